@@ -11,6 +11,8 @@
 */
 
 #include <linux/init.h>
+#include <linux/clk.h>
+#include <linux/err.h>
 #include <linux/interrupt.h>
 #include <linux/irq.h>
 #include <linux/ioport.h>
@@ -36,10 +38,7 @@
 #include <mach/regs-irq.h>
 #include <linux/gpio.h>
 #include <linux/cpufreq.h>
-
-#define CHECK_DELAY	(.5*HZ)
-#define TRANS_LOAD_L	20
-#define TRANS_LOAD_H	(TRANS_LOAD_L*3)
+#include <linux/hotplug_policy.h>
 
 #define HOTPLUG_UNLOCKED 0
 #define HOTPLUG_LOCKED 1
@@ -55,36 +54,59 @@ static struct workqueue_struct *hotplug_wq;
 
 static struct delayed_work hotplug_work;
 
-static unsigned int hotpluging_rate = CHECK_DELAY;
+/* Sampling period, in jiffies */
+static unsigned int hotpluging_rate = HZ / 10;
 module_param_named(rate, hotpluging_rate, uint, 0644);
+
+/* See struct hotplug_tunables for what these mean */
+static struct hotplug_tunables tunables = {
+	.window		= 5,
+	.load_l		= 20,
+	.load_h		= 60,
+	.nr_run_fast	= 2,
+	.down_delay	= 2000,
+	.low_freq	= LOWLEVEL_FREQ,
+};
+
+module_param_named(window, tunables.window, uint, 0644);
+module_param_named(loadl, tunables.load_l, uint, 0644);
+module_param_named(loadh, tunables.load_h, uint, 0644);
+module_param_named(nr_run_fast, tunables.nr_run_fast, uint, 0644);
+module_param_named(down_delay, tunables.down_delay, uint, 0644);
+module_param_named(low_freq, tunables.low_freq, uint, 0644);
 static unsigned int user_lock;
 module_param_named(lock, user_lock, uint, 0644);
-static unsigned int trans_load_l = TRANS_LOAD_L;
-module_param_named(loadl, trans_load_l, uint, 0644);
-static unsigned int trans_load_h = TRANS_LOAD_H;
-module_param_named(loadh, trans_load_h, uint, 0644);
 
 struct cpu_time_info {
 	cputime64_t prev_cpu_idle;
 	cputime64_t prev_cpu_wall;
-	unsigned int load;
+	unsigned int load[HOTPLUG_HISTORY_MAX];		/* % */
+	unsigned int nr_run[HOTPLUG_HISTORY_MAX];	/* tasks */
+	unsigned int head;
+	unsigned int count;
 };
 
 static DEFINE_PER_CPU(struct cpu_time_info, hotplug_cpu_time);
 
+/* Time of the last hotplug, in jiffies */
+static unsigned long hotplug_last_change;
+
+/* ARM clock, for when cpufreq does not know the speed */
+static struct clk *hotplug_armclk;
+
 /* mutex can be used since hotplug_timer does not run in
    timer(softirq) context but in process context */
 static DEFINE_MUTEX(hotplug_lock);
 
-static void hotplug_timer(struct work_struct *work)
+/*
+ * Record a load and run-queue sample for each online CPU. Returns false
+ * if some CPU's idle time could not be accounted, the sample is then
+ * dropped.
+ */
+static bool hotplug_sample(void)
 {
-	unsigned int i, avg_load = 0, load = 0;
-	unsigned int cur_freq;
-
-	mutex_lock(&hotplug_lock);
-
-	if (user_lock == 1)
-		goto no_hotplug;
+	unsigned int i;
+	unsigned int self = smp_processor_id();
 
 	for_each_online_cpu(i) {
 		struct cpu_time_info *tmp_info;
@@ -103,31 +125,127 @@ static void hotplug_timer(struct work_struct *work)
 							tmp_info->prev_cpu_wall);
 		tmp_info->prev_cpu_wall = cur_wall_time;
 
-		if (wall_time < idle_time)
-			goto no_hotplug;
+		if (!wall_time || wall_time < idle_time)
+			return false;
+
+		tmp_info->head = (tmp_info->head + 1) % HOTPLUG_HISTORY_MAX;
+		tmp_info->load[tmp_info->head] =
+			100 * (wall_time - idle_time) / wall_time;
+		/* Don't count ourselves as a runnable task */
+		tmp_info->nr_run[tmp_info->head] = nr_running_cpu(i) -
+			(i == self ? 1 : 0);
+		if (tmp_info->count < HOTPLUG_HISTORY_MAX)
+			tmp_info->count++;
+	}
+
+	return true;
+}
+
+/* Start a new window, the old samples were taken with other CPUs online */
+static void hotplug_reset_history(void)
+{
+	unsigned int i;
+
+	for_each_possible_cpu(i) {
+		struct cpu_time_info *tmp_info = &per_cpu(hotplug_cpu_time, i);
+
+		tmp_info->prev_cpu_idle = get_cpu_idle_time_us(i,
+						&tmp_info->prev_cpu_wall);
+		tmp_info->count = 0;
+	}
+}
+
+static void hotplug_get_stats(struct hotplug_stats *st, unsigned int window)
+{
+	unsigned int i, j, n;
+	unsigned int load, nr_run;
 
-		tmp_info->load = 100 * (wall_time - idle_time) / wall_time;
+	memset(st, 0, sizeof(*st));
+	st->online = num_online_cpus();
+	st->possible = num_possible_cpus();
+	st->samples = window;
 
-		load += tmp_info->load;
+	for_each_online_cpu(i) {
+		struct cpu_time_info *tmp_info = &per_cpu(hotplug_cpu_time, i);
+
+		n = min(tmp_info->count, window);
+		if (n < st->samples)
+			st->samples = n;
+		if (!n)
+			continue;
+
+		load = 0;
+		nr_run = 0;
+		for (j = 0; j < n; j++) {
+			unsigned int k = (tmp_info->head + HOTPLUG_HISTORY_MAX -
+					  j) % HOTPLUG_HISTORY_MAX;
+
+			load += tmp_info->load[k];
+			nr_run += tmp_info->nr_run[k];
+		}
+
+		st->load += load / n;
+		st->nr_run += nr_run * 100 / n;
+		st->nr_run_now += tmp_info->nr_run[tmp_info->head];
 	}
 
-	avg_load = load / num_online_cpus();
-
-	cur_freq = clk_get_rate(clk_get(NULL, "armclk"))/ 1000;
-
-	if (((avg_load < trans_load_l) || (cur_freq <= LOWLEVEL_FREQ)) &&
-	    (cpu_online(1) == 1)) {
-		DBG_PRINT("cpu1 turning off!\n");
-		cpu_down(1);
-		DBG_PRINT("cpu1 off end!\n");
-		hotpluging_rate = CHECK_DELAY;
-	} else if (((avg_load > trans_load_h) && (cur_freq > LOWLEVEL_FREQ)) &&
-		   (cpu_online(1) == 0)) {
-		DBG_PRINT("cpu1 turning on!\n");
-		cpu_up(1);
-		DBG_PRINT("cpu1 on end!\n");
-		hotpluging_rate = CHECK_DELAY * 4;
+	st->load /= st->online;
+}
+
+static unsigned int hotplug_cur_freq(void)
+{
+	unsigned int freq = cpufreq_quick_get(0);
+
+	if (!freq && !IS_ERR_OR_NULL(hotplug_armclk))
+		freq = clk_get_rate(hotplug_armclk) / 1000;
+
+	return freq;
+}
+
+static void hotplug_timer(struct work_struct *work)
+{
+	struct hotplug_stats st;
+	unsigned int window, cpu;
+
+	mutex_lock(&hotplug_lock);
+
+	window = clamp_t(unsigned int, tunables.window, 1,
+			 HOTPLUG_HISTORY_MAX);
+
+	if (user_lock == 1 || !hotplug_sample())
+		goto no_hotplug;
+
+	hotplug_get_stats(&st, window);
+	st.freq = hotplug_cur_freq();
+	st.since_change = jiffies_to_msecs(jiffies - hotplug_last_change);
+
+	switch (hotplug_decide(&st, &tunables)) {
+	case HOTPLUG_IN:
+		cpu = cpumask_next_zero(0, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			break;
+		DBG_PRINT("cpu turning on!\n");
+		if (!cpu_up(cpu)) {
+			hotplug_last_change = jiffies;
+			hotplug_reset_history();
+		}
+		break;
+	case HOTPLUG_OUT:
+		for (cpu = nr_cpu_ids - 1; cpu > 0; cpu--)
+			if (cpu_online(cpu))
+				break;
+		if (!cpu)
+			break;
+		DBG_PRINT("cpu turning off!\n");
+		if (!cpu_down(cpu)) {
+			hotplug_last_change = jiffies;
+			hotplug_reset_history();
+		}
+		break;
+	case HOTPLUG_NOP:
+		break;
 	}
+
  no_hotplug:
 
 	queue_delayed_work_on(0, hotplug_wq, &hotplug_work, hotpluging_rate);
@@ -189,6 +307,9 @@ static int __init s5pv310_pm_hotplug_init(void)
 		return -EFAULT;
 	}
 
+	hotplug_armclk = clk_get(NULL, "armclk");
+	hotplug_last_change = jiffies;
+
 	INIT_DELAYED_WORK_DEFERRABLE(&hotplug_work, hotplug_timer);
 
 	queue_delayed_work_on(0, hotplug_wq, &hotplug_work, 60 * HZ);
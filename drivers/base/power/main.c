@@ -23,6 +23,7 @@
 #include <linux/pm.h>
 #include <linux/pm_runtime.h>
 #include <linux/resume-trace.h>
+#include <linux/suspend_latency.h>
 #include <linux/interrupt.h>
 #include <linux/sched.h>
 #include <linux/async.h>
@@ -441,6 +442,7 @@ static void dpm_show_time(ktime_t starttime, pm_message_t state, char *info)
 static int device_resume_noirq(struct device *dev, pm_message_t state)
 {
 	int error = 0;
+	ktime_t starttime = ktime_get();
 
 	TRACE_DEVICE(dev);
 	TRACE_RESUME(0);
@@ -465,6 +467,8 @@ static int device_resume_noirq(struct device *dev, pm_message_t state)
 	}
 
 End:
+	pm_latency_record(PM_LATENCY_DEVICE_NOIRQ, state.event, dev_name(dev),
+			  starttime, error);
 	TRACE_RESUME(error);
 	return error;
 }
@@ -527,6 +531,7 @@ static int legacy_resume(struct device *dev, int (*cb)(struct device *dev))
 static int device_resume(struct device *dev, pm_message_t state, bool async)
 {
 	int error = 0;
+	ktime_t starttime;
 
 	TRACE_DEVICE(dev);
 	TRACE_RESUME(0);
@@ -535,6 +540,7 @@ static int device_resume(struct device *dev, pm_message_t state, bool async)
 			    dev->parent->power.status == DPM_RESUMING))
 		dpm_wait(dev->parent, async);
 	device_lock(dev);
+	starttime = ktime_get();
 
 	dev->power.status = DPM_RESUMING;
 
@@ -569,6 +575,8 @@ static int device_resume(struct device *dev, pm_message_t state, bool async)
 		}
 	}
  End:
+	pm_latency_record(PM_LATENCY_DEVICE, state.event, dev_name(dev),
+			  starttime, error);
 	device_unlock(dev);
 	complete_all(&dev->power.completion);
 
@@ -784,6 +792,7 @@ static pm_message_t resume_event(pm_message_t sleep_state)
 static int device_suspend_noirq(struct device *dev, pm_message_t state)
 {
 	int error = 0;
+	ktime_t starttime = ktime_get();
 
 	if (dev->class && dev->class->pm) {
 		pm_dev_dbg(dev, state, "LATE class ");
@@ -805,6 +814,8 @@ static int device_suspend_noirq(struct device *dev, pm_message_t state)
 	}
 
 End:
+	pm_latency_record(PM_LATENCY_DEVICE_NOIRQ, state.event, dev_name(dev),
+			  starttime, error);
 	return error;
 }
 
@@ -873,6 +884,7 @@ static int async_error;
 static int __device_suspend(struct device *dev, pm_message_t state, bool async)
 {
 	int error = 0;
+	ktime_t starttime;
 	struct timer_list timer;
 	struct dpm_drv_wd_data data;
 
@@ -887,6 +899,7 @@ static int __device_suspend(struct device *dev, pm_message_t state, bool async)
 	add_timer(&timer);
 
 	device_lock(dev);
+	starttime = ktime_get();
 
 	if (async_error)
 		goto End;
@@ -925,6 +938,8 @@ static int __device_suspend(struct device *dev, pm_message_t state, bool async)
 	if (!error)
 		dev->power.status = DPM_OFF;
 
+	pm_latency_record(PM_LATENCY_DEVICE, state.event, dev_name(dev),
+			  starttime, error);
  End:
 	device_unlock(dev);
 
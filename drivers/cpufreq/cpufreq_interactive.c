@@ -19,20 +19,43 @@
 #include <linux/cpu.h>
 #include <linux/cpumask.h>
 #include <linux/cpufreq.h>
+#include <linux/hrtimer.h>
+#include <linux/input.h>
 #include <linux/mutex.h>
 #include <linux/sched.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
 #include <linux/tick.h>
 #include <linux/timer.h>
-#include <linux/workqueue.h>
 #include <linux/kthread.h>
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/cpufreq_interactive.h>
+
 #include <asm/cputime.h>
 
 static void (*pm_idle_old)(void);
 static atomic_t active_count = ATOMIC_INIT(0);
 
+/*
+ * State shared by the CPUs of a policy, kept in the polinfo slot of the
+ * policy's managing CPU.  Speed changes for the policy are made by its
+ * own realtime task, so policies never wait on each other.
+ */
+struct cpufreq_interactive_policy {
+	struct cpufreq_policy *policy;
+	struct cpufreq_frequency_table *freq_table;
+	spinlock_t lock;		/* protects target_freq, pending */
+	unsigned int target_freq;	/* highest speed asked for by a CPU */
+	int pending;			/* target_freq not yet set */
+	struct task_struct *task;
+};
+
+static DEFINE_PER_CPU(struct cpufreq_interactive_policy, polinfo);
+
 struct cpufreq_interactive_cpuinfo {
 	struct timer_list cpu_timer;
+	struct timer_list cpu_slack_timer;
 	int timer_idlecancel;
 	u64 time_in_idle;
 	u64 idle_exit_time;
@@ -40,26 +63,26 @@ struct cpufreq_interactive_cpuinfo {
 	int idling;
 	u64 freq_change_time;
 	u64 freq_change_time_in_idle;
-	struct cpufreq_policy *policy;
-	struct cpufreq_frequency_table *freq_table;
-	unsigned int target_freq;
+	struct cpufreq_interactive_policy *ppol;
+	unsigned int target_freq;	/* speed this CPU's load asks for */
 	int governor_enabled;
 };
 
 static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
 
-/* Workqueues handle frequency scaling */
-static struct task_struct *up_task;
-static struct workqueue_struct *down_wq;
-static struct work_struct freq_scale_down_work;
-static cpumask_t up_cpumask;
-static spinlock_t up_cpumask_lock;
-static cpumask_t down_cpumask;
-static spinlock_t down_cpumask_lock;
+/* Hi speed to bump to from lo speed when load burst (default max) */
+static unsigned long hispeed_freq;
 
-/* Go to max speed when CPU load at or above this value. */
-#define DEFAULT_GO_MAXSPEED_LOAD 85
-static unsigned long go_maxspeed_load;
+/* Go to hi speed when CPU load at or above this value. */
+#define DEFAULT_GO_HISPEED_LOAD 85
+static unsigned long go_hispeed_load;
+
+/*
+ * The minimum amount of time to spend at hispeed_freq before ramping
+ * further up on load.
+ */
+#define DEFAULT_ABOVE_HISPEED_DELAY 20000
+static unsigned long above_hispeed_delay;
 
 /*
  * The minimum amount of time to spend at a frequency before we can ramp down.
@@ -67,96 +90,45 @@ static unsigned long go_maxspeed_load;
 #define DEFAULT_MIN_SAMPLE_TIME 80000;
 static unsigned long min_sample_time;
 
-#define DEBUG 0
-#define BUFSZ 128
-
-#if DEBUG
-#include <linux/proc_fs.h>
-
-struct dbgln {
-	int cpu;
-	unsigned long jiffy;
-	unsigned long run;
-	char buf[BUFSZ];
-};
-
-#define NDBGLNS 256
-
-static struct dbgln dbgbuf[NDBGLNS];
-static int dbgbufs;
-static int dbgbufe;
-static struct proc_dir_entry	*dbg_proc;
-static spinlock_t dbgpr_lock;
-
-static u64 up_request_time;
-static unsigned int up_max_latency;
-
-static void dbgpr(char *fmt, ...)
-{
-	va_list args;
-	int n;
-	unsigned long flags;
-
-	spin_lock_irqsave(&dbgpr_lock, flags);
-	n = dbgbufe;
-        va_start(args, fmt);
-        vsnprintf(dbgbuf[n].buf, BUFSZ, fmt, args);
-        va_end(args);
-	dbgbuf[n].cpu = smp_processor_id();
-	dbgbuf[n].run = nr_running();
-	dbgbuf[n].jiffy = jiffies;
+/*
+ * The load sampling timers are deferrable and never wake an idle CPU.
+ * A CPU going idle above the lowest speed arms a non-deferrable timer
+ * this many uS later so its speed is re-evaluated at some point, or
+ * never if negative.
+ */
+#define DEFAULT_TIMER_SLACK 80000
+static long timer_slack;
 
-	if (++dbgbufe >= NDBGLNS)
-		dbgbufe = 0;
+/*
+ * Boost to at least hispeed_freq while boost is set, and for
+ * boostpulse_duration uS after a write to boostpulse or an input event.
+ */
+static int boost_val;
+#define DEFAULT_BOOSTPULSE_DURATION 80000
+static unsigned long boostpulse_duration;
+static u64 boostpulse_endtime;
+/* Written from input events, a u64 can't be read in one go everywhere */
+static DEFINE_SEQLOCK(boostpulse_lock);
 
-	if (dbgbufe == dbgbufs)
-		if (++dbgbufs >= NDBGLNS)
-			dbgbufs = 0;
+/* Boost on touchscreen and key events. */
+static int input_boost = 1;
 
-	spin_unlock_irqrestore(&dbgpr_lock, flags);
-}
+static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
+		unsigned int event);
 
-static void dbgdump(void)
+static u64 cpufreq_interactive_boostpulse_end(void)
 {
-	int i, j;
-	unsigned long flags;
-	static struct dbgln prbuf[NDBGLNS];
+	unsigned int seq;
+	u64 endtime;
 
-	spin_lock_irqsave(&dbgpr_lock, flags);
-	i = dbgbufs;
-	j = dbgbufe;
-	memcpy(prbuf, dbgbuf, sizeof(dbgbuf));
-	dbgbufs = 0;
-	dbgbufe = 0;
-	spin_unlock_irqrestore(&dbgpr_lock, flags);
-
-	while (i != j)
-	{
-		printk("%lu %d %lu %s",
-		       prbuf[i].jiffy, prbuf[i].cpu, prbuf[i].run,
-		       prbuf[i].buf);
-		if (++i == NDBGLNS)
-			i = 0;
-	}
-}
+	do {
+		seq = read_seqbegin(&boostpulse_lock);
+		endtime = boostpulse_endtime;
+	} while (read_seqretry(&boostpulse_lock, seq));
 
-static int dbg_proc_read(char *buffer, char **start, off_t offset,
-			       int count, int *peof, void *dat)
-{
-	printk("max up_task latency=%uus\n", up_max_latency);
-	dbgdump();
-	*peof = 1;
-	return 0;
+	return endtime;
 }
 
-
-#else
-#define dbgpr(...) do {} while (0)
-#endif
-
-static int cpufreq_governor_interactive(struct cpufreq_policy *policy,
-		unsigned int event);
-
 #ifndef CONFIG_CPU_FREQ_DEFAULT_GOV_INTERACTIVE
 static
 #endif
@@ -167,6 +139,43 @@ struct cpufreq_governor cpufreq_gov_interactive = {
 	.owner = THIS_MODULE,
 };
 
+/*
+ * Set the policy speed to the highest one asked for by its CPUs, leaving
+ * out the idle ones other than @cpu, and kick the speed change task if
+ * that differs from the current target.  Called with ppol->lock held.
+ */
+static void cpufreq_interactive_update_policy(
+	struct cpufreq_interactive_policy *ppol, unsigned int cpu)
+{
+	unsigned int j;
+	unsigned int max_freq = 0;
+	struct cpufreq_interactive_cpuinfo *pjcpu;
+
+	for_each_cpu_and(j, ppol->policy->cpus, cpu_online_mask) {
+		pjcpu = &per_cpu(cpuinfo, j);
+
+		if (j != cpu && pjcpu->idling)
+			continue;
+
+		if (pjcpu->target_freq > max_freq)
+			max_freq = pjcpu->target_freq;
+	}
+
+	if (!max_freq || max_freq == ppol->target_freq)
+		return;
+
+	ppol->target_freq = max_freq;
+	ppol->pending = 1;
+	wake_up_process(ppol->task);
+}
+
+static void cpufreq_interactive_timer_start(
+	struct cpufreq_interactive_cpuinfo *pcpu, unsigned int cpu)
+{
+	pcpu->time_in_idle = get_cpu_idle_time_us(cpu, &pcpu->idle_exit_time);
+	mod_timer(&pcpu->cpu_timer, jiffies + 2);
+}
+
 static void cpufreq_interactive_timer(unsigned long data)
 {
 	unsigned int delta_idle;
@@ -177,16 +186,20 @@ static void cpufreq_interactive_timer(unsigned long data)
 	u64 idle_exit_time;
 	struct cpufreq_interactive_cpuinfo *pcpu =
 		&per_cpu(cpuinfo, data);
+	struct cpufreq_interactive_policy *ppol;
 	u64 now_idle;
 	unsigned int new_freq;
 	unsigned int index;
 	unsigned long flags;
+	int boosted;
 
 	smp_rmb();
 
 	if (!pcpu->governor_enabled)
 		goto exit;
 
+	ppol = pcpu->ppol;
+
 	/*
 	 * Once pcpu->timer_run_time is updated to >= pcpu->idle_exit_time,
 	 * this lets idle exit know the current idle time sample has
@@ -202,16 +215,8 @@ static void cpufreq_interactive_timer(unsigned long data)
 	smp_wmb();
 
 	/* If we raced with cancelling a timer, skip. */
-	if (!idle_exit_time) {
-		dbgpr("timer %d: no valid idle exit sample\n", (int) data);
+	if (!idle_exit_time)
 		goto exit;
-	}
-
-#if DEBUG
-	if ((int) jiffies - (int) pcpu->cpu_timer.expires >= 10)
-		dbgpr("timer %d: late by %d ticks\n",
-		      (int) data, jiffies - pcpu->cpu_timer.expires);
-#endif
 
 	delta_idle = (unsigned int) cputime64_sub(now_idle, time_in_idle);
 	delta_time = (unsigned int) cputime64_sub(pcpu->timer_run_time,
@@ -220,11 +225,8 @@ static void cpufreq_interactive_timer(unsigned long data)
 	/*
 	 * If timer ran less than 1ms after short-term sample started, retry.
 	 */
-	if (delta_time < 1000) {
-		dbgpr("timer %d: time delta %u too short exit=%llu now=%llu\n", (int) data,
-		      delta_time, idle_exit_time, pcpu->timer_run_time);
+	if (delta_time < 1000)
 		goto rearm;
-	}
 
 	if (delta_idle > delta_time)
 		cpu_load = 0;
@@ -250,23 +252,48 @@ static void cpufreq_interactive_timer(unsigned long data)
 	if (load_since_change > cpu_load)
 		cpu_load = load_since_change;
 
-	if (cpu_load >= go_maxspeed_load)
-		new_freq = pcpu->policy->max;
-	else
-		new_freq = pcpu->policy->max * cpu_load / 100;
+	boosted = boost_val ||
+		pcpu->timer_run_time < cpufreq_interactive_boostpulse_end();
+
+	if (cpu_load >= go_hispeed_load || boosted) {
+		if (pcpu->target_freq < hispeed_freq) {
+			new_freq = hispeed_freq;
+		} else {
+			new_freq = ppol->policy->max * cpu_load / 100;
+
+			if (new_freq < hispeed_freq)
+				new_freq = hispeed_freq;
+
+			/*
+			 * Hold at hispeed_freq for above_hispeed_delay
+			 * before going any higher, a short burst is
+			 * usually over by then.
+			 */
+			if (pcpu->target_freq == hispeed_freq &&
+			    new_freq > hispeed_freq &&
+			    cputime64_sub(pcpu->timer_run_time,
+					  pcpu->freq_change_time) <
+			    above_hispeed_delay) {
+				trace_cpufreq_interactive_notyet(data, cpu_load,
+						pcpu->target_freq, new_freq);
+				goto rearm;
+			}
+		}
+	} else {
+		new_freq = ppol->policy->max * cpu_load / 100;
+	}
 
-	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
+	if (cpufreq_frequency_table_target(ppol->policy, ppol->freq_table,
 					   new_freq, CPUFREQ_RELATION_H,
-					   &index)) {
-		dbgpr("timer %d: cpufreq_frequency_table_target error\n", (int) data);
+					   &index))
 		goto rearm;
-	}
 
-	new_freq = pcpu->freq_table[index].frequency;
+	new_freq = ppol->freq_table[index].frequency;
 
 	if (pcpu->target_freq == new_freq)
 	{
-		dbgpr("timer %d: load=%d, already at %d\n", (int) data, cpu_load, new_freq);
+		trace_cpufreq_interactive_already(data, cpu_load,
+						  pcpu->target_freq, new_freq);
 		goto rearm_if_notmax;
 	}
 
@@ -277,36 +304,29 @@ static void cpufreq_interactive_timer(unsigned long data)
 	if (new_freq < pcpu->target_freq) {
 		if (cputime64_sub(pcpu->timer_run_time, pcpu->freq_change_time) <
 		    min_sample_time) {
-			dbgpr("timer %d: load=%d cur=%d tgt=%d not yet\n", (int) data, cpu_load, pcpu->target_freq, new_freq);
+			trace_cpufreq_interactive_notyet(data, cpu_load,
+						pcpu->target_freq, new_freq);
 			goto rearm;
 		}
 	}
 
-	dbgpr("timer %d: load=%d cur=%d tgt=%d queue\n", (int) data, cpu_load, pcpu->target_freq, new_freq);
+	trace_cpufreq_interactive_target(data, cpu_load, pcpu->target_freq,
+					 new_freq);
 
-	if (new_freq < pcpu->target_freq) {
-		pcpu->target_freq = new_freq;
-		spin_lock_irqsave(&down_cpumask_lock, flags);
-		cpumask_set_cpu(data, &down_cpumask);
-		spin_unlock_irqrestore(&down_cpumask_lock, flags);
-		queue_work(down_wq, &freq_scale_down_work);
-	} else {
-		pcpu->target_freq = new_freq;
-#if DEBUG
-		up_request_time = ktime_to_us(ktime_get());
-#endif
-		spin_lock_irqsave(&up_cpumask_lock, flags);
-		cpumask_set_cpu(data, &up_cpumask);
-		spin_unlock_irqrestore(&up_cpumask_lock, flags);
-		wake_up_process(up_task);
-	}
+	spin_lock_irqsave(&ppol->lock, flags);
+	pcpu->target_freq = new_freq;
+	cpufreq_interactive_update_policy(ppol, data);
+	spin_unlock_irqrestore(&ppol->lock, flags);
+
+	pcpu->freq_change_time_in_idle =
+		get_cpu_idle_time_us(data, &pcpu->freq_change_time);
 
 rearm_if_notmax:
 	/*
 	 * Already set max speed and don't see a need to change that,
 	 * wait until next idle to re-evaluate, don't need timer.
 	 */
-	if (pcpu->target_freq == pcpu->policy->max)
+	if (pcpu->target_freq == ppol->policy->max)
 		goto exit;
 
 rearm:
@@ -316,27 +336,30 @@ rearm:
 		 * Else cancel the timer if that CPU goes idle.  We don't
 		 * need to re-evaluate speed until the next idle exit.
 		 */
-		if (pcpu->target_freq == pcpu->policy->min) {
+		if (pcpu->target_freq == ppol->policy->min) {
 			smp_rmb();
 
-			if (pcpu->idling) {
-				dbgpr("timer %d: cpu idle, don't re-arm\n", (int) data);
+			if (pcpu->idling)
 				goto exit;
-			}
 
 			pcpu->timer_idlecancel = 1;
 		}
 
-		pcpu->time_in_idle = get_cpu_idle_time_us(
-			data, &pcpu->idle_exit_time);
-		mod_timer(&pcpu->cpu_timer, jiffies + 2);
-		dbgpr("timer %d: set timer for %lu exit=%llu\n", (int) data, pcpu->cpu_timer.expires, pcpu->idle_exit_time);
+		cpufreq_interactive_timer_start(pcpu, data);
 	}
 
 exit:
 	return;
 }
 
+/*
+ * Only there to wake up an idle CPU so that its deferred load timer
+ * gets to run.
+ */
+static void cpufreq_interactive_nop_timer(unsigned long data)
+{
+}
+
 static void cpufreq_interactive_idle(void)
 {
 	struct cpufreq_interactive_cpuinfo *pcpu =
@@ -352,25 +375,25 @@ static void cpufreq_interactive_idle(void)
 	smp_wmb();
 	pending = timer_pending(&pcpu->cpu_timer);
 
-	if (pcpu->target_freq != pcpu->policy->min) {
+	if (pcpu->target_freq != pcpu->ppol->policy->min) {
 #ifdef CONFIG_SMP
 		/*
-		 * Entering idle while not at lowest speed.  On some
-		 * platforms this can hold the other CPU(s) at that speed
-		 * even though the CPU is idle. Set a timer to re-evaluate
-		 * speed so this idle CPU doesn't hold the other CPUs above
-		 * min indefinitely.  This should probably be a quirk of
-		 * the CPUFreq driver.
+		 * Entering idle while not at lowest speed.  The other
+		 * CPUs of the policy stop counting this CPU's speed, but
+		 * the deferrable timer does not run while this CPU is
+		 * idle, so if every CPU of the policy is idle nothing would
+		 * re-evaluate the speed until the next idle exit.  Wake
+		 * up after timer_slack to do so.
 		 */
 		if (!pending) {
-			pcpu->time_in_idle = get_cpu_idle_time_us(
-				smp_processor_id(), &pcpu->idle_exit_time);
 			pcpu->timer_idlecancel = 0;
-			mod_timer(&pcpu->cpu_timer, jiffies + 2);
-			dbgpr("idle: enter at %d, set timer for %lu exit=%llu\n",
-			      pcpu->target_freq, pcpu->cpu_timer.expires,
-			      pcpu->idle_exit_time);
+			cpufreq_interactive_timer_start(pcpu,
+							smp_processor_id());
 		}
+
+		if (timer_slack >= 0)
+			mod_timer(&pcpu->cpu_slack_timer,
+				  jiffies + usecs_to_jiffies(timer_slack));
 #endif
 	} else {
 		/*
@@ -380,7 +403,6 @@ static void cpufreq_interactive_idle(void)
 		 * CPU didn't go busy; we'll recheck things upon idle exit.
 		 */
 		if (pending && pcpu->timer_idlecancel) {
-			dbgpr("idle: cancel timer for %lu\n", pcpu->cpu_timer.expires);
 			del_timer(&pcpu->cpu_timer);
 			/*
 			 * Ensure last timer run time is after current idle
@@ -396,6 +418,9 @@ static void cpufreq_interactive_idle(void)
 	pcpu->idling = 0;
 	smp_wmb();
 
+	if (timer_pending(&pcpu->cpu_slack_timer))
+		del_timer(&pcpu->cpu_slack_timer);
+
 	/*
 	 * Arm the timer for 1-2 ticks later if not already, and if the timer
 	 * function has already processed the previous load sampling
@@ -410,137 +435,261 @@ static void cpufreq_interactive_idle(void)
 	if (timer_pending(&pcpu->cpu_timer) == 0 &&
 	    pcpu->timer_run_time >= pcpu->idle_exit_time &&
 	    pcpu->governor_enabled) {
-		pcpu->time_in_idle =
-			get_cpu_idle_time_us(smp_processor_id(),
-					     &pcpu->idle_exit_time);
 		pcpu->timer_idlecancel = 0;
-		mod_timer(&pcpu->cpu_timer, jiffies + 2);
-		dbgpr("idle: exit, set timer for %lu exit=%llu\n", pcpu->cpu_timer.expires, pcpu->idle_exit_time);
-#if DEBUG
-	} else if (timer_pending(&pcpu->cpu_timer) == 0 &&
-		   pcpu->timer_run_time < pcpu->idle_exit_time) {
-		dbgpr("idle: timer not run yet: exit=%llu tmrrun=%llu\n",
-		      pcpu->idle_exit_time, pcpu->timer_run_time);
-#endif
+		cpufreq_interactive_timer_start(pcpu, smp_processor_id());
 	}
-
 }
 
-static int cpufreq_interactive_up_task(void *data)
+static int cpufreq_interactive_speedchange_task(void *data)
 {
-	unsigned int cpu;
-	cpumask_t tmp_mask;
+	struct cpufreq_interactive_policy *ppol = data;
+	unsigned int target_freq;
+	unsigned int old_freq;
 	unsigned long flags;
-	struct cpufreq_interactive_cpuinfo *pcpu;
-
-#if DEBUG
-	u64 now;
-	u64 then;
-	unsigned int lat;
-#endif
 
 	while (1) {
 		set_current_state(TASK_INTERRUPTIBLE);
-		spin_lock_irqsave(&up_cpumask_lock, flags);
+		spin_lock_irqsave(&ppol->lock, flags);
 
-		if (cpumask_empty(&up_cpumask)) {
-			spin_unlock_irqrestore(&up_cpumask_lock, flags);
-			schedule();
+		if (!ppol->pending) {
+			spin_unlock_irqrestore(&ppol->lock, flags);
 
 			if (kthread_should_stop())
 				break;
 
-			spin_lock_irqsave(&up_cpumask_lock, flags);
+			schedule();
+			continue;
 		}
 
-		set_current_state(TASK_RUNNING);
+		ppol->pending = 0;
+		target_freq = ppol->target_freq;
+		spin_unlock_irqrestore(&ppol->lock, flags);
+		__set_current_state(TASK_RUNNING);
 
-#if DEBUG
-		then = up_request_time;
-		now = ktime_to_us(ktime_get());
-
-		if (now > then) {
-			lat = ktime_to_us(ktime_get()) - then;
+		old_freq = ppol->policy->cur;
+		__cpufreq_driver_target(ppol->policy, target_freq,
+					CPUFREQ_RELATION_H);
 
-			if (lat > up_max_latency)
-				up_max_latency = lat;
-		}
-#endif
+		if (target_freq > old_freq)
+			trace_cpufreq_interactive_up(ppol->policy->cpu,
+						     target_freq,
+						     ppol->policy->cur);
+		else
+			trace_cpufreq_interactive_down(ppol->policy->cpu,
+						       target_freq,
+						       ppol->policy->cur);
+	}
 
-		tmp_mask = up_cpumask;
-		cpumask_clear(&up_cpumask);
-		spin_unlock_irqrestore(&up_cpumask_lock, flags);
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
 
-		for_each_cpu(cpu, &tmp_mask) {
-			pcpu = &per_cpu(cpuinfo, cpu);
+/*
+ * Raise every CPU running the governor to at least hispeed_freq now,
+ * rather than waiting for the timer to measure the load.  The timer
+ * keeps them there for as long as the boost lasts.
+ */
+static void cpufreq_interactive_boost(void)
+{
+	int i;
+	unsigned long flags;
+	unsigned int freq;
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	struct cpufreq_interactive_policy *ppol;
 
-			if (nr_running() == 1) {
-				dbgpr("up %d: tgt=%d nothing else running\n", cpu,
-				      pcpu->target_freq);
-			}
+	for_each_online_cpu(i) {
+		pcpu = &per_cpu(cpuinfo, i);
 
-			smp_rmb();
+		if (!pcpu->governor_enabled)
+			continue;
 
-			if (!pcpu->governor_enabled)
-				continue;
+		ppol = pcpu->ppol;
+		spin_lock_irqsave(&ppol->lock, flags);
+		freq = min_t(unsigned int, hispeed_freq, ppol->policy->max);
 
-			__cpufreq_driver_target(pcpu->policy,
-						pcpu->target_freq,
-						CPUFREQ_RELATION_H);
-			pcpu->freq_change_time_in_idle =
-				get_cpu_idle_time_us(cpu,
-						     &pcpu->freq_change_time);
-			dbgpr("up %d: set tgt=%d (actual=%d)\n", cpu, pcpu->target_freq, pcpu->policy->cur);
+		/* Recheck, the policy may be stopping its task. */
+		if (pcpu->governor_enabled && pcpu->target_freq < freq) {
+			pcpu->target_freq = freq;
+			cpufreq_interactive_update_policy(ppol, i);
 		}
-	}
 
-	return 0;
+		spin_unlock_irqrestore(&ppol->lock, flags);
+	}
 }
 
-static void cpufreq_interactive_freq_down(struct work_struct *work)
+static void cpufreq_interactive_boostpulse(const char *s)
 {
-	unsigned int cpu;
-	cpumask_t tmp_mask;
+	u64 now = ktime_to_us(ktime_get());
 	unsigned long flags;
-	struct cpufreq_interactive_cpuinfo *pcpu;
+	int boosted;
 
-	spin_lock_irqsave(&down_cpumask_lock, flags);
-	tmp_mask = down_cpumask;
-	cpumask_clear(&down_cpumask);
-	spin_unlock_irqrestore(&down_cpumask_lock, flags);
+	write_seqlock_irqsave(&boostpulse_lock, flags);
+	boosted = now < boostpulse_endtime;
+	boostpulse_endtime = now + boostpulse_duration;
+	write_sequnlock_irqrestore(&boostpulse_lock, flags);
 
-	for_each_cpu(cpu, &tmp_mask) {
-		pcpu = &per_cpu(cpuinfo, cpu);
+	/* Still boosted, the timers keep the CPUs at hispeed_freq. */
+	if (boosted)
+		return;
 
-		smp_rmb();
+	trace_cpufreq_interactive_boost(s);
+	cpufreq_interactive_boost();
+}
 
-		if (!pcpu->governor_enabled)
-			continue;
+static void cpufreq_interactive_input_event(struct input_handle *handle,
+					    unsigned int type,
+					    unsigned int code, int value)
+{
+	if (!input_boost || !atomic_read(&active_count))
+		return;
 
-		__cpufreq_driver_target(pcpu->policy,
-					pcpu->target_freq,
-					CPUFREQ_RELATION_H);
-		pcpu->freq_change_time_in_idle =
-			get_cpu_idle_time_us(cpu,
-					     &pcpu->freq_change_time);
-		dbgpr("down %d: set tgt=%d (actual=%d)\n", cpu, pcpu->target_freq, pcpu->policy->cur);
-	}
+	if (type == EV_ABS || type == EV_KEY)
+		cpufreq_interactive_boostpulse("input");
+}
+
+static int cpufreq_interactive_input_connect(struct input_handler *handler,
+					     struct input_dev *dev,
+					     const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int error;
+
+	handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "cpufreq_interactive";
+
+	error = input_register_handle(handle);
+	if (error)
+		goto err_free;
+
+	error = input_open_device(handle);
+	if (error)
+		goto err_unregister;
+
+	return 0;
+
+err_unregister:
+	input_unregister_handle(handle);
+err_free:
+	kfree(handle);
+	return error;
 }
 
-static ssize_t show_go_maxspeed_load(struct kobject *kobj,
+static void cpufreq_interactive_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id cpufreq_interactive_ids[] = {
+	{
+		/* multi-touch touchscreen */
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) |
+			    BIT_MASK(ABS_MT_POSITION_Y) },
+	},
+	{
+		/* touchpad */
+		.flags = INPUT_DEVICE_ID_MATCH_KEYBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.keybit = { [BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH) },
+		.absbit = { [BIT_WORD(ABS_X)] =
+			    BIT_MASK(ABS_X) | BIT_MASK(ABS_Y) },
+	},
+	{
+		/* keys and buttons */
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+	},
+	{ },
+};
+
+static struct input_handler cpufreq_interactive_input_handler = {
+	.event		= cpufreq_interactive_input_event,
+	.connect	= cpufreq_interactive_input_connect,
+	.disconnect	= cpufreq_interactive_input_disconnect,
+	.name		= "cpufreq_interactive",
+	.id_table	= cpufreq_interactive_ids,
+};
+
+static ssize_t show_hispeed_freq(struct kobject *kobj,
+				 struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", hispeed_freq);
+}
+
+static ssize_t store_hispeed_freq(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	hispeed_freq = val;
+	return count;
+}
+
+static struct global_attr hispeed_freq_attr = __ATTR(hispeed_freq, 0644,
+		show_hispeed_freq, store_hispeed_freq);
+
+static ssize_t show_go_hispeed_load(struct kobject *kobj,
 				     struct attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", go_maxspeed_load);
+	return sprintf(buf, "%lu\n", go_hispeed_load);
 }
 
-static ssize_t store_go_maxspeed_load(struct kobject *kobj,
+static ssize_t store_go_hispeed_load(struct kobject *kobj,
 			struct attribute *attr, const char *buf, size_t count)
 {
-	return strict_strtoul(buf, 0, &go_maxspeed_load);
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	go_hispeed_load = val;
+	return count;
 }
 
+static struct global_attr go_hispeed_load_attr = __ATTR(go_hispeed_load, 0644,
+		show_go_hispeed_load, store_go_hispeed_load);
+
+/* The old name, for userspace written before hispeed_freq */
 static struct global_attr go_maxspeed_load_attr = __ATTR(go_maxspeed_load, 0644,
-		show_go_maxspeed_load, store_go_maxspeed_load);
+		show_go_hispeed_load, store_go_hispeed_load);
+
+static ssize_t show_above_hispeed_delay(struct kobject *kobj,
+					struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", above_hispeed_delay);
+}
+
+static ssize_t store_above_hispeed_delay(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	above_hispeed_delay = val;
+	return count;
+}
+
+static struct global_attr above_hispeed_delay_attr =
+	__ATTR(above_hispeed_delay, 0644,
+	       show_above_hispeed_delay, store_above_hispeed_delay);
 
 static ssize_t show_min_sample_time(struct kobject *kobj,
 				struct attribute *attr, char *buf)
@@ -551,15 +700,138 @@ static ssize_t show_min_sample_time(struct kobject *kobj,
 static ssize_t store_min_sample_time(struct kobject *kobj,
 			struct attribute *attr, const char *buf, size_t count)
 {
-	return strict_strtoul(buf, 0, &min_sample_time);
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	min_sample_time = val;
+	return count;
 }
 
 static struct global_attr min_sample_time_attr = __ATTR(min_sample_time, 0644,
 		show_min_sample_time, store_min_sample_time);
 
+static ssize_t show_timer_slack(struct kobject *kobj,
+				struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%ld\n", timer_slack);
+}
+
+static ssize_t store_timer_slack(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	long val;
+
+	ret = strict_strtol(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	timer_slack = val;
+	return count;
+}
+
+static struct global_attr timer_slack_attr = __ATTR(timer_slack, 0644,
+		show_timer_slack, store_timer_slack);
+
+static ssize_t show_boost(struct kobject *kobj, struct attribute *attr,
+			  char *buf)
+{
+	return sprintf(buf, "%d\n", boost_val);
+}
+
+static ssize_t store_boost(struct kobject *kobj, struct attribute *attr,
+			   const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+
+	boost_val = !!val;
+
+	if (boost_val) {
+		trace_cpufreq_interactive_boost("on");
+		cpufreq_interactive_boost();
+	} else {
+		trace_cpufreq_interactive_unboost("off");
+	}
+
+	return count;
+}
+
+static struct global_attr boost_attr = __ATTR(boost, 0644,
+		show_boost, store_boost);
+
+static ssize_t store_boostpulse(struct kobject *kobj, struct attribute *attr,
+				const char *buf, size_t count)
+{
+	cpufreq_interactive_boostpulse("pulse");
+	return count;
+}
+
+static struct global_attr boostpulse_attr = __ATTR(boostpulse, 0200,
+		NULL, store_boostpulse);
+
+static ssize_t show_boostpulse_duration(struct kobject *kobj,
+					struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", boostpulse_duration);
+}
+
+static ssize_t store_boostpulse_duration(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	boostpulse_duration = val;
+	return count;
+}
+
+static struct global_attr boostpulse_duration_attr =
+	__ATTR(boostpulse_duration, 0644,
+	       show_boostpulse_duration, store_boostpulse_duration);
+
+static ssize_t show_input_boost(struct kobject *kobj, struct attribute *attr,
+				char *buf)
+{
+	return sprintf(buf, "%d\n", input_boost);
+}
+
+static ssize_t store_input_boost(struct kobject *kobj, struct attribute *attr,
+				 const char *buf, size_t count)
+{
+	int ret;
+	unsigned long val;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+	input_boost = !!val;
+	return count;
+}
+
+static struct global_attr input_boost_attr = __ATTR(input_boost, 0644,
+		show_input_boost, store_input_boost);
+
 static struct attribute *interactive_attributes[] = {
+	&hispeed_freq_attr.attr,
+	&go_hispeed_load_attr.attr,
 	&go_maxspeed_load_attr.attr,
+	&above_hispeed_delay_attr.attr,
 	&min_sample_time_attr.attr,
+	&timer_slack_attr.attr,
+	&boost_attr.attr,
+	&boostpulse_attr.attr,
+	&boostpulse_duration_attr.attr,
+	&input_boost_attr.attr,
 	NULL,
 };
 
@@ -572,22 +844,46 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 		unsigned int event)
 {
 	int rc;
-	struct cpufreq_interactive_cpuinfo *pcpu =
-		&per_cpu(cpuinfo, new_policy->cpu);
+	unsigned int j;
+	unsigned long flags;
+	struct cpufreq_interactive_cpuinfo *pcpu;
+	struct cpufreq_interactive_policy *ppol =
+		&per_cpu(polinfo, new_policy->cpu);
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
 
 	switch (event) {
 	case CPUFREQ_GOV_START:
 		if (!cpu_online(new_policy->cpu))
 			return -EINVAL;
 
-		pcpu->policy = new_policy;
-		pcpu->freq_table = cpufreq_frequency_get_table(new_policy->cpu);
-		pcpu->target_freq = new_policy->cur;
-		pcpu->freq_change_time_in_idle =
-			get_cpu_idle_time_us(new_policy->cpu,
-					     &pcpu->freq_change_time);
-		pcpu->governor_enabled = 1;
+		ppol->policy = new_policy;
+		ppol->freq_table = cpufreq_frequency_get_table(new_policy->cpu);
+		ppol->target_freq = new_policy->cur;
+		ppol->pending = 0;
+		ppol->task = kthread_create(cpufreq_interactive_speedchange_task,
+					    ppol, "kinteractive/%u",
+					    new_policy->cpu);
+		if (IS_ERR(ppol->task))
+			return PTR_ERR(ppol->task);
+
+		sched_setscheduler_nocheck(ppol->task, SCHED_FIFO, &param);
+		get_task_struct(ppol->task);
+		wake_up_process(ppol->task);
+
+		for_each_cpu(j, new_policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+			pcpu->ppol = ppol;
+			pcpu->target_freq = new_policy->cur;
+			pcpu->freq_change_time_in_idle =
+				get_cpu_idle_time_us(j,
+						     &pcpu->freq_change_time);
+			pcpu->governor_enabled = 1;
+		}
 		smp_wmb();
+
+		if (!hispeed_freq)
+			hispeed_freq = new_policy->max;
+
 		/*
 		 * Do not register the idle hook and create sysfs
 		 * entries if we have already done so.
@@ -605,17 +901,28 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 		break;
 
 	case CPUFREQ_GOV_STOP:
-		pcpu->governor_enabled = 0;
-		smp_wmb();
-		del_timer_sync(&pcpu->cpu_timer);
-		flush_work(&freq_scale_down_work);
-		/*
-		 * Reset idle exit time since we may cancel the timer
-		 * before it can run after the last idle exit time,
-		 * to avoid tripping the check in idle exit for a timer
-		 * that is trying to run.
-		 */
-		pcpu->idle_exit_time = 0;
+		spin_lock_irqsave(&ppol->lock, flags);
+		for_each_cpu(j, new_policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+			pcpu->governor_enabled = 0;
+		}
+		spin_unlock_irqrestore(&ppol->lock, flags);
+
+		for_each_cpu(j, new_policy->cpus) {
+			pcpu = &per_cpu(cpuinfo, j);
+			del_timer_sync(&pcpu->cpu_timer);
+			del_timer_sync(&pcpu->cpu_slack_timer);
+			/*
+			 * Reset idle exit time since we may cancel the timer
+			 * before it can run after the last idle exit time,
+			 * to avoid tripping the check in idle exit for a
+			 * timer that is trying to run.
+			 */
+			pcpu->idle_exit_time = 0;
+		}
+
+		kthread_stop(ppol->task);
+		put_task_struct(ppol->task);
 
 		if (atomic_dec_return(&active_count) > 0)
 			return 0;
@@ -642,51 +949,28 @@ static int __init cpufreq_interactive_init(void)
 {
 	unsigned int i;
 	struct cpufreq_interactive_cpuinfo *pcpu;
-	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
 
-	go_maxspeed_load = DEFAULT_GO_MAXSPEED_LOAD;
+	go_hispeed_load = DEFAULT_GO_HISPEED_LOAD;
+	above_hispeed_delay = DEFAULT_ABOVE_HISPEED_DELAY;
 	min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
+	timer_slack = DEFAULT_TIMER_SLACK;
+	boostpulse_duration = DEFAULT_BOOSTPULSE_DURATION;
 
 	/* Initalize per-cpu timers */
 	for_each_possible_cpu(i) {
 		pcpu = &per_cpu(cpuinfo, i);
-		init_timer(&pcpu->cpu_timer);
+		init_timer_deferrable(&pcpu->cpu_timer);
 		pcpu->cpu_timer.function = cpufreq_interactive_timer;
 		pcpu->cpu_timer.data = i;
+		init_timer(&pcpu->cpu_slack_timer);
+		pcpu->cpu_slack_timer.function = cpufreq_interactive_nop_timer;
+		spin_lock_init(&per_cpu(polinfo, i).lock);
 	}
 
-	up_task = kthread_create(cpufreq_interactive_up_task, NULL,
-				 "kinteractiveup");
-	if (IS_ERR(up_task))
-		return PTR_ERR(up_task);
-
-	sched_setscheduler_nocheck(up_task, SCHED_FIFO, &param);
-	get_task_struct(up_task);
-
-	/* No rescuer thread, bind to CPU queuing the work for possibly
-	   warm cache (probably doesn't matter much). */
-	down_wq = alloc_workqueue("knteractive_down", 0, 1);
-
-	if (! down_wq)
-		goto err_freeuptask;
-
-	INIT_WORK(&freq_scale_down_work,
-		  cpufreq_interactive_freq_down);
-
-	spin_lock_init(&up_cpumask_lock);
-	spin_lock_init(&down_cpumask_lock);
-
-#if DEBUG
-	spin_lock_init(&dbgpr_lock);
-	dbg_proc = create_proc_entry("igov", S_IWUSR | S_IRUGO, NULL);
-	dbg_proc->read_proc = dbg_proc_read;
-#endif
+	if (input_register_handler(&cpufreq_interactive_input_handler))
+		pr_warning("cpufreq_interactive: no input boost\n");
 
 	return cpufreq_register_governor(&cpufreq_gov_interactive);
-
-err_freeuptask:
-	put_task_struct(up_task);
-	return -ENOMEM;
 }
 
 #ifdef CONFIG_CPU_FREQ_DEFAULT_GOV_INTERACTIVE
@@ -698,9 +982,7 @@ module_init(cpufreq_interactive_init);
 static void __exit cpufreq_interactive_exit(void)
 {
 	cpufreq_unregister_governor(&cpufreq_gov_interactive);
-	kthread_stop(up_task);
-	put_task_struct(up_task);
-	destroy_workqueue(down_wq);
+	input_unregister_handler(&cpufreq_interactive_input_handler);
 }
 
 module_exit(cpufreq_interactive_exit);
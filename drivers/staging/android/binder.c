@@ -19,6 +19,8 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/highmem.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -105,6 +107,11 @@ module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 static int binder_debug_no_lock;
 module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
 
+/* freed buffer pages each proc keeps for reuse instead of freeing them */
+static unsigned int binder_page_pool_pages = 8;
+module_param_named(page_pool_pages, binder_page_pool_pages, uint,
+		   S_IWUSR | S_IRUGO);
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -198,6 +205,20 @@ static struct binder_transaction_log_entry *binder_transaction_log_add(
 	return e;
 }
 
+/*
+ * Bucket i counts latencies below 2^i usec, the last bucket everything
+ * slower. delivery is BC_TRANSACTION to BR_TRANSACTION, reply is
+ * BR_TRANSACTION to BC_REPLY.
+ */
+#define BINDER_LATENCY_BUCKETS 20
+
+struct binder_latency {
+	uint32_t delivery[BINDER_LATENCY_BUCKETS];
+	uint32_t reply[BINDER_LATENCY_BUCKETS];
+};
+
+static struct binder_latency binder_latency;
+
 struct binder_work {
 	struct list_head entry;
 	enum {
@@ -232,6 +253,7 @@ struct binder_node {
 	unsigned accept_fds:1;
 	unsigned min_priority:8;
 	struct list_head async_todo;
+	struct binder_latency *latency;
 };
 
 struct binder_ref_death {
@@ -300,11 +322,16 @@ struct binder_proc {
 	size_t free_async_space;
 
 	struct page **pages;
+	struct list_head page_pool;
+	uint32_t pool_pages;
+	uint32_t pool_hits;
+	uint32_t page_allocs;
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	struct binder_latency latency;
 	struct list_head delivered_death;
 	int max_threads;
 	int requested_threads;
@@ -312,6 +339,8 @@ struct binder_proc {
 	int ready_threads;
 	long default_priority;
 	struct dentry *debugfs_entry;
+	int tmp_ref;
+	int release_pending;
 };
 
 enum {
@@ -355,11 +384,47 @@ struct binder_transaction {
 	long	priority;
 	long	saved_priority;
 	uid_t	sender_euid;
+	ktime_t	start_time;
+	ktime_t	delivered_time;
 };
 
 static void
 binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer);
 
+static void binder_latency_add(struct binder_proc *proc,
+			       struct binder_node *node, int reply,
+			       ktime_t start, ktime_t end)
+{
+	s64 us = ktime_us_delta(end, start);
+	int i;
+
+	if (us <= 0)
+		i = 0;
+	else if (us >= 1 << (BINDER_LATENCY_BUCKETS - 2))
+		i = BINDER_LATENCY_BUCKETS - 1;
+	else
+		i = fls((int)us);
+
+	if (reply) {
+		binder_latency.reply[i]++;
+		proc->latency.reply[i]++;
+	} else {
+		binder_latency.delivery[i]++;
+		proc->latency.delivery[i]++;
+	}
+	if (node == NULL)
+		return;
+	if (node->latency == NULL) {
+		node->latency = kzalloc(sizeof(*node->latency), GFP_KERNEL);
+		if (node->latency == NULL)
+			return;
+	}
+	if (reply)
+		node->latency->reply[i]++;
+	else
+		node->latency->delivery[i]++;
+}
+
 /*
  * copied from get_unused_fd_flags
  */
@@ -607,6 +672,32 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+static struct page *binder_get_pool_page(struct binder_proc *proc)
+{
+	struct page *page;
+
+	if (list_empty(&proc->page_pool)) {
+		proc->page_allocs++;
+		return alloc_page(GFP_KERNEL | __GFP_ZERO);
+	}
+	page = list_first_entry(&proc->page_pool, struct page, lru);
+	list_del(&page->lru);
+	proc->pool_pages--;
+	proc->pool_hits++;
+	/* still holds whatever the last transaction left in it */
+	clear_highpage(page);
+	return page;
+}
+
+static void binder_put_pool_page(struct binder_proc *proc, struct page *page)
+{
+	if (proc->pool_pages < binder_page_pool_pages) {
+		list_add(&page->lru, &proc->page_pool);
+		proc->pool_pages++;
+	} else
+		__free_page(page);
+}
+
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
@@ -615,7 +706,9 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
 	struct page **page;
+	struct page **page_array_ptr;
 	struct mm_struct *mm;
+	int ret;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: %s pages %p-%p\n", proc->pid,
@@ -643,28 +736,32 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		goto err_no_vma;
 	}
 
+	/* Fill in the whole page array first so the kernel view of the
+	 * range can be mapped with a single map_vm_area() call.
+	 */
 	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
-		int ret;
-		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
 		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		*page = binder_get_pool_page(proc);
 		if (*page == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "for page at %p\n", proc->pid, page_addr);
 			goto err_alloc_page_failed;
 		}
-		tmp_area.addr = page_addr;
-		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
-		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
-		if (ret) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %p in kernel\n",
-			       proc->pid, page_addr);
-			goto err_map_kernel_failed;
-		}
+	}
+	tmp_area.addr = start;
+	tmp_area.size = end - start + PAGE_SIZE /* guard page? */;
+	page_array_ptr = &proc->pages[(start - proc->buffer) / PAGE_SIZE];
+	ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
+	if (ret) {
+		printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
+		       "to map pages at %p in kernel\n",
+		       proc->pid, start);
+		goto free_range;
+	}
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 		user_page_addr =
 			(uintptr_t)page_addr + proc->user_buffer_offset;
 		ret = vm_insert_page(vma, user_page_addr, page[0]);
@@ -672,7 +769,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "to map page at %lx in userspace\n",
 			       proc->pid, user_page_addr);
-			goto err_vm_insert_page_failed;
+			goto free_range;
 		}
 		/* vm_insert_page does not seem to increment the refcount */
 	}
@@ -683,19 +780,17 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	return 0;
 
 free_range:
-	for (page_addr = end - PAGE_SIZE; page_addr >= start;
-	     page_addr -= PAGE_SIZE) {
-		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
-err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
-err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
+	if (vma)
+		zap_page_range(vma, (uintptr_t)start +
+			proc->user_buffer_offset, end - start, NULL);
+	unmap_kernel_range((unsigned long)start, end - start);
 err_alloc_page_failed:
-		;
+	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (*page) {
+			binder_put_pool_page(proc, *page);
+			*page = NULL;
+		}
 	}
 err_no_vma:
 	if (mm) {
@@ -1052,6 +1147,7 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 					     "binder: dead node %d deleted\n",
 					     node->debug_id);
 			}
+			kfree(node->latency);
 			kfree(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
 		}
@@ -1375,6 +1471,32 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+/*
+ * A synchronous transaction is delivered to the thread of target_proc that
+ * is already waiting on thread's call stack, if there is one.
+ */
+static struct binder_thread *binder_find_stacked_thread(
+	struct binder_thread *thread, struct binder_proc *target_proc)
+{
+	struct binder_thread *target_thread = NULL;
+	struct binder_transaction *tmp;
+
+	for (tmp = thread->transaction_stack; tmp; tmp = tmp->from_parent) {
+		if (tmp->from && tmp->from->proc == target_proc)
+			target_thread = tmp->from;
+	}
+	return target_thread;
+}
+
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	BUG_ON(proc->tmp_ref <= 0);
+	if (--proc->tmp_ref == 0 && proc->release_pending) {
+		proc->release_pending = 0;
+		binder_defer_work(proc, BINDER_DEFERRED_RELEASE);
+	}
+}
+
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
 			       struct binder_transaction_data *tr, int reply)
@@ -1390,6 +1512,7 @@ static void binder_transaction(struct binder_proc *proc,
 	struct binder_transaction *in_reply_to = NULL;
 	struct binder_transaction_log_entry *e;
 	uint32_t return_error;
+	int copy_failed;
 
 	e = binder_transaction_log_add(&binder_transaction_log);
 	e->call_type = reply ? 2 : !!(tr->flags & TF_ONE_WAY);
@@ -1481,11 +1604,8 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
-			while (tmp) {
-				if (tmp->from && tmp->from->proc == target_proc)
-					target_thread = tmp->from;
-				tmp = tmp->from_parent;
-			}
+			target_thread = binder_find_stacked_thread(thread,
+								   target_proc);
 		}
 	}
 	if (target_thread) {
@@ -1514,6 +1634,7 @@ static void binder_transaction(struct binder_proc *proc,
 	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
 	t->debug_id = ++binder_last_id;
+	t->start_time = ktime_get();
 	e->debug_id = t->debug_id;
 
 	if (reply)
@@ -1558,17 +1679,45 @@ static void binder_transaction(struct binder_proc *proc,
 
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
 
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
+	/*
+	 * The buffer is not reachable from target_proc until t is queued,
+	 * so the payload copy, the only step whose cost grows with the
+	 * transaction size, runs without binder_lock. The tmp_ref keeps
+	 * binder_deferred_release from freeing the target pages meanwhile.
+	 */
+	target_proc->tmp_ref++;
+	mutex_unlock(&binder_lock);
+	copy_failed = 0;
+	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size))
+		copy_failed = 1;
+	else if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size))
+		copy_failed = 2;
+	mutex_lock(&binder_lock);
+	binder_proc_dec_tmpref(target_proc);
+
+	if (copy_failed) {
 		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
+			"%s ptr\n", proc->pid, thread->pid,
+			copy_failed == 1 ? "data" : "offsets");
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
-	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"offsets ptr\n", proc->pid, thread->pid);
-		return_error = BR_FAILED_REPLY;
-		goto err_copy_data_failed;
+	if (reply) {
+		/* binder_free_thread clears ->from if the caller went away */
+		if (in_reply_to->from != target_thread) {
+			return_error = BR_DEAD_REPLY;
+			goto err_copy_data_failed;
+		}
+	} else if (target_thread) {
+		target_thread = binder_find_stacked_thread(thread, target_proc);
+		if (target_thread) {
+			target_list = &target_thread->todo;
+			target_wait = &target_thread->wait;
+		} else {
+			target_list = &target_proc->todo;
+			target_wait = &target_proc->wait;
+		}
+		t->to_thread = target_thread;
 	}
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
 		binder_user_error("binder: %d:%d got transaction with "
@@ -1610,6 +1759,7 @@ static void binder_transaction(struct binder_proc *proc,
 					proc->pid, thread->pid,
 					fp->binder, node->debug_id,
 					fp->cookie, node->cookie);
+				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_for_node_failed;
 			}
 			ref = binder_get_ref_for_node(target_proc, node);
@@ -1717,6 +1867,10 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	if (reply) {
 		BUG_ON(t->buffer->async_transaction != 0);
+		/* Only replies that get through count */
+		binder_latency_add(proc, in_reply_to->buffer ?
+				   in_reply_to->buffer->target_node : NULL, 1,
+				   in_reply_to->delivered_time, ktime_get());
 		binder_pop_transaction(target_thread, in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
@@ -2352,6 +2506,7 @@ retry:
 						     proc->pid, thread->pid, node->debug_id,
 						     node->ptr, node->cookie);
 					rb_erase(&node->rb_node, &proc->nodes);
+					kfree(node->latency);
 					kfree(node);
 					binder_stats_deleted(BINDER_STAT_NODE);
 				} else {
@@ -2413,6 +2568,9 @@ retry:
 			else if (!(t->flags & TF_ONE_WAY) ||
 				 t->saved_priority > target_node->min_priority)
 				binder_set_nice(target_node->min_priority);
+			t->delivered_time = ktime_get();
+			binder_latency_add(proc, target_node, 0, t->start_time,
+					   t->delivered_time);
 			cmd = BR_TRANSACTION;
 		} else {
 			tr.target.ptr = NULL;
@@ -2883,6 +3041,7 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	get_task_struct(current);
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
+	INIT_LIST_HEAD(&proc->page_pool);
 	init_waitqueue_head(&proc->wait);
 	proc->default_priority = task_nice(current);
 	mutex_lock(&binder_lock);
@@ -2974,6 +3133,7 @@ static void binder_deferred_release(struct binder_proc *proc)
 		rb_erase(&node->rb_node, &proc->nodes);
 		list_del_init(&node->work.entry);
 		if (hlist_empty(&node->refs)) {
+			kfree(node->latency);
 			kfree(node);
 			binder_stats_deleted(BINDER_STAT_NODE);
 		} else {
@@ -3051,6 +3211,12 @@ static void binder_deferred_release(struct binder_proc *proc)
 		kfree(proc->pages);
 		vfree(proc->buffer);
 	}
+	while (!list_empty(&proc->page_pool)) {
+		struct page *page = list_first_entry(&proc->page_pool,
+						     struct page, lru);
+		list_del(&page->lru);
+		__free_page(page);
+	}
 
 	put_task_struct(proc->tsk);
 
@@ -3095,8 +3261,12 @@ static void binder_deferred_func(struct work_struct *work)
 		if (defer & BINDER_DEFERRED_FLUSH)
 			binder_deferred_flush(proc);
 
-		if (defer & BINDER_DEFERRED_RELEASE)
-			binder_deferred_release(proc); /* frees proc */
+		if (defer & BINDER_DEFERRED_RELEASE) {
+			if (proc->tmp_ref)
+				proc->release_pending = 1;
+			else
+				binder_deferred_release(proc); /* frees proc */
+		}
 
 		mutex_unlock(&binder_lock);
 		if (files)
@@ -3252,6 +3422,30 @@ static void print_binder_ref(struct seq_file *m, struct binder_ref *ref)
 		   ref->node->debug_id, ref->strong, ref->weak, ref->death);
 }
 
+static void print_binder_alloc_stats(struct seq_file *m,
+				     struct binder_proc *proc)
+{
+	struct rb_node *n;
+	int count = 0;
+	size_t free_size = 0;
+	size_t largest = 0;
+
+	for (n = rb_first(&proc->free_buffers); n != NULL; n = rb_next(n)) {
+		count++;
+		free_size += binder_buffer_size(proc, rb_entry(n,
+					struct binder_buffer, rb_node));
+	}
+	/* free_buffers is sorted by size */
+	n = rb_last(&proc->free_buffers);
+	if (n)
+		largest = binder_buffer_size(proc, rb_entry(n,
+					struct binder_buffer, rb_node));
+	seq_printf(m, "  free buffers: %d size %zd largest %zd of %zd\n",
+		   count, free_size, largest, proc->buffer_size);
+	seq_printf(m, "  pages: pooled %u pool hits %u allocated %u\n",
+		   proc->pool_pages, proc->pool_hits, proc->page_allocs);
+}
+
 static void print_binder_proc(struct seq_file *m,
 			      struct binder_proc *proc, int print_all)
 {
@@ -3263,6 +3457,8 @@ static void print_binder_proc(struct seq_file *m,
 	seq_printf(m, "proc %d\n", proc->pid);
 	header_pos = m->count;
 
+	if (print_all && proc->buffer)
+		print_binder_alloc_stats(m, proc);
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n))
 		print_binder_thread(m, rb_entry(n, struct binder_thread,
 						rb_node), print_all);
@@ -3414,6 +3610,8 @@ static void print_binder_proc_stats(struct seq_file *m,
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
 	seq_printf(m, "  buffers: %d\n", count);
+	if (proc->buffer)
+		print_binder_alloc_stats(m, proc);
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
@@ -3475,6 +3673,54 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	return 0;
 }
 
+static void print_binder_latency(struct seq_file *m, const char *prefix,
+				 struct binder_latency *lat)
+{
+	int i;
+
+	seq_printf(m, "%sdelivery:", prefix);
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++)
+		seq_printf(m, " %u", lat->delivery[i]);
+	seq_printf(m, "\n%sreply:", prefix);
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++)
+		seq_printf(m, " %u", lat->reply[i]);
+	seq_puts(m, "\n");
+}
+
+static int binder_latency_show(struct seq_file *m, void *unused)
+{
+	struct binder_proc *proc;
+	struct hlist_node *pos;
+	struct rb_node *n;
+	int do_lock = !binder_debug_no_lock;
+	int i;
+
+	if (do_lock)
+		mutex_lock(&binder_lock);
+
+	seq_puts(m, "binder latency:\nusec:");
+	for (i = 0; i < BINDER_LATENCY_BUCKETS - 1; i++)
+		seq_printf(m, " <%u", 1U << i);
+	seq_printf(m, " >=%u\n", 1U << (BINDER_LATENCY_BUCKETS - 2));
+	print_binder_latency(m, "", &binder_latency);
+
+	hlist_for_each_entry(proc, pos, &binder_procs, proc_node) {
+		seq_printf(m, "proc %d\n", proc->pid);
+		print_binder_latency(m, "  ", &proc->latency);
+		for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
+			struct binder_node *node = rb_entry(n,
+					struct binder_node, rb_node);
+			if (node->latency == NULL)
+				continue;
+			seq_printf(m, "  node %d\n", node->debug_id);
+			print_binder_latency(m, "    ", node->latency);
+		}
+	}
+	if (do_lock)
+		mutex_unlock(&binder_lock);
+	return 0;
+}
+
 static int binder_transactions_show(struct seq_file *m, void *unused)
 {
 	struct binder_proc *proc;
@@ -3550,6 +3796,7 @@ static struct miscdevice binder_miscdev = {
 BINDER_DEBUG_ENTRY(state);
 BINDER_DEBUG_ENTRY(stats);
 BINDER_DEBUG_ENTRY(transactions);
+BINDER_DEBUG_ENTRY(latency);
 BINDER_DEBUG_ENTRY(transaction_log);
 
 static int __init binder_init(void)
@@ -3581,6 +3828,11 @@ static int __init binder_init(void)
 				    binder_debugfs_dir_entry_root,
 				    NULL,
 				    &binder_transactions_fops);
+		debugfs_create_file("latency",
+				    S_IRUGO,
+				    binder_debugfs_dir_entry_root,
+				    NULL,
+				    &binder_latency_fops);
 		debugfs_create_file("transaction_log",
 				    S_IRUGO,
 				    binder_debugfs_dir_entry_root,
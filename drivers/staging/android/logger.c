@@ -21,6 +21,7 @@
 #include <linux/module.h>
 #include <linux/fs.h>
 #include <linux/miscdevice.h>
+#include <linux/mm.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
@@ -46,6 +47,7 @@ struct logger_log {
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
 	size_t			size;	/* size of the log */
+	struct logger_ring_info	*info;	/* offsets exported by mmap() */
 };
 
 /*
@@ -58,6 +60,7 @@ struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	int			batch;	/* read() returns many entries */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
@@ -150,7 +153,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or with LOGGER_SET_BATCH_READ
+ * 	  as many complete entries as fit in the buffer
  *
  * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
@@ -205,7 +209,20 @@ start:
 		goto out;
 	}
 
-	/* get exactly one entry from the log */
+	if (reader->batch) {
+		size_t off = logger_offset(reader->r_off + ret);
+
+		/* extend to every following entry that still fits */
+		while (off != log->w_off) {
+			size_t len = get_entry_len(log, off);
+			if (ret + len > count)
+				break;
+			ret += len;
+			off = logger_offset(off + len);
+		}
+	}
+
+	/* get the entries from the log */
 	ret = do_read_log_to_user(log, reader, buf, ret);
 
 out:
@@ -292,57 +309,52 @@ static void do_write_log(struct logger_log *log, const void *buf, size_t count)
 }
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * update_ring_info - publish the offsets to mmap() readers
  *
  * The caller needs to hold log->mutex.
- *
- * Returns 'count' on success, negative error code on failure.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static void update_ring_info(struct logger_log *log)
 {
-	size_t len;
-
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
-		return -EFAULT;
-
-	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
-			return -EFAULT;
-
-	/* print as kernel log if the log string starts with "!@" */
-	if (count >= 2) {
-		if (log->buffer[log->w_off] == '!'
-		    && log->buffer[logger_offset(log->w_off + 1)] == '@') {
-			char tmp[256];
-			int i;
-			for (i = 0; i < min(count, sizeof(tmp) - 1); i++)
-				tmp[i] =
-				    log->buffer[logger_offset(log->w_off + i)];
-			tmp[i] = '\0';
-			printk("%s\n", tmp);
-		}
-	}
+	if (!log->info)
+		return;
+	smp_wmb();
+	log->info->head = log->head;
+	log->info->w_off = log->w_off;
+}
 
-	log->w_off = logger_offset(log->w_off + count);
+/*
+ * Payloads up to this size are gathered on the stack, larger ones in a
+ * kmalloc()ed buffer. Most log lines fit.
+ */
+#define LOGGER_STACK_PAYLOAD	256
 
-	return count;
+/*
+ * print_kmsg_segment - echo an iovec segment starting with "!@" to the
+ * kernel log
+ */
+static void print_kmsg_segment(const char *buf, size_t count)
+{
+	if (count >= 2 && buf[0] == '!' && buf[1] == '@')
+		printk("%.*s\n", (int) min_t(size_t, count, 255), buf);
 }
 
 /*
  * logger_aio_write - our write method, implementing support for write(),
  * writev(), and aio_write(). Writes are our fast path, and we try to optimize
  * them above all else.
+ *
+ * The payload is gathered from user-space before log->mutex is taken, so
+ * the lock only covers fixing up the readers and two memcpy()s into the
+ * ring; a writer that faults on its buffer never stalls the others.
  */
 ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
+	char stack_payload[LOGGER_STACK_PAYLOAD];
+	char *payload = stack_payload;
 	ssize_t ret = 0;
 
 	now = current_kernel_time();
@@ -357,42 +369,48 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
-
-	/*
-	 * Fix up any readers, pulling them forward to the first readable
-	 * entry after (what will be) the new write offset. We do this now
-	 * because if we partially fail, we can end up with clobbered log
-	 * entries that encroach on readable buffer.
-	 */
-	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
-
-	do_write_log(log, &header, sizeof(struct logger_entry));
+	if (header.len > sizeof(stack_payload)) {
+		payload = kmalloc(header.len, GFP_KERNEL);
+		if (unlikely(!payload))
+			return -ENOMEM;
+	}
 
-	while (nr_segs-- > 0) {
+	while (nr_segs-- > 0 && ret < header.len) {
 		size_t len;
-		ssize_t nr;
 
 		/* figure out how much of this vector we can keep */
 		len = min_t(size_t, iov->iov_len, header.len - ret);
 
-		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
+		if (len && copy_from_user(payload + ret, iov->iov_base, len)) {
+			ret = -EFAULT;
+			goto out;
 		}
+		print_kmsg_segment(payload + ret, len);
 
 		iov++;
-		ret += nr;
+		ret += len;
 	}
 
+	mutex_lock(&log->mutex);
+
+	/*
+	 * Fix up any readers, pulling them forward to the first readable
+	 * entry after (what will be) the new write offset.
+	 */
+	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
+
+	do_write_log(log, &header, sizeof(struct logger_entry));
+	do_write_log(log, payload, header.len);
+	update_ring_info(log);
+
 	mutex_unlock(&log->mutex);
 
 	/* wake up any blocked readers */
 	wake_up_interruptible(&log->wq);
 
+out:
+	if (payload != stack_payload)
+		kfree(payload);
 	return ret;
 }
 
@@ -533,6 +551,16 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		list_for_each_entry(reader, &log->readers, list)
 			reader->r_off = log->w_off;
 		log->head = log->w_off;
+		update_ring_info(log);
+		ret = 0;
+		break;
+	case LOGGER_SET_BATCH_READ:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		reader->batch = !!arg;
 		ret = 0;
 		break;
 	}
@@ -542,11 +570,42 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	return ret;
 }
 
+/*
+ * logger_mmap - map the log read-only: one page of struct logger_ring_info
+ * followed by the ring. Readers walk the entries themselves and must cope
+ * with being lapped by the writer, exactly as logger_read() does.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	unsigned long size = vma->vm_end - vma->vm_start;
+	int ret;
+
+	if (!(file->f_mode & FMODE_READ) || !log->info)
+		return -ENODEV;
+	if (vma->vm_pgoff != 0 || size != PAGE_SIZE + log->size)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	ret = remap_pfn_range(vma, vma->vm_start,
+			      page_to_pfn(virt_to_page(log->info)),
+			      PAGE_SIZE, vma->vm_page_prot);
+	if (ret)
+		return ret;
+
+	return remap_pfn_range(vma, vma->vm_start + PAGE_SIZE,
+			       page_to_pfn(virt_to_page(log->buffer)),
+			       log->size, vma->vm_page_prot);
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -559,7 +618,7 @@ static const struct file_operations logger_fops = {
  * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[SIZE] __aligned(PAGE_SIZE); \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
 	.misc = { \
@@ -598,6 +657,13 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	log->info = (struct logger_ring_info *) get_zeroed_page(GFP_KERNEL);
+	if (log->info)
+		log->info->size = log->size;
+	else
+		printk(KERN_WARNING "logger: no mmap() support for log "
+		       "'%s'\n", log->misc.name);
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
@@ -35,6 +35,18 @@ struct logger_entry {
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
 #define LOGGER_LOG_MAIN		"log_main"	/* everything else */
 
+/*
+ * struct logger_ring_info - first page of a read-only mmap() of a log,
+ * followed by the ring itself. w_off is updated after the entry it
+ * covers has been written.
+ */
+struct logger_ring_info {
+	__u32		w_off;	/* current write head offset */
+	__u32		head;	/* oldest entry still in the ring */
+	__u32		size;	/* size of the ring */
+	__u32		__pad;
+};
+
 #define LOGGER_ENTRY_MAX_LEN		(4*1024)
 #define LOGGER_ENTRY_MAX_PAYLOAD	\
 	(LOGGER_ENTRY_MAX_LEN - sizeof(struct logger_entry))
@@ -45,5 +57,6 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_BATCH_READ		_IO(__LOGGERIO, 5) /* read many entries */
 
 #endif /* _LINUX_LOGGER_H */
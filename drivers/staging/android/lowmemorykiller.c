@@ -12,6 +12,13 @@
  * and kill processes with a oom_adj value of 0 or higher when the free memory
  * drops below 1024 pages.
  *
+ * Reading /dev/lowmem_notify returns the current pressure level: 0 when no
+ * minfree threshold is crossed, otherwise 1 for the largest threshold up to
+ * the number of thresholds for the smallest one. poll() on it reports
+ * POLLIN whenever the level has changed since the last read, so user-space
+ * can trim its caches before anything is killed. Once the current level has
+ * been read, further reads return end of file until it changes.
+ *
  * The driver considers memory used for caches to be free, but if a large
  * percentage of the cached memory is locked this can be very inaccurate
  * and processes may not get killed until the normal oom killer is triggered.
@@ -35,6 +42,12 @@
 #include <linux/oom.h>
 #include <linux/sched.h>
 #include <linux/notifier.h>
+#include <linux/ktime.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -55,6 +68,62 @@ static int lowmem_minfree_size = 4;
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+static DEFINE_SPINLOCK(lowmem_notify_lock);
+static int lowmem_notify_level;
+static unsigned int lowmem_notify_seq;
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_notify_wait);
+
+struct lowmem_notify_reader {
+	unsigned int seq;	/* lowmem_notify_seq of the last record read */
+	int read;		/* that record has been read, next read is EOF */
+};
+
+static uint32_t lowmem_kill_count;
+static uint32_t lowmem_select_count;
+static uint32_t lowmem_select_usecs;	/* last victim search */
+static uint32_t lowmem_select_usecs_max;
+
+/*
+ * Thread group leaders bucketed by signal->oom_adj, so a victim search
+ * only looks at processes that may be killed at the current level.
+ * Protected by tasklist_lock.
+ */
+static struct hlist_head lowmem_adj_index[OOM_ADJUST_MAX - OOM_DISABLE + 1];
+
+static struct hlist_head *lowmem_adj_bucket(int oom_adj)
+{
+	if (oom_adj < OOM_DISABLE)
+		oom_adj = OOM_DISABLE;
+	else if (oom_adj > OOM_ADJUST_MAX)
+		oom_adj = OOM_ADJUST_MAX;
+	return &lowmem_adj_index[oom_adj - OOM_DISABLE];
+}
+
+void lowmem_adj_index_add(struct task_struct *p)
+{
+	hlist_add_head(&p->lmk_adj_node, lowmem_adj_bucket(p->signal->oom_adj));
+}
+
+void lowmem_adj_index_del(struct task_struct *p)
+{
+	hlist_del_init(&p->lmk_adj_node);
+}
+
+void lowmem_adj_index_update(struct task_struct *task)
+{
+	struct task_struct *p;
+
+	write_lock_irq(&tasklist_lock);
+	if (pid_alive(task)) {
+		p = task->group_leader;
+		if (!hlist_unhashed(&p->lmk_adj_node)) {
+			hlist_del(&p->lmk_adj_node);
+			lowmem_adj_index_add(p);
+		}
+	}
+	write_unlock_irq(&tasklist_lock);
+}
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -79,9 +148,63 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	return NOTIFY_OK;
 }
 
+/*
+ * lowmem_threshold - index of the first (smallest) minfree threshold both
+ * free and file pages are below, or -1. *array_size is set to the number
+ * of usable thresholds.
+ */
+static int lowmem_threshold(int other_free, int other_file, int *array_size)
+{
+	int i;
+
+	*array_size = ARRAY_SIZE(lowmem_adj);
+	if (lowmem_adj_size < *array_size)
+		*array_size = lowmem_adj_size;
+	if (lowmem_minfree_size < *array_size)
+		*array_size = lowmem_minfree_size;
+	for (i = 0; i < *array_size; i++) {
+		if (other_free < lowmem_minfree[i] &&
+		    other_file < lowmem_minfree[i])
+			return i;
+	}
+	return -1;
+}
+
+static int lowmem_level(void)
+{
+	int array_size;
+	int i = lowmem_threshold(global_page_state(NR_FREE_PAGES),
+				 global_page_state(NR_FILE_PAGES) -
+				 global_page_state(NR_SHMEM), &array_size);
+
+	return i < 0 ? 0 : array_size - i;
+}
+
+/* Called with lowmem_notify_lock held, returns nonzero if readers need waking */
+static int lowmem_notify_locked(int level)
+{
+	if (level == lowmem_notify_level)
+		return 0;
+	lowmem_notify_level = level;
+	lowmem_notify_seq++;
+	return 1;
+}
+
+static void lowmem_notify(int level)
+{
+	int changed;
+
+	spin_lock(&lowmem_notify_lock);
+	changed = lowmem_notify_locked(level);
+	spin_unlock(&lowmem_notify_lock);
+	if (changed)
+		wake_up_interruptible(&lowmem_notify_wait);
+}
+
 static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 {
 	struct task_struct *p;
+	struct hlist_node *pos;
 	struct task_struct *selected = NULL;
 	int rem = 0;
 	int tasksize;
@@ -89,10 +212,15 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	int min_adj = OOM_ADJUST_MAX + 1;
 	int selected_tasksize = 0;
 	int selected_oom_adj;
-	int array_size = ARRAY_SIZE(lowmem_adj);
+	int array_size;
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 		global_page_state(NR_SHMEM);
+	int oom_adj;
+	ktime_t start;
+
+	i = lowmem_threshold(other_free, other_file, &array_size);
+	lowmem_notify(i < 0 ? 0 : array_size - i);
 
 	/*
 	 * If we already have a death outstanding, then
@@ -105,17 +233,8 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	    time_before_eq(jiffies, lowmem_deathpending_timeout))
 		return 0;
 
-	if (lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if (lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
-	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
-			break;
-		}
-	}
+	if (i >= 0)
+		min_adj = lowmem_adj[i];
 
 	if (min_adj == OOM_ADJUST_MAX + 1)
 		return 0;
@@ -135,41 +254,39 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	}
 	selected_oom_adj = min_adj;
 
+	start = ktime_get();
 	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
-			continue;
-		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
+	/* the highest oom_adj with a non-empty process wins */
+	for (oom_adj = OOM_ADJUST_MAX; oom_adj >= min_adj && !selected;
+	     oom_adj--) {
+		hlist_for_each_entry(p, pos, lowmem_adj_bucket(oom_adj),
+				     lmk_adj_node) {
+			struct mm_struct *mm;
+
+			task_lock(p);
+			mm = p->mm;
+			if (!mm) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(mm);
 			task_unlock(p);
-			continue;
-		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
-			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
+			if (tasksize <= 0)
 				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
+			if (selected && tasksize <= selected_tasksize)
 				continue;
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = oom_adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, "
+				     "to kill\n", p->pid, p->comm, oom_adj,
+				     tasksize);
 		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
 	}
+	lowmem_select_usecs = ktime_us_delta(ktime_get(), start);
+	if (lowmem_select_usecs > lowmem_select_usecs_max)
+		lowmem_select_usecs_max = lowmem_select_usecs;
+	lowmem_select_count++;
 	if (selected) {
 		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
 			     selected->pid, selected->comm,
@@ -177,6 +294,7 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 		lowmem_deathpending = selected;
 		lowmem_deathpending_timeout = jiffies + HZ;
 		force_sig(SIGKILL, selected);
+		lowmem_kill_count++;
 		rem -= selected_tasksize;
 	} else
 		rem = -1;
@@ -186,6 +304,81 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	return rem;
 }
 
+static int lowmem_notify_open(struct inode *inode, struct file *file)
+{
+	struct lowmem_notify_reader *reader;
+
+	reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+	reader->seq = lowmem_notify_seq;
+	file->private_data = reader;
+	return nonseekable_open(inode, file);
+}
+
+static int lowmem_notify_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static ssize_t lowmem_notify_read(struct file *file, char __user *buf,
+				  size_t count, loff_t *pos)
+{
+	struct lowmem_notify_reader *reader = file->private_data;
+	char tmp[12];
+	int len;
+	int level;
+	int changed;
+
+	/* pressure may have eased without a shrinker call, so re-check */
+	level = lowmem_level();
+
+	spin_lock(&lowmem_notify_lock);
+	changed = lowmem_notify_locked(level);
+	if (reader->read && reader->seq == lowmem_notify_seq) {
+		/* this level has been read already */
+		spin_unlock(&lowmem_notify_lock);
+		return 0;
+	}
+	reader->seq = lowmem_notify_seq;
+	spin_unlock(&lowmem_notify_lock);
+	if (changed)
+		wake_up_interruptible(&lowmem_notify_wait);
+
+	len = snprintf(tmp, sizeof(tmp), "%d\n", level);
+	if (count < len)
+		return -EINVAL;
+	if (copy_to_user(buf, tmp, len))
+		return -EFAULT;
+	reader->read = 1;
+	return len;
+}
+
+static unsigned int lowmem_notify_poll(struct file *file, poll_table *wait)
+{
+	struct lowmem_notify_reader *reader = file->private_data;
+
+	poll_wait(file, &lowmem_notify_wait, wait);
+	if (reader->seq != lowmem_notify_seq)
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static const struct file_operations lowmem_notify_fops = {
+	.owner = THIS_MODULE,
+	.open = lowmem_notify_open,
+	.release = lowmem_notify_release,
+	.read = lowmem_notify_read,
+	.poll = lowmem_notify_poll,
+};
+
+static struct miscdevice lowmem_notify_misc = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "lowmem_notify",
+	.fops = &lowmem_notify_fops,
+};
+
 static struct shrinker lowmem_shrinker = {
 	.shrink = lowmem_shrink,
 	.seeks = DEFAULT_SEEKS * 16
@@ -195,11 +388,15 @@ static int __init lowmem_init(void)
 {
 	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
+	if (misc_register(&lowmem_notify_misc))
+		printk(KERN_ERR "lowmemorykiller: failed to register "
+		       "lowmem_notify device\n");
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	misc_deregister(&lowmem_notify_misc);
 	unregister_shrinker(&lowmem_shrinker);
 	task_free_unregister(&task_nb);
 }
@@ -210,6 +407,11 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_named(kill_count, lowmem_kill_count, uint, S_IRUGO);
+module_param_named(select_count, lowmem_select_count, uint, S_IRUGO);
+module_param_named(select_usecs, lowmem_select_usecs, uint, S_IRUGO);
+module_param_named(select_usecs_max, lowmem_select_usecs_max, uint,
+		   S_IRUGO | S_IWUSR);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
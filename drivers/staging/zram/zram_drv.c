@@ -22,10 +22,14 @@
 #include <linux/blkdev.h>
 #include <linux/buffer_head.h>
 #include <linux/device.h>
+#include <linux/file.h>
+#include <linux/fs.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
+#include <linux/math64.h>
+#include <linux/percpu.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 
@@ -38,6 +42,11 @@ static struct zram *devices;
 /* Module params (documentation at end) */
 static unsigned int num_devices;
 
+static struct kmem_cache *zram_entry_cache;
+
+/* Reads of pages on backing devices, see zram_read() */
+static struct workqueue_struct *zram_bd_wq;
+
 static int zram_test_flag(struct zram *zram, u32 index,
 			enum zram_pageflags flag)
 {
@@ -56,18 +65,23 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+/*
+ * Check whether the page is one word repeated, zero included, and
+ * return that word in @element.
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
@@ -111,7 +125,7 @@ static void zram_ioctl_get_stats(struct zram *zram,
 	size_t succ_writes, mem_used;
 	unsigned int good_compress_perc = 0, no_compress_perc = 0;
 
-	mem_used = xv_get_total_size_bytes(zram->mem_pool)
+	mem_used = zs_get_total_size_bytes(zram->mem_pool)
 			+ (rs->pages_expand << PAGE_SHIFT);
 	succ_writes = zram_stat64_read(zram, &rs->num_writes) -
 			zram_stat64_read(zram, &rs->failed_writes);
@@ -139,52 +153,250 @@ static void zram_ioctl_get_stats(struct zram *zram,
 	s->orig_data_size = rs->pages_stored << PAGE_SHIFT;
 	s->compr_data_size = rs->compr_size;
 	s->mem_used_total = mem_used;
+
+	s->num_compress = zram_stat64_read(zram, &rs->num_compress);
+	s->compress_time_ns = zram_stat64_read(zram, &rs->compress_time_ns);
+	s->num_decompress = zram_stat64_read(zram, &rs->num_decompress);
+	s->decompress_time_ns = zram_stat64_read(zram,
+					&rs->decompress_time_ns);
+
+	s->pages_same = rs->pages_same;
+	s->pages_dedup = rs->pages_dedup;
+	s->dedup_saved_size = rs->dedup_size;
+	s->pages_wb = rs->pages_wb;
+	s->bd_reads = zram_stat64_read(zram, &rs->bd_reads);
+	s->bd_writes = zram_stat64_read(zram, &rs->bd_writes);
+	if (s->num_compress)
+		s->compress_ratio_pct = div64_u64(100 *
+				zram_stat64_read(zram, &rs->compress_bytes),
+				s->num_compress << PAGE_SHIFT);
 	}
 #endif /* CONFIG_ZRAM_STATS */
+	memcpy(s->compressor, zram->compressor, ZRAM_COMP_NAME_LEN);
+}
+
+static struct hlist_head *zram_dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->dedup_hash[checksum & (zram->dedup_hash_size - 1)];
+}
+
+/* Called with dedup_lock held, which it drops */
+static u32 zram_entry_release(struct zram *zram, struct zram_entry *entry)
+{
+	u32 len;
+
+	if (entry->refcount || entry->pins) {
+		spin_unlock(&zram->dedup_lock);
+		return 0;
+	}
+	hlist_del(&entry->node);
+	spin_unlock(&zram->dedup_lock);
+
+	len = entry->len;
+	zs_free(zram->mem_pool, entry->handle);
+	kmem_cache_free(zram_entry_cache, entry);
+
+	return len;
+}
+
+/*
+ * Drop a table slot's reference to a shared object. Returns 1 if other
+ * slots still share it. *freed is set to the compressed size if the
+ * object itself went away, which a lookup in flight can delay.
+ */
+static int zram_entry_put(struct zram *zram, struct zram_entry *entry,
+			u32 *freed)
+{
+	int shared;
+
+	spin_lock(&zram->dedup_lock);
+	shared = --entry->refcount != 0;
+	*freed = zram_entry_release(zram, entry);
+
+	return shared;
+}
+
+/* Drop a lookup's pin. Returns the compressed size freed, if any. */
+static u32 zram_entry_unpin(struct zram *zram, struct zram_entry *entry)
+{
+	spin_lock(&zram->dedup_lock);
+	entry->pins--;
+	return zram_entry_release(zram, entry);
+}
+
+/*
+ * Publish a newly stored object for sharing. On failure the object is
+ * simply stored unshared.
+ */
+static struct zram_entry *zram_entry_add(struct zram *zram,
+				unsigned long handle, u32 len, u32 checksum)
+{
+	struct zram_entry *entry;
+
+	entry = kmem_cache_alloc(zram_entry_cache, GFP_NOIO);
+	if (unlikely(!entry))
+		return NULL;
+
+	entry->checksum = checksum;
+	entry->len = len;
+	entry->handle = handle;
+	entry->refcount = 1;
+	entry->pins = 0;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_add_head(&entry->node, zram_dedup_bucket(zram, checksum));
+	spin_unlock(&zram->dedup_lock);
+
+	return entry;
+}
+
+/*
+ * Find a stored object with the same content as @mem and take a
+ * reference to it. Only the first object with a matching checksum is
+ * compared, checksum collisions are rare enough not to bother. The
+ * candidate is decompressed into the workspace buffer, which is still
+ * much cheaper than compressing @mem.
+ *
+ * The candidate is only pinned while it is compared, so table slots
+ * letting go of it meanwhile still see how many slots share it and
+ * keep the dedup stats right.
+ *
+ * Readers decompress with the same tfm, the caller holds zstrm->dlock.
+ */
+static struct zram_entry *zram_entry_find(struct zram *zram,
+			struct zram_comp_strm *zstrm, void *mem, u32 checksum)
+{
+	int ret, found = 0;
+	unsigned int dlen = PAGE_SIZE;
+	struct zram_entry *entry;
+	struct hlist_node *pos;
+	void *cmem;
+	u32 freed;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_for_each_entry(entry, pos, zram_dedup_bucket(zram, checksum),
+			     node) {
+		if (entry->checksum == checksum && entry->refcount) {
+			entry->pins++;
+			found = 1;
+			break;
+		}
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	if (!found)
+		return NULL;
+
+	cmem = zs_map_object(zram->mem_pool, entry->handle, ZS_MM_RO);
+	ret = crypto_comp_decompress(zstrm->tfm, cmem, entry->len,
+				zstrm->buffer, &dlen);
+	zs_unmap_object(zram->mem_pool, entry->handle);
+
+	if (!ret && dlen == PAGE_SIZE &&
+	    !memcmp(zstrm->buffer, mem, PAGE_SIZE)) {
+		spin_lock(&zram->dedup_lock);
+		if (entry->refcount) {
+			/* The pin becomes the new slot's reference */
+			entry->refcount++;
+			entry->pins--;
+			spin_unlock(&zram->dedup_lock);
+			return entry;
+		}
+		spin_unlock(&zram->dedup_lock);
+	}
+
+	/* Not a match, or no slot holds it any more */
+	freed = zram_entry_unpin(zram, entry);
+	if (freed) {
+		write_lock(&zram->table_lock);
+		zram->stats.compr_size -= freed;
+		write_unlock(&zram->table_lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Blocks of the backing device are handed out one page at a time.
+ * Returns zram->bd_nr_blocks if the device is full.
+ */
+static unsigned long zram_bd_alloc_block(struct zram *zram)
+{
+	unsigned long blk;
+
+	spin_lock(&zram->bd_lock);
+	blk = find_first_zero_bit(zram->bd_bitmap, zram->bd_nr_blocks);
+	if (blk < zram->bd_nr_blocks)
+		__set_bit(blk, zram->bd_bitmap);
+	spin_unlock(&zram->bd_lock);
+
+	return blk;
 }
 
+static void zram_bd_free_block(struct zram *zram, unsigned long blk)
+{
+	spin_lock(&zram->bd_lock);
+	__clear_bit(blk, zram->bd_bitmap);
+	spin_unlock(&zram->bd_lock);
+}
+
+/*
+ * Caller must hold zram->table_lock for writing. Clears all flags of
+ * the entry, including ZRAM_IDLE and ZRAM_UNDER_WB.
+ */
 static void zram_free_page(struct zram *zram, size_t index)
 {
-	u32 clen;
-	void *obj;
+	u32 clen = zram->table[index].size;
+	unsigned long handle = zram->table[index].handle;
+
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		zram_bd_free_block(zram, zram->table[index].element);
+		zram_stat_dec(&zram->stats.pages_wb);
+		goto reset;
+	}
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_stat_dec(&zram->stats.pages_same);
+		goto reset;
+	}
 
-	if (unlikely(!page)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
+	if (unlikely(!handle)) {
+		/* No memory is allocated for zero filled pages */
+		if (zram_test_flag(zram, index, ZRAM_ZERO))
 			zram_stat_dec(&zram->stats.pages_zero);
-		}
-		return;
+		goto reset;
 	}
 
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-		clen = PAGE_SIZE;
-		__free_page(page);
-		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
+		__free_page(zram->table[index].page);
 		zram_stat_dec(&zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+		u32 freed;
 
-	xv_free(zram->mem_pool, page, offset);
-	if (clen <= PAGE_SIZE / 2)
+		if (zram_entry_put(zram, zram->table[index].entry, &freed)) {
+			/* Others still share the object */
+			zram_stat_dec(&zram->stats.pages_dedup);
+			zram->stats.dedup_size -= clen;
+		}
+		/* Only counted once freed, a lookup may hold it a bit longer */
+		clen = freed;
+	} else {
+		zs_free(zram->mem_pool, handle);
+	}
+	if (zram->table[index].size <= PAGE_SIZE / 2)
 		zram_stat_dec(&zram->stats.good_compress);
 
 out:
 	zram->stats.compr_size -= clen;
 	zram_stat_dec(&zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+reset:
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
+	zram->table[index].flags = 0;
 }
 
 static void handle_zero_page(struct page *page)
@@ -198,14 +410,26 @@ static void handle_zero_page(struct page *page)
 	flush_dcache_page(page);
 }
 
+static void handle_same_page(struct page *page, unsigned long element)
+{
+	unsigned int pos;
+	unsigned long *user_mem;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	for (pos = 0; pos != PAGE_SIZE / sizeof(*user_mem); pos++)
+		user_mem[pos] = element;
+	kunmap_atomic(user_mem, KM_USER0);
+
+	flush_dcache_page(page);
+}
+
 static void handle_uncompressed_page(struct zram *zram,
 				struct page *page, u32 index)
 {
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = kmap_atomic(zram->table[index].page, KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
@@ -214,67 +438,299 @@ static void handle_uncompressed_page(struct zram *zram,
 	flush_dcache_page(page);
 }
 
-static int zram_read(struct zram *zram, struct bio *bio)
+/*
+ * Pick the workspace of the CPU we are running on. We may migrate
+ * once we sleep on its mutex; that only costs locality, the mutex
+ * still keeps the workspace private to us.
+ */
+static struct zram_comp_strm *
+zram_comp_strm_get(struct zram_comp_strm __percpu *strm)
 {
+	struct zram_comp_strm *zstrm;
 
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	zstrm = per_cpu_ptr(strm, raw_smp_processor_id());
+	mutex_lock(&zstrm->lock);
 
-	zram_stat64_inc(zram, &zram->stats.num_reads);
+	return zstrm;
+}
 
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
-		struct page *page;
-		struct zobj_header *zheader;
-		unsigned char *user_mem, *cmem;
+static void zram_comp_strm_put(struct zram_comp_strm *zstrm)
+{
+	mutex_unlock(&zstrm->lock);
+}
 
-		page = bvec->bv_page;
+/*
+ * Readers share the tfm of the writers. Compression and decompression
+ * keep separate state in the crypto_comp algorithms (lzo needs none to
+ * decompress, deflate has a stream for each way), so only readers need
+ * to be kept apart from each other.
+ */
+static struct zram_comp_strm *
+zram_decomp_strm_get(struct zram_comp_strm __percpu *strm)
+{
+	struct zram_comp_strm *zstrm;
 
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			handle_zero_page(page);
-			continue;
-		}
+	zstrm = per_cpu_ptr(strm, raw_smp_processor_id());
+	mutex_lock(&zstrm->dlock);
 
-		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
-			pr_debug("Read before write: sector=%lu, size=%u",
-				(ulong)(bio->bi_sector), bio->bi_size);
-			/* Do nothing */
-			continue;
-		}
+	return zstrm;
+}
 
-		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
-			continue;
-		}
+static void zram_decomp_strm_put(struct zram_comp_strm *zstrm)
+{
+	mutex_unlock(&zstrm->dlock);
+}
 
-		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
+static void zram_comp_strm_destroy(struct zram_comp_strm __percpu *strm)
+{
+	int cpu;
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+	if (!strm)
+		return;
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_strm *zstrm;
 
-		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+		zstrm = per_cpu_ptr(strm, cpu);
+		if (zstrm->tfm)
+			crypto_free_comp(zstrm->tfm);
+		free_pages((unsigned long)zstrm->buffer, 1);
+	}
+
+	free_percpu(strm);
+}
+
+/* Allocate a workspace per possible CPU for the given compressor */
+static struct zram_comp_strm __percpu *
+zram_comp_strm_create(const char *compressor)
+{
+	int cpu;
+	struct zram_comp_strm __percpu *strm;
+
+	strm = alloc_percpu(struct zram_comp_strm);
+	if (!strm)
+		return NULL;
+
+	for_each_possible_cpu(cpu) {
+		struct zram_comp_strm *zstrm;
+		struct crypto_comp *tfm;
+
+		zstrm = per_cpu_ptr(strm, cpu);
+		mutex_init(&zstrm->lock);
+		mutex_init(&zstrm->dlock);
+
+		tfm = crypto_alloc_comp(compressor, 0, 0);
+		if (IS_ERR(tfm))
+			goto fail;
+		zstrm->tfm = tfm;
+
+		zstrm->buffer = (void *)__get_free_pages(GFP_KERNEL |
+							 __GFP_ZERO, 1);
+		if (!zstrm->buffer)
+			goto fail;
+	}
+
+	return strm;
+
+fail:
+	zram_comp_strm_destroy(strm);
+	return NULL;
+}
+
+static void zram_bd_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+/*
+ * Start reading or writing one page at block @blk of the backing
+ * device, zram_bd_wait() waits for it.
+ */
+static int zram_bd_submit(struct zram *zram, struct zram_bd_io *io,
+			struct page *page, unsigned long blk, int rw)
+{
+	struct bio *bio;
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_sector = (sector_t)blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_bdev = zram->bd_bdev;
+	bio->bi_io_vec[0].bv_page = page;
+	bio->bi_io_vec[0].bv_len = PAGE_SIZE;
+	bio->bi_io_vec[0].bv_offset = 0;
+	bio->bi_vcnt = 1;
+	bio->bi_idx = 0;
+	bio->bi_size = PAGE_SIZE;
+	bio->bi_end_io = zram_bd_end_io;
+	bio->bi_private = &io->done;
+
+	init_completion(&io->done);
+	io->bio = bio;
+	submit_bio(rw, bio);
+
+	return 0;
+}
+
+static int zram_bd_wait(struct zram_bd_io *io)
+{
+	int ret;
+
+	wait_for_completion(&io->done);
+	ret = test_bit(BIO_UPTODATE, &io->bio->bi_flags) ? 0 : -EIO;
+	bio_put(io->bio);
+
+	return ret;
+}
+
+/* zram_read_page() flags */
+#define ZRAM_READ_BD		0x1	/* may wait for the backing device */
+#define ZRAM_READ_KEEP_IDLE	0x2	/* not an access, keep ZRAM_IDLE */
+
+/*
+ * Pages on the backing device can only be read with ZRAM_READ_BD, from
+ * a context that may wait for a bio; -EAGAIN is returned otherwise.
+ */
+static int zram_read_page(struct zram *zram, struct page *page, u32 index,
+			int flags)
+{
+	int ret;
+	ktime_t start;
+	unsigned int clen;
+	unsigned long handle;
+	struct zram_comp_strm *zstrm;
+	unsigned char *user_mem, *cmem;
 
-		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
-			pr_err("Decompression failed! err=%d, page=%u\n",
+retry:
+	zstrm = zram_decomp_strm_get(zram->comp_strm);
+	read_lock(&zram->table_lock);
+
+	/*
+	 * Readers only ever clear this bit, so racing with each other
+	 * under the read lock cannot lose an update of another flag.
+	 */
+	if (!(flags & ZRAM_READ_KEEP_IDLE) &&
+	    zram_test_flag(zram, index, ZRAM_IDLE))
+		zram_clear_flag(zram, index, ZRAM_IDLE);
+
+	if (unlikely(zram_test_flag(zram, index, ZRAM_WB))) {
+		struct zram_bd_io io;
+		unsigned long blk = zram->table[index].element;
+		int valid;
+
+		read_unlock(&zram->table_lock);
+		zram_decomp_strm_put(zstrm);
+
+		if (!(flags & ZRAM_READ_BD))
+			return -EAGAIN;
+
+		ret = zram_bd_submit(zram, &io, page, blk, READ_SYNC);
+		if (!ret)
+			ret = zram_bd_wait(&io);
+		if (ret) {
+			pr_err("Backing device read failed! err=%d, page=%u\n",
 				ret, index);
+			return ret;
+		}
+
+		/* The page may have been rewritten and its block reused */
+		read_lock(&zram->table_lock);
+		valid = zram_test_flag(zram, index, ZRAM_WB) &&
+			zram->table[index].element == blk;
+		read_unlock(&zram->table_lock);
+		if (!valid)
+			goto retry;
+
+		zram_stat64_inc(zram, &zram->stats.bd_reads);
+		return 0;
+	}
+
+	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+		read_unlock(&zram->table_lock);
+		zram_decomp_strm_put(zstrm);
+		handle_zero_page(page);
+		return 0;
+	}
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		unsigned long element = zram->table[index].element;
+
+		read_unlock(&zram->table_lock);
+		zram_decomp_strm_put(zstrm);
+		handle_same_page(page, element);
+		return 0;
+	}
+
+	/* Requested page is not present in compressed area */
+	if (unlikely(!zram->table[index].handle)) {
+		read_unlock(&zram->table_lock);
+		zram_decomp_strm_put(zstrm);
+		pr_debug("Read before write: index=%u\n", index);
+		/* Do nothing */
+		return 0;
+	}
+
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		handle_uncompressed_page(zram, page, index);
+		read_unlock(&zram->table_lock);
+		zram_decomp_strm_put(zstrm);
+		return 0;
+	}
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	clen = PAGE_SIZE;
+
+	handle = zram->table[index].handle;
+	if (zram_test_flag(zram, index, ZRAM_DEDUP))
+		handle = zram->table[index].entry->handle;
+
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+
+	start = ktime_get();
+	ret = crypto_comp_decompress(zstrm->tfm, cmem,
+		zram->table[index].size, user_mem, &clen);
+
+	zs_unmap_object(zram->mem_pool, handle);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	read_unlock(&zram->table_lock);
+	zram_decomp_strm_put(zstrm);
+
+	zram_stat64_time(zram, &zram->stats.num_decompress,
+			&zram->stats.decompress_time_ns, start);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret || clen != PAGE_SIZE)) {
+		pr_err("Decompression failed! err=%d, page=%u\n",
+			ret, index);
+		return -EIO;
+	}
+
+	flush_dcache_page(page);
+	return 0;
+}
+
+/*
+ * Completes the bio, unless a page is on the backing device and
+ * ZRAM_READ_BD is not given; then -EAGAIN is returned.
+ */
+static int zram_read_bio(struct zram *zram, struct bio *bio, int flags)
+{
+	int i, ret;
+	u32 index;
+	struct bio_vec *bvec;
+
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	bio_for_each_segment(bvec, bio, i) {
+		ret = zram_read_page(zram, bvec->bv_page, index, flags);
+		if (ret == -EAGAIN)
+			return ret;
+		if (unlikely(ret)) {
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
 			goto out;
 		}
-
-		flush_dcache_page(page);
 		index++;
 	}
 
@@ -287,121 +743,215 @@ out:
 	return 0;
 }
 
-static int zram_write(struct zram *zram, struct bio *bio)
+static void zram_bd_read_work(struct work_struct *work)
 {
-	int i;
-	u32 index;
-	struct bio_vec *bvec;
+	struct zram *zram = container_of(work, struct zram, bd_read_work);
+	struct bio *bio;
 
-	zram_stat64_inc(zram, &zram->stats.num_writes);
+	for (;;) {
+		spin_lock_irq(&zram->bd_read_lock);
+		bio = bio_list_pop(&zram->bd_read_bios);
+		spin_unlock_irq(&zram->bd_read_lock);
+		if (!bio)
+			break;
 
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+		zram_read_bio(zram, bio, ZRAM_READ_BD);
+	}
+}
 
-	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
-		size_t clen;
-		struct zobj_header *zheader;
-		struct page *page, *page_store;
-		unsigned char *user_mem, *cmem, *src;
-
-		page = bvec->bv_page;
-		src = zram->compress_buffer;
-
-		/*
-		 * System overwrites unused sectors. Free memory associated
-		 * with this sector now.
-		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
-			zram_free_page(zram, index);
-
-		mutex_lock(&zram->lock);
-
-		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
-			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
+static int zram_read(struct zram *zram, struct bio *bio)
+{
+	unsigned long flags;
+
+	zram_stat64_inc(zram, &zram->stats.num_reads);
+
+	if (likely(zram_read_bio(zram, bio, 0) != -EAGAIN))
+		return 0;
+
+	/*
+	 * Bios submitted from within make_request are only issued once
+	 * we return, so waiting for the backing device here would hang.
+	 * Read the whole bio again from process context.
+	 */
+	spin_lock_irqsave(&zram->bd_read_lock, flags);
+	bio_list_add(&zram->bd_read_bios, bio);
+	spin_unlock_irqrestore(&zram->bd_read_lock, flags);
+	queue_work(zram_bd_wq, &zram->bd_read_work);
+
+	return 0;
+}
+
+/*
+ * Compress and store one page. Compression and allocation run without
+ * zram->table_lock; the lock is only taken to swap the new object into
+ * the table, so writers on different CPUs and readers do not wait for
+ * each other's compression.
+ */
+static int zram_write_page(struct zram *zram, struct page *page, u32 index)
+{
+	int ret, uncompressed = 0;
+	size_t clen;
+	unsigned int dlen;
+	unsigned long handle = 0, element;
+	u32 checksum = 0;
+	ktime_t start;
+	struct zram_entry *entry = NULL;
+	struct zram_comp_strm *zstrm;
+	struct page *page_store;
+	unsigned char *user_mem, *cmem, *src;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	if (page_same_filled(user_mem, &element)) {
+		kunmap_atomic(user_mem, KM_USER0);
+		write_lock(&zram->table_lock);
+		zram_free_page(zram, index);
+		if (!element) {
 			zram_stat_inc(&zram->stats.pages_zero);
 			zram_set_flag(zram, index, ZRAM_ZERO);
-			continue;
+		} else {
+			zram_stat_inc(&zram->stats.pages_same);
+			zram_set_flag(zram, index, ZRAM_SAME);
+			zram->table[index].element = element;
 		}
+		write_unlock(&zram->table_lock);
+		return 0;
+	}
+	kunmap_atomic(user_mem, KM_USER0);
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+	zstrm = zram_comp_strm_get(zram->comp_strm);
+	src = zstrm->buffer;
 
-		kunmap_atomic(user_mem, KM_USER0);
+	if (zram->dedup)
+		mutex_lock(&zstrm->dlock);
+	user_mem = kmap_atomic(page, KM_USER0);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
-			pr_err("Compression failed! err=%d\n", ret);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
-			goto out;
+	if (zram->dedup) {
+		checksum = jhash2((u32 *)user_mem, PAGE_SIZE / sizeof(u32), 0);
+		entry = zram_entry_find(zram, zstrm, user_mem, checksum);
+		mutex_unlock(&zstrm->dlock);
+		if (entry) {
+			kunmap_atomic(user_mem, KM_USER0);
+			zram_comp_strm_put(zstrm);
+			clen = entry->len;
+			goto install;
 		}
+	}
 
-		/*
-		 * Page is incompressible. Store it as-is (uncompressed)
-		 * since we do not want to return too many disk write
-		 * errors which has side effect of hanging the system.
-		 */
-		if (unlikely(clen > max_zpage_size)) {
-			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
-				pr_info("Error allocating memory for "
-					"incompressible page: %u\n", index);
-				zram_stat64_inc(zram,
-					&zram->stats.failed_writes);
-				goto out;
-			}
+	start = ktime_get();
+	dlen = 2 * PAGE_SIZE;
+	ret = crypto_comp_compress(zstrm->tfm, user_mem, PAGE_SIZE,
+				src, &dlen);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	if (unlikely(ret)) {
+		pr_err("Compression failed! err=%d\n", ret);
+		ret = -EIO;
+		goto out;
+	}
 
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
-			src = kmap_atomic(page, KM_USER0);
-			goto memstore;
+	clen = dlen;
+	zram_stat64_time(zram, &zram->stats.num_compress,
+			&zram->stats.compress_time_ns, start);
+	zram_stat64_add(zram, &zram->stats.compress_bytes, clen);
+
+	/*
+	 * Page is incompressible. Store it as-is (uncompressed)
+	 * since we do not want to return too many disk write
+	 * errors which has side effect of hanging the system.
+	 */
+	if (unlikely(clen > max_zpage_size)) {
+		clen = PAGE_SIZE;
+		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+		if (unlikely(!page_store)) {
+			pr_info("Error allocating memory for "
+				"incompressible page: %u\n", index);
+			ret = -ENOMEM;
+			goto out;
 		}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
+		uncompressed = 1;
+		src = kmap_atomic(page, KM_USER0);
+		cmem = kmap_atomic(page_store, KM_USER1);
+		memcpy(cmem, src, clen);
+		kunmap_atomic(cmem, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+	} else {
+		handle = zs_malloc(zram->mem_pool, clen,
+				GFP_NOIO | __GFP_HIGHMEM);
+		if (unlikely(!handle)) {
 			pr_info("Error allocating memory for compressed "
 				"page: %u, size=%zu\n", index, clen);
-			zram_stat64_inc(zram, &zram->stats.failed_writes);
+			ret = -ENOMEM;
 			goto out;
 		}
 
-memstore:
-		zram->table[index].offset = offset;
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
+		memcpy(cmem, src, clen);
+		zs_unmap_object(zram->mem_pool, handle);
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		if (zram->dedup)
+			entry = zram_entry_add(zram, handle, clen, checksum);
+	}
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
-			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
-			cmem += sizeof(*zheader);
-		}
-#endif
+	zram_comp_strm_put(zstrm);
 
-		memcpy(cmem, src, clen);
+install:
+	write_lock(&zram->table_lock);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			kunmap_atomic(src, KM_USER0);
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	zram_free_page(zram, index);
 
-		/* Update stats */
+	if (unlikely(uncompressed)) {
+		zram->table[index].page = page_store;
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram_stat_inc(&zram->stats.pages_expand);
+	} else if (entry) {
+		zram->table[index].entry = entry;
+		zram_set_flag(zram, index, ZRAM_DEDUP);
+	} else {
+		zram->table[index].handle = handle;
+	}
+	zram->table[index].size = clen;
+
+	/* Update stats */
+	if (entry && !handle) {
+		/* Shares an existing object */
+		zram_stat_inc(&zram->stats.pages_dedup);
+		zram->stats.dedup_size += clen;
+	} else {
 		zram->stats.compr_size += clen;
-		zram_stat_inc(&zram->stats.pages_stored);
-		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+	}
+	zram_stat_inc(&zram->stats.pages_stored);
+	if (clen <= PAGE_SIZE / 2)
+		zram_stat_inc(&zram->stats.good_compress);
+
+	write_unlock(&zram->table_lock);
+
+	return 0;
+
+out:
+	zram_comp_strm_put(zstrm);
+	return ret;
+}
+
+static int zram_write(struct zram *zram, struct bio *bio)
+{
+	int i;
+	u32 index;
+	struct bio_vec *bvec;
+
+	zram_stat64_inc(zram, &zram->stats.num_writes);
 
-		mutex_unlock(&zram->lock);
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (unlikely(zram_write_page(zram, bvec->bv_page, index))) {
+			zram_stat64_inc(zram, &zram->stats.failed_writes);
+			goto out;
+		}
 		index++;
 	}
 
@@ -463,41 +1013,371 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 	return ret;
 }
 
+static int zram_bd_open(struct zram *zram, char *name)
+{
+	int ret;
+	struct file *file;
+	struct block_device *bdev;
+	unsigned long nr_blocks, *bitmap;
+
+	file = filp_open(name, O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+
+	if (!S_ISBLK(file->f_mapping->host->i_mode)) {
+		ret = -ENOTBLK;
+		goto out_close;
+	}
+
+	bdev = I_BDEV(file->f_mapping->host);
+	ret = bd_claim(bdev, zram);
+	if (ret)
+		goto out_close;
+
+	ret = set_blocksize(bdev, PAGE_SIZE);
+	if (ret)
+		goto out_release;
+
+	nr_blocks = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (!nr_blocks) {
+		ret = -EINVAL;
+		goto out_release;
+	}
+
+	bitmap = vmalloc(BITS_TO_LONGS(nr_blocks) * sizeof(long));
+	if (!bitmap) {
+		ret = -ENOMEM;
+		goto out_release;
+	}
+	memset(bitmap, 0, BITS_TO_LONGS(nr_blocks) * sizeof(long));
+
+	zram->bd_name = name;
+	zram->bd_file = file;
+	zram->bd_bdev = bdev;
+	zram->bd_bitmap = bitmap;
+	zram->bd_nr_blocks = nr_blocks;
+
+	pr_info("%s: using %s as backing device, %lu pages\n",
+		zram->disk->disk_name, name, nr_blocks);
+	return 0;
+
+out_release:
+	bd_release(bdev);
+out_close:
+	filp_close(file, NULL);
+	return ret;
+}
+
+static void zram_bd_release(struct zram *zram)
+{
+	if (!zram->bd_file)
+		return;
+
+	bd_release(zram->bd_bdev);
+	filp_close(zram->bd_file, NULL);
+	vfree(zram->bd_bitmap);
+	kfree(zram->bd_name);
+
+	zram->bd_name = NULL;
+	zram->bd_file = NULL;
+	zram->bd_bdev = NULL;
+	zram->bd_bitmap = NULL;
+	zram->bd_nr_blocks = 0;
+}
+
+enum zram_wb_mode {
+	ZRAM_WB_IDLE,		/* pages not accessed since marked idle */
+	ZRAM_WB_HUGE,		/* pages stored uncompressed */
+};
+
+struct zram_wb_req {
+	u32 index;
+	unsigned long blk;
+	struct page *page;
+	struct zram_bd_io io;
+	int err;
+};
+
+/*
+ * Zero and same-filled pages take no memory and are never written back.
+ * Caller must hold zram->table_lock.
+ */
+static int zram_wb_candidate(struct zram *zram, u32 index,
+			enum zram_wb_mode mode)
+{
+	if (zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNDER_WB) ||
+	    zram_test_flag(zram, index, ZRAM_SAME) ||
+	    !zram->table[index].handle)
+		return 0;
+
+	if (mode == ZRAM_WB_HUGE)
+		return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+
+	return zram_test_flag(zram, index, ZRAM_IDLE);
+}
+
+/*
+ * Move pages matching @mode to the backing device, ZRAM_WB_BATCH at a
+ * time. Candidates are marked ZRAM_UNDER_WB and copied out; once their
+ * batch is on disk, only those still marked, i.e. not rewritten or
+ * freed meanwhile, have their memory released. Caller must hold
+ * zram->init_lock.
+ */
+static int zram_writeback(struct zram *zram, enum zram_wb_mode mode)
+{
+	int ret = 0;
+	unsigned int i, n;
+	u32 index = 0, nr_pages = zram->disksize >> PAGE_SHIFT;
+	u64 written;
+	struct zram_wb_req *reqs;
+
+	reqs = kcalloc(ZRAM_WB_BATCH, sizeof(*reqs), GFP_KERNEL);
+	if (!reqs)
+		return -ENOMEM;
+
+	for (i = 0; i < ZRAM_WB_BATCH; i++) {
+		reqs[i].page = alloc_page(GFP_KERNEL);
+		if (!reqs[i].page) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	while (index < nr_pages && !ret) {
+		for (n = 0; n < ZRAM_WB_BATCH && index < nr_pages; index++) {
+			struct zram_wb_req *req = &reqs[n];
+
+			write_lock(&zram->table_lock);
+			if (!zram_wb_candidate(zram, index, mode)) {
+				write_unlock(&zram->table_lock);
+				continue;
+			}
+			zram_set_flag(zram, index, ZRAM_UNDER_WB);
+			write_unlock(&zram->table_lock);
+
+			req->blk = zram_bd_alloc_block(zram);
+			if (req->blk == zram->bd_nr_blocks)
+				ret = -ENOSPC;
+			else if (zram_read_page(zram, req->page, index,
+						ZRAM_READ_KEEP_IDLE))
+				ret = -EIO;
+
+			if (ret) {
+				write_lock(&zram->table_lock);
+				zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+				write_unlock(&zram->table_lock);
+				if (req->blk != zram->bd_nr_blocks)
+					zram_bd_free_block(zram, req->blk);
+				break;
+			}
+
+			req->index = index;
+			n++;
+		}
+
+		for (i = 0; i < n; i++)
+			reqs[i].err = zram_bd_submit(zram, &reqs[i].io,
+					reqs[i].page, reqs[i].blk, WRITE);
+		blk_unplug(bdev_get_queue(zram->bd_bdev));
+
+		written = 0;
+		for (i = 0; i < n; i++) {
+			struct zram_wb_req *req = &reqs[i];
+
+			if (!req->err)
+				req->err = zram_bd_wait(&req->io);
+
+			write_lock(&zram->table_lock);
+			if (!req->err &&
+			    zram_test_flag(zram, req->index, ZRAM_UNDER_WB)) {
+				zram_free_page(zram, req->index);
+				zram_set_flag(zram, req->index, ZRAM_WB);
+				zram->table[req->index].element = req->blk;
+				zram_stat_inc(&zram->stats.pages_wb);
+				written++;
+			} else {
+				zram_clear_flag(zram, req->index,
+						ZRAM_UNDER_WB);
+				zram_bd_free_block(zram, req->blk);
+			}
+			write_unlock(&zram->table_lock);
+
+			if (req->err && !ret)
+				ret = req->err;
+		}
+		zram_stat64_add(zram, &zram->stats.bd_writes, written);
+	}
+
+out:
+	for (i = 0; i < ZRAM_WB_BATCH; i++)
+		if (reqs[i].page)
+			__free_page(reqs[i].page);
+	kfree(reqs);
+
+	return ret;
+}
+
+static struct zram *dev_to_zram(struct device *dev)
+{
+	return dev_to_disk(dev)->private_data;
+}
+
+static ssize_t backing_dev_show(struct device *dev,
+			struct device_attribute *attr, char *buf)
+{
+	ssize_t ret;
+	struct zram *zram = dev_to_zram(dev);
+
+	mutex_lock(&zram->init_lock);
+	ret = sprintf(buf, "%s\n", zram->bd_name ? zram->bd_name : "none");
+	mutex_unlock(&zram->init_lock);
+
+	return ret;
+}
+
+static ssize_t backing_dev_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret = 0;
+	char *name;
+	struct zram *zram = dev_to_zram(dev);
+
+	name = kstrndup(buf, len, GFP_KERNEL);
+	if (!name)
+		return -ENOMEM;
+	if (len && name[len - 1] == '\n')
+		name[len - 1] = '\0';
+
+	mutex_lock(&zram->init_lock);
+	if (zram->init_done) {
+		pr_info("Cannot change backing device of an initialized "
+			"device\n");
+		ret = -EBUSY;
+		goto out;
+	}
+
+	zram_bd_release(zram);
+	if (strcmp(name, "none")) {
+		ret = zram_bd_open(zram, name);
+		if (!ret)
+			name = NULL;	/* now owned by zram */
+	}
+
+out:
+	mutex_unlock(&zram->init_lock);
+	kfree(name);
+
+	return ret ? ret : len;
+}
+
+static ssize_t idle_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t len)
+{
+	u32 index;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (!sysfs_streq(buf, "all"))
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done) {
+		mutex_unlock(&zram->init_lock);
+		return -EINVAL;
+	}
+
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
+		write_lock(&zram->table_lock);
+		if (zram->table[index].handle &&
+		    !zram_test_flag(zram, index, ZRAM_SAME) &&
+		    !zram_test_flag(zram, index, ZRAM_WB))
+			zram_set_flag(zram, index, ZRAM_IDLE);
+		write_unlock(&zram->table_lock);
+	}
+	mutex_unlock(&zram->init_lock);
+
+	return len;
+}
+
+static ssize_t writeback_store(struct device *dev,
+			struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	enum zram_wb_mode mode;
+	struct zram *zram = dev_to_zram(dev);
+
+	if (sysfs_streq(buf, "idle"))
+		mode = ZRAM_WB_IDLE;
+	else if (sysfs_streq(buf, "huge"))
+		mode = ZRAM_WB_HUGE;
+	else
+		return -EINVAL;
+
+	mutex_lock(&zram->init_lock);
+	if (!zram->init_done || !zram->bd_file)
+		ret = -EINVAL;
+	else
+		ret = zram_writeback(zram, mode);
+	mutex_unlock(&zram->init_lock);
+
+	return ret ? ret : len;
+}
+
+static DEVICE_ATTR(backing_dev, S_IRUGO | S_IWUSR,
+		backing_dev_show, backing_dev_store);
+static DEVICE_ATTR(idle, S_IWUSR, NULL, idle_store);
+static DEVICE_ATTR(writeback, S_IWUSR, NULL, writeback_store);
+
+static struct attribute *zram_disk_attrs[] = {
+	&dev_attr_backing_dev.attr,
+	&dev_attr_idle.attr,
+	&dev_attr_writeback.attr,
+	NULL,
+};
+
+static struct attribute_group zram_disk_attr_group = {
+	.attrs = zram_disk_attrs,
+};
+
 static void reset_device(struct zram *zram)
 {
 	size_t index;
 
 	/* Do not accept any new I/O request */
 	zram->init_done = 0;
+	flush_work(&zram->bd_read_work);
 
 	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
-
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+	zram_comp_strm_destroy(zram->comp_strm);
+	zram->comp_strm = NULL;
 
 	/* Free all pages that are still in this zram device */
 	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
-
-		if (!page)
+		if (zram_test_flag(zram, index, ZRAM_SAME) ||
+				zram_test_flag(zram, index, ZRAM_WB) ||
+				!zram->table[index].handle)
 			continue;
 
 		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
+			__free_page(zram->table[index].page);
+		else if (zram_test_flag(zram, index, ZRAM_DEDUP)) {
+			u32 freed;
+
+			zram_entry_put(zram, zram->table[index].entry, &freed);
+		} else
+			zs_free(zram->mem_pool, zram->table[index].handle);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	/* Callers release the backing device, see zram_ioctl_reset_device() */
+
+	vfree(zram->dedup_hash);
+	zram->dedup_hash = NULL;
+
+	if (zram->mem_pool)
+		zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -518,16 +1398,10 @@ static int zram_ioctl_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
+	zram->comp_strm = zram_comp_strm_create(zram->compressor);
+	if (!zram->comp_strm) {
+		pr_err("Error allocating %s compressor workspaces!\n",
+			zram->compressor);
 		ret = -ENOMEM;
 		goto fail;
 	}
@@ -543,12 +1417,28 @@ static int zram_ioctl_init_device(struct zram *zram)
 	}
 	memset(zram->table, 0, num_pages * sizeof(*zram->table));
 
+	if (zram->dedup) {
+		unsigned int i;
+
+		zram->dedup_hash_size = roundup_pow_of_two(
+					max_t(size_t, num_pages / 16, 64));
+		zram->dedup_hash = vmalloc(zram->dedup_hash_size *
+					sizeof(*zram->dedup_hash));
+		if (!zram->dedup_hash) {
+			pr_err("Error allocating dedup hash table\n");
+			ret = -ENOMEM;
+			goto fail;
+		}
+		for (i = 0; i < zram->dedup_hash_size; i++)
+			INIT_HLIST_HEAD(&zram->dedup_hash[i]);
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool(zram->disk->disk_name);
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -571,6 +1461,7 @@ static int zram_ioctl_reset_device(struct zram *zram)
 {
 	if (zram->init_done)
 		reset_device(zram);
+	zram_bd_release(zram);
 
 	return 0;
 }
@@ -598,6 +1489,46 @@ static int zram_ioctl(struct block_device *bdev, fmode_t mode,
 		pr_info("Disk size set to %zu kB\n", disksize_kb);
 		break;
 
+	case ZRAMIO_SET_DEDUP:
+	{
+		int dedup;
+
+		if (zram->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(&dedup, (void *)arg, sizeof(dedup))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		zram->dedup = !!dedup;
+		pr_info("Deduplication %s\n", dedup ? "enabled" : "disabled");
+		break;
+	}
+
+	case ZRAMIO_SET_COMPRESSOR:
+	{
+		char name[ZRAM_COMP_NAME_LEN];
+
+		if (zram->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(name, (void *)arg, sizeof(name))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		name[sizeof(name) - 1] = '\0';
+		if (!crypto_has_comp(name, 0, 0)) {
+			pr_info("Compressor %s not available\n", name);
+			ret = -EINVAL;
+			goto out;
+		}
+		strcpy(zram->compressor, name);
+		pr_info("Compressor set to %s\n", name);
+		break;
+	}
+
 	case ZRAMIO_GET_STATS:
 	{
 		struct zram_ioctl_stats *stats;
@@ -619,8 +1550,19 @@ static int zram_ioctl(struct block_device *bdev, fmode_t mode,
 		kfree(stats);
 		break;
 	}
+	case ZRAMIO_COMPACT:
+		/* Returns the number of pages freed */
+		if (!zram->init_done) {
+			ret = -ENXIO;
+			goto out;
+		}
+		ret = zs_compact(zram->mem_pool);
+		break;
+
 	case ZRAMIO_INIT:
+		mutex_lock(&zram->init_lock);
 		ret = zram_ioctl_init_device(zram);
+		mutex_unlock(&zram->init_lock);
 		break;
 
 	case ZRAMIO_RESET:
@@ -634,7 +1576,9 @@ static int zram_ioctl(struct block_device *bdev, fmode_t mode,
 		if (bdev)
 			fsync_bdev(bdev);
 
+		mutex_lock(&zram->init_lock);
 		ret = zram_ioctl_reset_device(zram);
+		mutex_unlock(&zram->init_lock);
 		break;
 
 	default:
@@ -651,7 +1595,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	write_lock(&zram->table_lock);
 	zram_free_page(zram, index);
+	write_unlock(&zram->table_lock);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -665,7 +1611,14 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
+	rwlock_init(&zram->table_lock);
+	mutex_init(&zram->init_lock);
+	spin_lock_init(&zram->dedup_lock);
+	spin_lock_init(&zram->bd_lock);
+	spin_lock_init(&zram->bd_read_lock);
+	bio_list_init(&zram->bd_read_bios);
+	INIT_WORK(&zram->bd_read_work, zram_bd_read_work);
+	strcpy(zram->compressor, default_compressor);
 	spin_lock_init(&zram->stat64_lock);
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
@@ -710,6 +1663,19 @@ static int create_device(struct zram *zram, int device_id)
 
 	add_disk(zram->disk);
 
+	ret = sysfs_create_group(&disk_to_dev(zram->disk)->kobj,
+				&zram_disk_attr_group);
+	if (ret) {
+		pr_warning("Error creating sysfs group for device %d\n",
+			device_id);
+		del_gendisk(zram->disk);
+		put_disk(zram->disk);
+		zram->disk = NULL;
+		blk_cleanup_queue(zram->queue);
+		zram->queue = NULL;
+		goto out;
+	}
+
 	zram->init_done = 0;
 
 out:
@@ -719,6 +1685,8 @@ out:
 static void destroy_device(struct zram *zram)
 {
 	if (zram->disk) {
+		sysfs_remove_group(&disk_to_dev(zram->disk)->kobj,
+				&zram_disk_attr_group);
 		del_gendisk(zram->disk);
 		put_disk(zram->disk);
 	}
@@ -750,12 +1718,24 @@ static int __init zram_init(void)
 		num_devices = 1;
 	}
 
+	zram_entry_cache = KMEM_CACHE(zram_entry, 0);
+	if (!zram_entry_cache) {
+		ret = -ENOMEM;
+		goto unregister;
+	}
+
+	zram_bd_wq = create_workqueue("zram_bd");
+	if (!zram_bd_wq) {
+		ret = -ENOMEM;
+		goto free_cache;
+	}
+
 	/* Allocate the device array and initialize each one */
 	pr_info("Creating %u devices ...\n", num_devices);
 	devices = kzalloc(num_devices * sizeof(struct zram), GFP_KERNEL);
 	if (!devices) {
 		ret = -ENOMEM;
-		goto unregister;
+		goto free_wq;
 	}
 
 	for (dev_id = 0; dev_id < num_devices; dev_id++) {
@@ -770,6 +1750,10 @@ free_devices:
 	while (dev_id)
 		destroy_device(&devices[--dev_id]);
 	kfree(devices);
+free_wq:
+	destroy_workqueue(zram_bd_wq);
+free_cache:
+	kmem_cache_destroy(zram_entry_cache);
 unregister:
 	unregister_blkdev(zram_major, "zram");
 out:
@@ -787,11 +1771,14 @@ static void __exit zram_exit(void)
 		destroy_device(zram);
 		if (zram->init_done)
 			reset_device(zram);
+		zram_bd_release(zram);
 	}
 
 	unregister_blkdev(zram_major, "zram");
 
 	kfree(devices);
+	destroy_workqueue(zram_bd_wq);
+	kmem_cache_destroy(zram_entry_cache);
 	pr_debug("Cleanup done!\n");
 }
 
@@ -17,9 +17,14 @@
 
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/crypto.h>
+#include <linux/ktime.h>
+#include <linux/bio.h>
+#include <linux/completion.h>
+#include <linux/workqueue.h>
 
 #include "zram_ioctl.h"
-#include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -27,20 +32,11 @@
  */
 static const unsigned max_num_devices = 32;
 
-/*
- * Stored at beginning of each compressed object.
- *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
- */
-struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
-};
-
 /*-- Configurable parameters */
 
+/* Default compressor, any crypto API compression algorithm will do */
+static const char default_compressor[] = "lzo";
+
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
@@ -52,10 +48,13 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE
+ * otherwise, zs_malloc() would always return failure.
  */
 
+/* Pages written to the backing device per batch */
+#define ZRAM_WB_BATCH		32
+
 /*-- End of configurable params */
 
 #define SECTOR_SHIFT		9
@@ -71,23 +70,75 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page is one repeated non-zero word, kept in table[].element */
+	ZRAM_SAME,
+
+	/* Page is stored in a shared table[].entry */
+	ZRAM_DEDUP,
+
+	/* Page was not accessed since it was last marked idle */
+	ZRAM_IDLE,
+
+	/* Page is on the backing device, at block table[].element */
+	ZRAM_WB,
+
+	/* Page is being written to the backing device */
+	ZRAM_UNDER_WB,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
+/*
+ * A compressed object shared by all table entries whose pages have
+ * the same content. Only used when deduplication is enabled.
+ */
+struct zram_entry {
+	struct hlist_node node;		/* in zram->dedup_hash */
+	u32 checksum;			/* of the uncompressed page */
+	u32 len;			/* compressed size */
+	unsigned long handle;		/* zsmalloc handle */
+	unsigned int refcount;		/* table slots, under dedup_lock */
+	unsigned int pins;		/* lookups in flight, ditto */
+};
+
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
+	union {
+		unsigned long handle;	/* zsmalloc handle */
+		struct page *page;	/* if ZRAM_UNCOMPRESSED */
+		struct zram_entry *entry; /* if ZRAM_DEDUP */
+		unsigned long element;	/* if ZRAM_SAME or ZRAM_WB */
+	};
+	u16 size;	/* compressed size in bytes */
 	u8 count;	/* object ref count (not yet used) */
 	u8 flags;
 } __attribute__((aligned(4)));
 
+/*
+ * Compression workspace, one for each possible CPU. Writers and
+ * readers take different locks, so that they all run in parallel.
+ */
+struct zram_comp_strm {
+	struct mutex lock;	/* serializes compression */
+	struct mutex dlock;	/* serializes decompression */
+	struct crypto_comp *tfm;
+	void *buffer;		/* compressed output (two pages) */
+};
+
+/* A single page I/O to the backing device */
+struct zram_bd_io {
+	struct bio *bio;
+	struct completion done;
+};
+
 struct zram_stats {
 	/* basic stats */
 	size_t compr_size;	/* compressed size of pages stored -
 				 * needed to enforce memlimit */
+	u64 dedup_size;		/* compressed size not stored again
+				 * thanks to deduplication */
 	/* more stats */
 #if defined(CONFIG_ZRAM_STATS)
 	u64 num_reads;		/* failed + successful */
@@ -97,23 +148,54 @@ struct zram_stats {
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_same;		/* no. of other same-filled pages */
+	u32 pages_dedup;	/* no. of pages sharing an object */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u32 pages_wb;		/* no. of pages on the backing device */
+	u64 bd_reads;		/* pages read from the backing device */
+	u64 bd_writes;		/* pages written to the backing device */
+	u64 num_compress;	/* compressor calls */
+	u64 compress_bytes;	/* compressor output, before any
+				 * incompressible page is stored raw */
+	u64 compress_time_ns;
+	u64 num_decompress;
+	u64 decompress_time_ns;
 #endif
 };
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct zram_comp_strm __percpu *comp_strm;
+	char compressor[ZRAM_COMP_NAME_LEN];
+	int dedup;		/* share objects between equal pages */
+	struct hlist_head *dedup_hash;
+	unsigned int dedup_hash_size;	/* power of two */
+	spinlock_t dedup_lock;	/* protect dedup_hash, entry refcounts */
 	struct table *table;
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	rwlock_t table_lock;	/* protect table entries and the 32-bit
+				 * stats; held only to look up or swap
+				 * entries, never while compressing */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
+	struct mutex init_lock;	/* serialize init, reset and sysfs */
+
+	/* Optional backing device for idle and incompressible pages */
+	char *bd_name;
+	struct file *bd_file;
+	struct block_device *bd_bdev;
+	unsigned long *bd_bitmap;	/* blocks in use */
+	unsigned long bd_nr_blocks;	/* in pages */
+	spinlock_t bd_lock;		/* protect bd_bitmap */
+
+	/* Reads of written back pages, deferred out of make_request */
+	struct bio_list bd_read_bios;
+	spinlock_t bd_read_lock;
+	struct work_struct bd_read_work;
+
 	/*
 	 * This is the limit on amount of *uncompressed* worth of data
 	 * we can store in a disk.
@@ -144,6 +226,24 @@ static void zram_stat64_inc(struct zram *zram, u64 *v)
 	spin_unlock(&zram->stat64_lock);
 }
 
+static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
+{
+	spin_lock(&zram->stat64_lock);
+	*v = *v + inc;
+	spin_unlock(&zram->stat64_lock);
+}
+
+static void zram_stat64_time(struct zram *zram, u64 *count, u64 *time_ns,
+				ktime_t start)
+{
+	s64 delta = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	spin_lock(&zram->stat64_lock);
+	*count = *count + 1;
+	*time_ns = *time_ns + delta;
+	spin_unlock(&zram->stat64_lock);
+}
+
 static u64 zram_stat64_read(struct zram *zram, u64 *v)
 {
 	u64 val;
@@ -158,6 +258,8 @@ static u64 zram_stat64_read(struct zram *zram, u64 *v)
 #define zram_stat_inc(v)
 #define zram_stat_dec(v)
 #define zram_stat64_inc(r, v)
+#define zram_stat64_add(r, v, i)
+#define zram_stat64_time(r, c, t, s)
 #define zram_stat64_read(r, v)
 #endif /* CONFIG_ZRAM_STATS */
 
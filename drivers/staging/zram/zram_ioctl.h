@@ -15,6 +15,9 @@
 #ifndef _ZRAM_IOCTL_H_
 #define _ZRAM_IOCTL_H_
 
+/* Max length of a crypto API compressor name, including the NUL */
+#define ZRAM_COMP_NAME_LEN	16
+
 struct zram_ioctl_stats {
 	u64 disksize;		/* disksize in bytes (user specifies in KB) */
 	u64 num_reads;		/* failed + successful */
@@ -31,11 +34,28 @@ struct zram_ioctl_stats {
 	u64 orig_data_size;
 	u64 compr_data_size;
 	u64 mem_used_total;
+	/* compressor stats, since the device was initialized */
+	char compressor[ZRAM_COMP_NAME_LEN];
+	u32 compress_ratio_pct;	/* compressor output / input */
+	u64 num_compress;	/* pages given to the compressor */
+	u64 compress_time_ns;
+	u64 num_decompress;
+	u64 decompress_time_ns;
+	u32 pages_same;		/* no. of pages filled with one word */
+	u32 pages_dedup;	/* no. of pages sharing a stored object */
+	u64 dedup_saved_size;	/* compressed bytes not stored thanks
+				 * to deduplication */
+	u32 pages_wb;		/* no. of pages on the backing device */
+	u64 bd_reads;		/* pages read from the backing device */
+	u64 bd_writes;		/* pages written to the backing device */
 } __attribute__ ((packed, aligned(4)));
 
 #define ZRAMIO_SET_DISKSIZE_KB	_IOW('z', 0, size_t)
 #define ZRAMIO_GET_STATS	_IOR('z', 1, struct zram_ioctl_stats)
 #define ZRAMIO_INIT		_IO('z', 2)
 #define ZRAMIO_RESET		_IO('z', 3)
+#define ZRAMIO_SET_COMPRESSOR	_IOW('z', 4, char[ZRAM_COMP_NAME_LEN])
+#define ZRAMIO_COMPACT		_IO('z', 5)
+#define ZRAMIO_SET_DEDUP	_IOW('z', 6, int)
 
 #endif
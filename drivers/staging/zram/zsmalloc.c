@@ -0,0 +1,567 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Size class allocator for compressed pages, replacing xvmalloc in zram.
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are sorted into size classes ZS_SIZE_CLASS_DELTA bytes apart.
+ * Each class packs its objects back to back into zspages of one to
+ * ZS_MAX_PAGES_PER_ZSPAGE pages, the zspage size being chosen to waste
+ * the least space for that class, so objects may straddle a page
+ * boundary. Such objects are bounced through a per-CPU buffer when
+ * mapped.
+ *
+ * Callers only ever see an opaque handle, so zs_compact() can move
+ * objects out of sparsely used zspages and give the pages back.
+ *
+ * Lock Ordering: class->lock -> pool->migrate_lock
+ */
+
+#include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static unsigned int get_size_class_index(size_t size)
+{
+	unsigned int idx = 0;
+
+	if (likely(size > ZS_MIN_ALLOC_SIZE))
+		idx = DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE,
+				   ZS_SIZE_CLASS_DELTA);
+
+	return idx;
+}
+
+/*
+ * Pick the zspage size, in pages, that leaves the smallest fraction
+ * of a zspage unused for objects of the given size.
+ */
+static unsigned int get_pages_per_zspage(unsigned int size)
+{
+	unsigned int i, best = 1, best_usedpc = 0;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		unsigned int zspage_size = i * PAGE_SIZE;
+		unsigned int usedpc;
+
+		usedpc = (zspage_size - zspage_size % size) * 100 / zspage_size;
+		if (usedpc > best_usedpc) {
+			best_usedpc = usedpc;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+static void obj_location(struct size_class *class, unsigned int obj_idx,
+			unsigned int *page_idx, unsigned int *offset)
+{
+	unsigned long off = (unsigned long)obj_idx * class->size;
+
+	*page_idx = off >> PAGE_SHIFT;
+	*offset = off & ~PAGE_MASK;
+}
+
+/*
+ * Copy a whole object, header included, from (to_buf) or to its
+ * zspage. Uses KM_USER1.
+ */
+static void copy_object(struct size_class *class, struct zspage *zspage,
+			unsigned int obj_idx, char *buf, int to_buf)
+{
+	unsigned int page_idx, offset, len, remain = class->size;
+
+	obj_location(class, obj_idx, &page_idx, &offset);
+	while (remain) {
+		char *addr;
+
+		len = min_t(unsigned int, remain, PAGE_SIZE - offset);
+		addr = kmap_atomic(zspage->pages[page_idx], KM_USER1);
+		if (to_buf)
+			memcpy(buf, addr + offset, len);
+		else
+			memcpy(addr + offset, buf, len);
+		kunmap_atomic(addr, KM_USER1);
+
+		buf += len;
+		remain -= len;
+		page_idx++;
+		offset = 0;
+	}
+}
+
+static void set_obj_handle(struct size_class *class, struct zspage *zspage,
+			unsigned int obj_idx, struct zs_handle *handle)
+{
+	unsigned int page_idx, offset;
+	char *addr;
+
+	obj_location(class, obj_idx, &page_idx, &offset);
+	addr = kmap_atomic(zspage->pages[page_idx], KM_USER1);
+	*(struct zs_handle **)(addr + offset) = handle;
+	kunmap_atomic(addr, KM_USER1);
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+				struct size_class *class, gfp_t flags)
+{
+	unsigned int i;
+	struct zspage *zspage;
+
+	zspage = kmem_cache_zalloc(pool->zspage_cachep, flags & ~__GFP_HIGHMEM);
+	if (unlikely(!zspage))
+		return NULL;
+
+	INIT_LIST_HEAD(&zspage->list);
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(flags);
+		if (unlikely(!zspage->pages[i]))
+			goto fail;
+	}
+
+	atomic_long_add(class->pages_per_zspage, &pool->total_pages);
+	return zspage;
+
+fail:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kmem_cache_free(pool->zspage_cachep, zspage);
+	return NULL;
+}
+
+static void free_zspage(struct zs_pool *pool, struct size_class *class,
+			struct zspage *zspage)
+{
+	unsigned int i;
+
+	for (i = 0; i < class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+	atomic_long_sub(class->pages_per_zspage, &pool->total_pages);
+	kmem_cache_free(pool->zspage_cachep, zspage);
+}
+
+/*
+ * Take a free object slot from @zspage. Caller must hold class->lock.
+ */
+static unsigned int obj_alloc(struct size_class *class, struct zspage *zspage)
+{
+	unsigned int obj_idx;
+
+	obj_idx = find_first_zero_bit(zspage->used, class->objs_per_zspage);
+	__set_bit(obj_idx, zspage->used);
+
+	/* Full zspages are not kept on any list */
+	if (++zspage->inuse == class->objs_per_zspage)
+		list_del_init(&zspage->list);
+
+	return obj_idx;
+}
+
+/*
+ * Return an object slot to @zspage. Caller must hold class->lock.
+ * Returns 1 if the zspage is now empty and has been unlinked, in which
+ * case the caller frees it.
+ */
+static int obj_free(struct size_class *class, struct zspage *zspage,
+			unsigned int obj_idx)
+{
+	/* Catch double free bugs */
+	BUG_ON(!__test_and_clear_bit(obj_idx, zspage->used));
+
+	if (zspage->inuse-- == class->objs_per_zspage)
+		list_add_tail(&zspage->list, &class->partial);
+
+	if (zspage->inuse)
+		return 0;
+
+	list_del(&zspage->list);
+	class->zspages--;
+	return 1;
+}
+
+/**
+ * zs_malloc - Allocate an object of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of object to allocate
+ * @flags: gfp flags for any new zspage, may include __GFP_HIGHMEM
+ *
+ * Returns an opaque handle to the object, to be passed to
+ * zs_map_object() to access it, or 0 on failure.
+ *
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE will fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags)
+{
+	unsigned int class_idx;
+	struct size_class *class;
+	struct zspage *zspage;
+	struct zs_handle *handle;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	class_idx = get_size_class_index(size + ZS_HANDLE_SIZE);
+	class = &pool->size_class[class_idx];
+
+	handle = kmem_cache_alloc(pool->handle_cachep, flags & ~__GFP_HIGHMEM);
+	if (unlikely(!handle))
+		return 0;
+	handle->class_idx = class_idx;
+
+	spin_lock(&class->lock);
+	if (list_empty(&class->partial)) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(pool, class, flags);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(pool->handle_cachep, handle);
+			return 0;
+		}
+
+		spin_lock(&class->lock);
+		list_add(&zspage->list, &class->partial);
+		class->zspages++;
+	}
+
+	zspage = list_first_entry(&class->partial, struct zspage, list);
+	handle->zspage = zspage;
+	handle->obj_idx = obj_alloc(class, zspage);
+	class->objs_inuse++;
+
+	/* Back-reference needed for compaction */
+	set_obj_handle(class, zspage, handle->obj_idx, handle);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+
+/*
+ * Free object identified by handle. The object must not be mapped.
+ */
+void zs_free(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *zh = (struct zs_handle *)handle;
+	struct size_class *class = &pool->size_class[zh->class_idx];
+	struct zspage *zspage;
+
+	spin_lock(&class->lock);
+	zspage = zh->zspage;
+	class->objs_inuse--;
+	if (!obj_free(class, zspage, zh->obj_idx))
+		zspage = NULL;
+	spin_unlock(&class->lock);
+
+	if (zspage)
+		free_zspage(pool, class, zspage);
+	kmem_cache_free(pool->handle_cachep, zh);
+}
+
+/**
+ * zs_map_object - get a pointer to an object's data
+ * @pool: pool the object was allocated from
+ * @handle: handle returned by zs_malloc()
+ * @mm: ZS_MM_WO if the caller writes to the object
+ *
+ * The mapping is atomic: the caller must not sleep, must not use
+ * KM_USER1 and must not call into the pool again until it calls
+ * zs_unmap_object(). Only one object per CPU can be mapped at a time.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm)
+{
+	struct zs_handle *zh = (struct zs_handle *)handle;
+	struct size_class *class = &pool->size_class[zh->class_idx];
+	struct zs_map_area *area;
+	unsigned int page_idx, offset;
+
+	read_lock(&pool->migrate_lock);
+
+	area = per_cpu_ptr(pool->map_area, smp_processor_id());
+	area->mm = mm;
+
+	obj_location(class, zh->obj_idx, &page_idx, &offset);
+	if (offset + class->size <= PAGE_SIZE) {
+		area->kaddr = kmap_atomic(zh->zspage->pages[page_idx],
+					  KM_USER1);
+		return area->kaddr + offset + ZS_HANDLE_SIZE;
+	}
+
+	/* The object straddles two pages, bounce it */
+	area->kaddr = NULL;
+	if (mm == ZS_MM_RO)
+		copy_object(class, zh->zspage, zh->obj_idx, area->buf, 1);
+	else
+		*(struct zs_handle **)area->buf = zh;
+
+	return area->buf + ZS_HANDLE_SIZE;
+}
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle)
+{
+	struct zs_handle *zh = (struct zs_handle *)handle;
+	struct size_class *class = &pool->size_class[zh->class_idx];
+	struct zs_map_area *area;
+
+	area = per_cpu_ptr(pool->map_area, smp_processor_id());
+	if (area->kaddr)
+		kunmap_atomic(area->kaddr, KM_USER1);
+	else if (area->mm == ZS_MM_WO)
+		copy_object(class, zh->zspage, zh->obj_idx, area->buf, 0);
+
+	read_unlock(&pool->migrate_lock);
+}
+
+/*
+ * Move objects out of the emptiest partial zspages of a class into its
+ * fullest ones for as long as that frees a whole zspage, at most
+ * ZS_COMPACT_BATCH zspages per call. class->lock is dropped between
+ * zspages. Returns the number of pages freed.
+ */
+static unsigned long compact_class(struct zs_pool *pool,
+				struct size_class *class)
+{
+	unsigned long freed = 0;
+	unsigned int batch;
+
+	spin_lock(&class->lock);
+	for (batch = 0; batch < ZS_COMPACT_BATCH; batch++) {
+		struct zspage *zspage, *src = NULL, *dst = NULL;
+		unsigned long free_objs = 0;
+
+		list_for_each_entry(zspage, &class->partial, list) {
+			if (!src || zspage->inuse < src->inuse)
+				src = zspage;
+			free_objs += class->objs_per_zspage - zspage->inuse;
+		}
+
+		/* Stop unless the other zspages can take all of src */
+		if (!src || free_objs - (class->objs_per_zspage - src->inuse)
+				< src->inuse)
+			break;
+
+		while (src->inuse) {
+			struct zs_handle *zh;
+			unsigned int s_idx, d_idx;
+
+			/* Keep filling dst until it is full, then pick again */
+			if (!dst || dst->inuse == class->objs_per_zspage) {
+				dst = NULL;
+				list_for_each_entry(zspage, &class->partial,
+						    list) {
+					if (zspage != src &&
+					    (!dst || zspage->inuse > dst->inuse))
+						dst = zspage;
+				}
+			}
+
+			s_idx = find_first_bit(src->used, class->objs_per_zspage);
+			d_idx = obj_alloc(class, dst);
+
+			write_lock(&pool->migrate_lock);
+			copy_object(class, src, s_idx, pool->compact_buf, 1);
+			copy_object(class, dst, d_idx, pool->compact_buf, 0);
+			zh = *(struct zs_handle **)pool->compact_buf;
+			zh->zspage = dst;
+			zh->obj_idx = d_idx;
+			write_unlock(&pool->migrate_lock);
+
+			obj_free(class, src, s_idx);
+		}
+
+		spin_unlock(&class->lock);
+		free_zspage(pool, class, src);
+		freed += class->pages_per_zspage;
+		cond_resched();
+		spin_lock(&class->lock);
+	}
+	spin_unlock(&class->lock);
+
+	return freed;
+}
+
+/*
+ * Compact all size classes of the pool. Returns the number of pages
+ * given back to the system.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned int i;
+	unsigned long freed = 0;
+
+	mutex_lock(&pool->compact_mutex);
+	for (i = 0; i < ZS_SIZE_CLASSES; i++)
+		freed += compact_class(pool, &pool->size_class[i]);
+	pool->pages_compacted += freed;
+	mutex_unlock(&pool->compact_mutex);
+
+	return freed;
+}
+
+/*
+ * Returns total memory used by allocator (userdata + metadata)
+ */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->total_pages) << PAGE_SHIFT;
+}
+
+/*
+ * Per size class usage. frag% is the part of the class's pages not
+ * holding objects: partially used zspages plus the unusable tail of
+ * each zspage.
+ */
+static int zs_stats_show(struct seq_file *m, void *unused)
+{
+	unsigned int i;
+	struct zs_pool *pool = m->private;
+
+	seq_printf(m, "%5s %5s %5s %5s %8s %8s %8s %5s\n", "class", "size",
+		"pages", "objs", "zspages", "inuse", "total", "frag%");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+		unsigned long zspages, inuse, capacity;
+
+		spin_lock(&class->lock);
+		zspages = class->zspages;
+		inuse = class->objs_inuse;
+		spin_unlock(&class->lock);
+
+		if (!zspages)
+			continue;
+
+		capacity = zspages * class->pages_per_zspage * PAGE_SIZE;
+		seq_printf(m, "%5u %5u %5u %5u %8lu %8lu %8lu %5lu\n", i,
+			class->size, class->pages_per_zspage,
+			class->objs_per_zspage, zspages, inuse,
+			zspages * class->objs_per_zspage,
+			100 - (unsigned long)div64_u64((u64)inuse * class->size
+						* 100, capacity));
+	}
+
+	seq_printf(m, "pages: %ld compacted: %lu\n",
+		atomic_long_read(&pool->total_pages), pool->pages_compacted);
+
+	return 0;
+}
+
+static int zs_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zs_stats_show, inode->i_private);
+}
+
+static const struct file_operations zs_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = zs_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/*
+ * Create a memory pool. @name identifies the pool's slab caches and
+ * its debugfs statistics file, zsmalloc-<name>.
+ */
+struct zs_pool *zs_create_pool(const char *name)
+{
+	int cpu;
+	unsigned int i;
+	char debugfs_name[32];
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->size_class[i];
+
+		spin_lock_init(&class->lock);
+		INIT_LIST_HEAD(&class->partial);
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE
+						/ class->size;
+	}
+
+	rwlock_init(&pool->migrate_lock);
+	mutex_init(&pool->compact_mutex);
+	atomic_long_set(&pool->total_pages, 0);
+
+	snprintf(pool->handle_cache_name, sizeof(pool->handle_cache_name),
+		"zs_handle-%s", name);
+	pool->handle_cachep = kmem_cache_create(pool->handle_cache_name,
+				sizeof(struct zs_handle), 0, 0, NULL);
+	snprintf(pool->zspage_cache_name, sizeof(pool->zspage_cache_name),
+		"zs_zspage-%s", name);
+	pool->zspage_cachep = kmem_cache_create(pool->zspage_cache_name,
+				sizeof(struct zspage), 0, 0, NULL);
+	pool->compact_buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+	pool->map_area = alloc_percpu(struct zs_map_area);
+	if (!pool->handle_cachep || !pool->zspage_cachep ||
+	    !pool->compact_buf || !pool->map_area)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		struct zs_map_area *area = per_cpu_ptr(pool->map_area, cpu);
+
+		area->buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto fail;
+	}
+
+	snprintf(debugfs_name, sizeof(debugfs_name), "zsmalloc-%s", name);
+	pool->debugfs_file = debugfs_create_file(debugfs_name, S_IRUGO, NULL,
+						pool, &zs_stats_fops);
+
+	return pool;
+
+fail:
+	zs_destroy_pool(pool);
+	return NULL;
+}
+
+/*
+ * All objects must have been freed.
+ */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int cpu;
+	unsigned int i;
+
+	debugfs_remove(pool->debugfs_file);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++)
+		WARN_ON(pool->size_class[i].zspages);
+
+	if (pool->map_area) {
+		for_each_possible_cpu(cpu)
+			kfree(per_cpu_ptr(pool->map_area, cpu)->buf);
+		free_percpu(pool->map_area);
+	}
+
+	kfree(pool->compact_buf);
+	if (pool->zspage_cachep)
+		kmem_cache_destroy(pool->zspage_cachep);
+	if (pool->handle_cachep)
+		kmem_cache_destroy(pool->handle_cachep);
+	kfree(pool);
+}
@@ -0,0 +1,115 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Size class allocator for compressed pages, replacing xvmalloc in zram.
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/types.h>
+
+/* User configurable params */
+
+/* Objects are grouped in size classes this many bytes apart */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+
+/* Smallest size class, must be a multiple of ZS_SIZE_CLASS_DELTA */
+#define ZS_MIN_ALLOC_SIZE	32
+
+/*
+ * A zspage is a group of up to this many (not necessarily contiguous)
+ * pages that objects of one size class are packed into, objects may
+ * straddle the boundary between two pages of a zspage.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/* Most zspages one zs_compact() call empties per size class */
+#define ZS_COMPACT_BATCH	32
+
+/* End of user params */
+
+#define ZS_SIZE_CLASSES		((PAGE_SIZE - ZS_MIN_ALLOC_SIZE) / \
+					ZS_SIZE_CLASS_DELTA + 1)
+#define ZS_MAX_OBJS_PER_ZSPAGE	(ZS_MAX_PAGES_PER_ZSPAGE * PAGE_SIZE / \
+					ZS_MIN_ALLOC_SIZE)
+
+/*
+ * Every object starts with a back-reference to its handle so that
+ * compaction can find and update the handle when it moves the object.
+ * Object sizes are multiples of ZS_SIZE_CLASS_DELTA, so this header
+ * never straddles a page boundary.
+ */
+#define ZS_HANDLE_SIZE		sizeof(unsigned long)
+
+/*
+ * What a handle returned by zs_malloc() points to. class_idx never
+ * changes; zspage and obj_idx change only under both the class lock
+ * and pool->migrate_lock held for writing.
+ */
+struct zs_handle {
+	struct zspage *zspage;
+	u16 obj_idx;
+	u16 class_idx;
+};
+
+struct zspage {
+	struct list_head list;		/* entry in class->partial */
+	unsigned int inuse;		/* no. of allocated objects */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	unsigned long used[BITS_TO_LONGS(ZS_MAX_OBJS_PER_ZSPAGE)];
+};
+
+struct size_class {
+	spinlock_t lock;
+	struct list_head partial;	/* zspages with free objects */
+	unsigned int size;		/* object size, incl. header */
+	unsigned int pages_per_zspage;
+	unsigned int objs_per_zspage;
+
+	/* stats */
+	unsigned long zspages;
+	unsigned long objs_inuse;
+};
+
+/* Per-CPU state for an object mapped with zs_map_object() */
+struct zs_map_area {
+	char *buf;			/* bounce buffer for split objects */
+	void *kaddr;			/* kmap_atomic() of unsplit object */
+	enum zs_mapmode mm;
+};
+
+struct zs_pool {
+	struct size_class size_class[ZS_SIZE_CLASSES];
+
+	/*
+	 * Held for reading while an object is mapped and for writing
+	 * while compaction moves an object.
+	 */
+	rwlock_t migrate_lock;
+	struct mutex compact_mutex;	/* one compaction at a time */
+	char *compact_buf;		/* object copy, under compact_mutex */
+
+	struct kmem_cache *handle_cachep;
+	struct kmem_cache *zspage_cachep;
+	struct zs_map_area __percpu *map_area;
+	struct dentry *debugfs_file;
+	char handle_cache_name[32];
+	char zspage_cache_name[32];
+
+	/* stats */
+	atomic_long_t total_pages;
+	unsigned long pages_compacted;
+};
+
+#endif
@@ -444,14 +444,104 @@ static unsigned yaffs_gc_control_callback(yaffs_Device *dev)
 static void yaffs_GrossLock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locking %p\n"), current));
-	down(&(yaffs_DeviceToContext(dev)->grossLock));
+	down_write(&(yaffs_DeviceToContext(dev)->grossLock));
 	T(YAFFS_TRACE_LOCK, (TSTR("yaffs locked %p\n"), current));
 }
 
 static void yaffs_GrossUnlock(yaffs_Device *dev)
 {
 	T(YAFFS_TRACE_LOCK, (TSTR("yaffs unlocking %p\n"), current));
-	up(&(yaffs_DeviceToContext(dev)->grossLock));
+	up_write(&(yaffs_DeviceToContext(dev)->grossLock));
+}
+
+/* Only for operations that leave the file system unchanged */
+static void yaffs_GrossReadLock(yaffs_Device *dev)
+{
+	T(YAFFS_TRACE_LOCK, (TSTR("yaffs read locking %p\n"), current));
+	down_read(&(yaffs_DeviceToContext(dev)->grossLock));
+	T(YAFFS_TRACE_LOCK, (TSTR("yaffs read locked %p\n"), current));
+}
+
+static void yaffs_GrossReadUnlock(yaffs_Device *dev)
+{
+	T(YAFFS_TRACE_LOCK, (TSTR("yaffs read unlocking %p\n"), current));
+	up_read(&(yaffs_DeviceToContext(dev)->grossLock));
+}
+
+/* From yaffs_GrossLock() to yaffs_GrossReadLock(), letting readers in */
+static void yaffs_GrossDowngrade(yaffs_Device *dev)
+{
+	T(YAFFS_TRACE_LOCK, (TSTR("yaffs downgrading %p\n"), current));
+	downgrade_write(&(yaffs_DeviceToContext(dev)->grossLock));
+}
+
+static void yaffs_LockCallback(yaffs_Device *dev, yaffs_LockType which)
+{
+	struct yaffs_LinuxContext *context = yaffs_DeviceToContext(dev);
+
+	switch (which) {
+	case YAFFS_LOCK_INDEX:
+		mutex_lock(&context->indexLock);
+		break;
+	case YAFFS_LOCK_OBJECT:
+		mutex_lock(&context->objectLock);
+		break;
+	case YAFFS_LOCK_CACHE:
+		mutex_lock(&context->cacheLock);
+		break;
+	case YAFFS_LOCK_MAP:
+		down_write(&context->mapLock);
+		break;
+	case YAFFS_LOCK_NAND:
+		mutex_lock(&context->nandLock);
+		break;
+	case YAFFS_LOCK_BUFFERS:
+		spin_lock(&context->bufferLock);
+		break;
+	}
+}
+
+static void yaffs_UnlockCallback(yaffs_Device *dev, yaffs_LockType which)
+{
+	struct yaffs_LinuxContext *context = yaffs_DeviceToContext(dev);
+
+	switch (which) {
+	case YAFFS_LOCK_INDEX:
+		mutex_unlock(&context->indexLock);
+		break;
+	case YAFFS_LOCK_OBJECT:
+		mutex_unlock(&context->objectLock);
+		break;
+	case YAFFS_LOCK_CACHE:
+		mutex_unlock(&context->cacheLock);
+		break;
+	case YAFFS_LOCK_MAP:
+		up_write(&context->mapLock);
+		break;
+	case YAFFS_LOCK_NAND:
+		mutex_unlock(&context->nandLock);
+		break;
+	case YAFFS_LOCK_BUFFERS:
+		spin_unlock(&context->bufferLock);
+		break;
+	}
+}
+
+static void yaffs_LockSharedCallback(yaffs_Device *dev, yaffs_LockType which)
+{
+	if (which == YAFFS_LOCK_MAP)
+		down_read(&yaffs_DeviceToContext(dev)->mapLock);
+	else
+		yaffs_LockCallback(dev, which);
+}
+
+static void yaffs_UnlockSharedCallback(yaffs_Device *dev,
+					yaffs_LockType which)
+{
+	if (which == YAFFS_LOCK_MAP)
+		up_read(&yaffs_DeviceToContext(dev)->mapLock);
+	else
+		yaffs_UnlockCallback(dev, which);
 }
 
 #ifdef YAFFS_COMPILE_EXPORTFS
@@ -643,11 +733,11 @@ static int yaffs_readlink(struct dentry *dentry, char __user *buffer,
 
 	yaffs_Device *dev = yaffs_DentryToObject(dentry)->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossReadLock(dev);
 
 	alias = yaffs_GetSymlinkAlias(yaffs_DentryToObject(dentry));
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossReadUnlock(dev);
 
 	if (!alias)
 		return -ENOMEM;
@@ -667,11 +757,11 @@ static int yaffs_follow_link(struct dentry *dentry, struct nameidata *nd)
 	int ret;
 	yaffs_Device *dev = yaffs_DentryToObject(dentry)->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossReadLock(dev);
 
 	alias = yaffs_GetSymlinkAlias(yaffs_DentryToObject(dentry));
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossReadUnlock(dev);
 
 	if (!alias) {
 		ret = -ENOMEM;
@@ -708,7 +798,7 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 	yaffs_Device *dev = yaffs_InodeToObject(dir)->myDev;
 
 	if(current != yaffs_DeviceToContext(dev)->readdirProcess)
-		yaffs_GrossLock(dev);
+		yaffs_GrossReadLock(dev);
 
 	T(YAFFS_TRACE_OS,
 		(TSTR("yaffs_lookup for %d:%s\n"),
@@ -721,7 +811,7 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 
 	/* Can't hold gross lock when calling yaffs_get_inode() */
 	if(current != yaffs_DeviceToContext(dev)->readdirProcess)
-		yaffs_GrossUnlock(dev);
+		yaffs_GrossReadUnlock(dev);
 
 	if (obj) {
 		T(YAFFS_TRACE_OS,
@@ -932,13 +1022,13 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 	pg_buf = kmap(pg);
 	/* FIXME: Can kmap fail? */
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossReadLock(dev);
 
 	ret = yaffs_ReadDataFromFile(obj, pg_buf,
 				pg->index << PAGE_CACHE_SHIFT,
 				PAGE_CACHE_SIZE);
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossReadUnlock(dev);
 
 	if (ret >= 0)
 		ret = 0;
@@ -2030,11 +2120,21 @@ static void yaffs_FlushSuperBlock(struct super_block *sb, int do_checkpoint)
 }
 
 
-static unsigned yaffs_bg_gc_urgency(yaffs_Device *dev)
+/*
+ * Background gc urgency, from how much room writers have left before they
+ * have to collect for themselves. When nobody has written for a while the
+ * background thread also collects ahead of time while there is something
+ * worth collecting, so that the next burst of writes finds erased blocks.
+ */
+#define YAFFS_BG_GC_HEADROOM	4	/* erased blocks above the reserve */
+#define YAFFS_BG_IDLE_TIME	(HZ * 2)
+
+static unsigned yaffs_bg_gc_urgency(yaffs_Device *dev, int idle)
 {
 	unsigned erasedChunks = dev->nErasedBlocks * dev->param.nChunksPerBlock;
 	struct yaffs_LinuxContext *context = yaffs_DeviceToContext(dev);
 	unsigned scatteredFree = 0; /* Free chunks not in an erased block */
+	int headroom = dev->nErasedBlocks - dev->param.nReservedBlocks;
 
 	if(erasedChunks < dev->nFreeChunks)
 		scatteredFree = (dev->nFreeChunks - erasedChunks);
@@ -2043,8 +2143,10 @@ static unsigned yaffs_bg_gc_urgency(yaffs_Device *dev)
 		return 0;
 	else if(scatteredFree < (dev->param.nChunksPerBlock * 2))
 		return 0;
+	else if(headroom < YAFFS_BG_GC_HEADROOM)
+		return 2;
 	else if(erasedChunks > dev->nFreeChunks/2)
-		return 0;
+		return idle ? 1 : 0;
 	else if(erasedChunks > dev->nFreeChunks/4)
 		return 1;
 	else
@@ -2057,7 +2159,7 @@ static int yaffs_do_sync_fs(struct super_block *sb,
 
 	yaffs_Device *dev = yaffs_SuperToDevice(sb);
 	unsigned int oneshot_checkpoint = (yaffs_auto_checkpoint & 4);
-	unsigned gc_urgent = yaffs_bg_gc_urgency(dev);
+	unsigned gc_urgent = yaffs_bg_gc_urgency(dev, 0);
 	int do_checkpoint;
 
 	T(YAFFS_TRACE_OS | YAFFS_TRACE_SYNC | YAFFS_TRACE_BACKGROUND,
@@ -2110,6 +2212,8 @@ static int yaffs_BackgroundThread(void *data)
 	unsigned long next_dir_update = now;
 	unsigned long next_gc = now;
 	unsigned long expires;
+	unsigned long last_write = now;
+	__u32 host_writes = dev->nHostWrites;
 	unsigned int urgency;
 
 	int gcResult;
@@ -2135,28 +2239,49 @@ static int yaffs_BackgroundThread(void *data)
 
 		now = jiffies;
 
+		/* Objects the last gc pass finished with */
+		yaffs_FinishGarbageCollection(dev);
+
 		if(time_after(now, next_dir_update)){
 			yaffs_UpdateDirtyDirectories(dev);
 			next_dir_update = now + HZ;
 		}
 
-		if(time_after(now,next_gc)){
-			if(!dev->isCheckpointed){
-				urgency = yaffs_bg_gc_urgency(dev);
-				gcResult = yaffs_BackgroundGarbageCollect(dev, urgency);
-				if(urgency > 1)
-					next_gc = now + HZ/20+1;
-				else if(urgency > 0)
-					next_gc = now + HZ/10+1;
-				else
-					next_gc = now + HZ * 2;
-			} else /*
-				* gc not running so set to next_dir_update
-				* to cut down on wake ups
-				*/
+		if(time_after(now,next_gc) && !dev->isCheckpointed){
+			if(dev->nHostWrites != host_writes){
+				host_writes = dev->nHostWrites;
+				last_write = now;
+			}
+			urgency = yaffs_bg_gc_urgency(dev,
+				time_after(now,
+					last_write + YAFFS_BG_IDLE_TIME));
+
+			/*
+			 * Writers wait for gc, but readers carry on: they
+			 * only need gc to keep still the chunks they are
+			 * reading, see YAFFS_LOCK_MAP.
+			 */
+			yaffs_GrossDowngrade(dev);
+			mutex_lock(&context->gcLock);
+			gcResult = yaffs_BackgroundGarbageCollect(dev, urgency);
+			mutex_unlock(&context->gcLock);
+			yaffs_GrossReadUnlock(dev);
+
+			if(urgency > 1)
+				next_gc = now + HZ/20+1;
+			else if(urgency > 0)
+				next_gc = now + HZ/10+1;
+			else
+				next_gc = now + HZ * 2;
+		} else {
+			if(time_after(now,next_gc))
+				/*
+				 * gc not running so set to next_dir_update
+				 * to cut down on wake ups
+				 */
 				next_gc = next_dir_update;
+			yaffs_GrossUnlock(dev);
 		}
-		yaffs_GrossUnlock(dev);
 #if 1
 		expires = next_dir_update;
 		if (time_before(next_gc,expires))
@@ -2286,13 +2411,13 @@ static struct inode *yaffs_iget(struct super_block *sb, unsigned long ino)
 	 * need to lock again.
 	 */
 
-	yaffs_GrossLock(dev);
+	yaffs_GrossReadLock(dev);
 
 	obj = yaffs_FindObjectByNumber(dev, inode->i_ino);
 
 	yaffs_FillInodeFromObject(inode, obj);
 
-	yaffs_GrossUnlock(dev);
+	yaffs_GrossReadUnlock(dev);
 
 	unlock_new_inode(inode);
 	return inode;
@@ -2414,17 +2539,43 @@ static void yaffs_MarkSuperBlockDirty(yaffs_Device *dev)
 		sb->s_dirt = 1;
 }
 
+/*
+ * Short op cache sizing. Unless the cache=N mount option says otherwise,
+ * give the cache about 1/1024 of memory, but no less than it always had.
+ */
+#define YAFFS_MIN_DEFAULT_CACHES	10
+
+static int yaffs_DefaultCacheSize(int bytesPerChunk)
+{
+	unsigned long nCaches;
+
+	nCaches = (totalram_pages / 1024) * PAGE_SIZE / bytesPerChunk;
+	if (nCaches < YAFFS_MIN_DEFAULT_CACHES)
+		nCaches = YAFFS_MIN_DEFAULT_CACHES;
+	if (nCaches > YAFFS_MAX_SHORT_OP_CACHES)
+		nCaches = YAFFS_MAX_SHORT_OP_CACHES;
+
+	return nCaches;
+}
+
 typedef struct {
 	int inband_tags;
 	int skip_checkpoint_read;
 	int skip_checkpoint_write;
 	int no_cache;
+	int cache_size;
+	int cache_size_overridden;
 	int tags_ecc_on;
 	int tags_ecc_overridden;
 	int lazy_loading_enabled;
 	int lazy_loading_overridden;
 	int empty_lost_and_found;
 	int empty_lost_and_found_overridden;
+	int block_summary;
+	int block_summary_overridden;
+	int gc_greedy;
+	int cold_stream;
+	int cold_stream_overridden;
 } yaffs_options;
 
 #define MAX_OPT_LEN 30
@@ -2471,9 +2622,27 @@ static int yaffs_parse_options(yaffs_options *options, const char *options_str)
 		} else if (!strcmp(cur_opt, "empty-lost-and-found-on")){
 			options->empty_lost_and_found = 1;
 			options->empty_lost_and_found_overridden=1;
+		} else if (!strcmp(cur_opt, "block-summary-off")){
+			options->block_summary = 0;
+			options->block_summary_overridden = 1;
+		} else if (!strcmp(cur_opt, "block-summary-on")){
+			options->block_summary = 1;
+			options->block_summary_overridden = 1;
+		} else if (!strcmp(cur_opt, "gc-greedy"))
+			options->gc_greedy = 1;
+		else if (!strcmp(cur_opt, "gc-cold-stream-off")){
+			options->cold_stream = 0;
+			options->cold_stream_overridden = 1;
+		} else if (!strcmp(cur_opt, "gc-cold-stream-on")){
+			options->cold_stream = 1;
+			options->cold_stream_overridden = 1;
 		} else if (!strcmp(cur_opt, "no-cache"))
 			options->no_cache = 1;
-		else if (!strcmp(cur_opt, "no-checkpoint-read"))
+		else if (!strncmp(cur_opt, "cache=", 6)) {
+			options->cache_size =
+				simple_strtoul(cur_opt + 6, NULL, 0);
+			options->cache_size_overridden = 1;
+		} else if (!strcmp(cur_opt, "no-checkpoint-read"))
 			options->skip_checkpoint_read = 1;
 		else if (!strcmp(cur_opt, "no-checkpoint-write"))
 			options->skip_checkpoint_write = 1;
@@ -2712,7 +2881,6 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	param->nChunksPerBlock = YAFFS_CHUNKS_PER_BLOCK;
 	param->totalBytesPerChunk = YAFFS_BYTES_PER_CHUNK;
 	param->nReservedBlocks = 5;
-	param->nShortOpCaches = (options.no_cache) ? 0 : 10;
 	param->inbandTags = options.inband_tags;
 
 #ifdef CONFIG_YAFFS_DISABLE_LAZY_LOAD
@@ -2746,6 +2914,16 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	if(options.empty_lost_and_found_overridden)
 		param->emptyLostAndFound = options.empty_lost_and_found;
 
+#ifndef CONFIG_YAFFS_BLOCK_SUMMARY
+	param->disableSummary = 1;
+#endif
+	if(options.block_summary_overridden)
+		param->disableSummary = !options.block_summary;
+
+	param->gcGreedy = options.gc_greedy;
+	if(options.cold_stream_overridden)
+		param->disableColdStream = !options.cold_stream;
+
 	/* ... and the functions. */
 	if (yaffsVersion == 2) {
 		param->writeChunkWithTagsToNAND =
@@ -2782,6 +2960,15 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 #endif
 		param->isYaffs2 = 0;
 	}
+	/* The cache size depends on the chunk size, so set it up now */
+	if (options.no_cache)
+		param->nShortOpCaches = 0;
+	else if (options.cache_size_overridden)
+		param->nShortOpCaches = options.cache_size;
+	else
+		param->nShortOpCaches =
+			yaffs_DefaultCacheSize(param->totalBytesPerChunk);
+
 	/* ... and common functions */
 	param->eraseBlockInNAND = nandmtd_EraseBlockInNAND;
 	param->initialiseNAND = nandmtd_InitialiseNAND;
@@ -2814,7 +3001,18 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
         YINIT_LIST_HEAD(&(yaffs_DeviceToContext(dev)->searchContexts));
         param->removeObjectCallback = yaffs_RemoveObjectCallback;
 
-	init_MUTEX(&(yaffs_DeviceToContext(dev)->grossLock));
+	init_rwsem(&(yaffs_DeviceToContext(dev)->grossLock));
+	mutex_init(&(yaffs_DeviceToContext(dev)->indexLock));
+	mutex_init(&(yaffs_DeviceToContext(dev)->objectLock));
+	mutex_init(&(yaffs_DeviceToContext(dev)->cacheLock));
+	init_rwsem(&(yaffs_DeviceToContext(dev)->mapLock));
+	mutex_init(&(yaffs_DeviceToContext(dev)->nandLock));
+	spin_lock_init(&(yaffs_DeviceToContext(dev)->bufferLock));
+	mutex_init(&(yaffs_DeviceToContext(dev)->gcLock));
+	param->lock = yaffs_LockCallback;
+	param->unlock = yaffs_UnlockCallback;
+	param->lockShared = yaffs_LockSharedCallback;
+	param->unlockShared = yaffs_UnlockSharedCallback;
 
 	yaffs_GrossLock(dev);
 
@@ -2984,6 +3182,21 @@ static char *yaffs_dump_dev_part0(char *buf, yaffs_Device * dev)
 }
 
 
+/* NAND page writes per chunk written for the host, times 100 */
+static unsigned yaffs_write_amplification(yaffs_Device *dev)
+{
+	__u32 writes = dev->nPageWrites;
+	__u32 host = dev->nHostWrites;
+
+	if (!host)
+		return 0;
+	if (writes < 0xFFFFFFFF / 100)
+		return writes * 100 / host;
+	if (host < 100)
+		return 0xFFFFFFFF;
+	return writes / (host / 100);
+}
+
 static char *yaffs_dump_dev_part1(char *buf, yaffs_Device * dev)
 {
 	buf += sprintf(buf, "nDataBytesPerChunk. %d\n", dev->nDataBytesPerChunk);
@@ -3002,6 +3215,10 @@ static char *yaffs_dump_dev_part1(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "nPageReads......... %u\n", dev->nPageReads);
 	buf += sprintf(buf, "nBlockErasures..... %u\n", dev->nBlockErasures);
 	buf += sprintf(buf, "nGCCopies.......... %u\n", dev->nGCCopies);
+	buf += sprintf(buf, "nHostWrites........ %u\n", dev->nHostWrites);
+	buf += sprintf(buf, "writeAmp(x100)..... %u\n",
+		yaffs_write_amplification(dev));
+	buf += sprintf(buf, "nColdBlocks........ %u\n", dev->nColdBlocks);
 	buf += sprintf(buf, "allGCs............. %u\n", dev->allGCs);
 	buf += sprintf(buf, "passiveGCs......... %u\n", dev->passiveGCs);
 	buf += sprintf(buf, "oldestDirtyGCs..... %u\n", dev->oldestDirtyGCs);
@@ -3013,9 +3230,14 @@ static char *yaffs_dump_dev_part1(char *buf, yaffs_Device * dev)
 	buf += sprintf(buf, "tagsEccFixed....... %u\n", dev->tagsEccFixed);
 	buf += sprintf(buf, "tagsEccUnfixed..... %u\n", dev->tagsEccUnfixed);
 	buf += sprintf(buf, "cacheHits.......... %u\n", dev->cacheHits);
+	buf += sprintf(buf, "cacheMisses........ %u\n", dev->cacheMisses);
+	buf += sprintf(buf, "nDirIndexes........ %u\n", dev->nDirIndexes);
+	buf += sprintf(buf, "dirIndexBytes...... %u\n", dev->dirIndexBytes);
 	buf += sprintf(buf, "nDeletedFiles...... %u\n", dev->nDeletedFiles);
 	buf += sprintf(buf, "nUnlinkedFiles..... %u\n", dev->nUnlinkedFiles);
 	buf += sprintf(buf, "refreshCount....... %u\n", dev->refreshCount);
+	buf += sprintf(buf, "summaryWrites...... %u\n", dev->summaryWrites);
+	buf += sprintf(buf, "summaryScans....... %u\n", dev->summaryScans);
 	buf +=
 	    sprintf(buf, "nBackgroudDeletions %u\n", dev->nBackgroundDeletions);
 
@@ -33,6 +33,7 @@
 /* Note YAFFS_GC_GOOD_ENOUGH must be <= YAFFS_GC_PASSIVE_THRESHOLD */
 #define YAFFS_GC_GOOD_ENOUGH 2
 #define YAFFS_GC_PASSIVE_THRESHOLD 4
+#define YAFFS_GC_MAX_AGE 0xFFFFF
 
 #define YAFFS_SMALL_HOLE_THRESHOLD 3
 
@@ -122,6 +123,11 @@ static yaffs_Tnode *yaffs_FindLevel0Tnode(yaffs_Device *dev,
 
 static int yaffs_HandleHole(yaffs_Object *obj, loff_t newSize);
 static void yaffs_SkipRestOfBlock(yaffs_Device *dev);
+static void yaffs_SkipRestOfAltBlock(yaffs_Device *dev);
+static void yaffs_SwapAllocationStreams(yaffs_Device *dev);
+static int yaffs_ColdBlockAffordable(yaffs_Device *dev);
+static void yaffs_SummaryAdd(yaffs_Device *dev, const yaffs_ExtendedTags *tags,
+				int chunk);
 static int yaffs_VerifyChunkWritten(yaffs_Device *dev,
 					int chunkInNAND,
 					const __u8 *data,
@@ -227,6 +233,8 @@ __u8 *yaffs_GetTempBuffer(yaffs_Device *dev, int lineNo)
 {
 	int i, j;
 
+	yaffs_Lock(dev, YAFFS_LOCK_BUFFERS);
+
 	dev->tempInUse++;
 	if (dev->tempInUse > dev->maxTemp)
 		dev->maxTemp = dev->tempInUse;
@@ -241,6 +249,7 @@ __u8 *yaffs_GetTempBuffer(yaffs_Device *dev, int lineNo)
 					    dev->tempBuffer[j].line;
 			}
 
+			yaffs_Unlock(dev, YAFFS_LOCK_BUFFERS);
 			return dev->tempBuffer[i].buffer;
 		}
 	}
@@ -259,6 +268,7 @@ __u8 *yaffs_GetTempBuffer(yaffs_Device *dev, int lineNo)
 	 */
 
 	dev->unmanagedTempAllocations++;
+	yaffs_Unlock(dev, YAFFS_LOCK_BUFFERS);
 	return YMALLOC(dev->nDataBytesPerChunk);
 
 }
@@ -268,22 +278,29 @@ void yaffs_ReleaseTempBuffer(yaffs_Device *dev, __u8 *buffer,
 {
 	int i;
 
+	yaffs_Lock(dev, YAFFS_LOCK_BUFFERS);
+
 	dev->tempInUse--;
 
 	for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++) {
 		if (dev->tempBuffer[i].buffer == buffer) {
 			dev->tempBuffer[i].line = 0;
+			yaffs_Unlock(dev, YAFFS_LOCK_BUFFERS);
 			return;
 		}
 	}
 
+	if (buffer)
+		dev->unmanagedTempDeallocations++;
+
+	yaffs_Unlock(dev, YAFFS_LOCK_BUFFERS);
+
 	if (buffer) {
 		/* assume it is an unmanaged one. */
 		T(YAFFS_TRACE_BUFFERS,
 		  (TSTR("Releasing unmanaged temp buffer in line %d" TENDSTR),
 		   lineNo));
 		YFREE(buffer);
-		dev->unmanagedTempDeallocations++;
 	}
 
 }
@@ -527,7 +544,8 @@ static void yaffs_VerifyBlocks(yaffs_Device *dev)
 	T(YAFFS_TRACE_VERIFY, (TSTR("Block summary"TENDSTR)));
 
 	T(YAFFS_TRACE_VERIFY, (TSTR("%d blocks have illegal states"TENDSTR), nIllegalBlockStates));
-	if (nBlocksPerState[YAFFS_BLOCK_STATE_ALLOCATING] > 1)
+	if (nBlocksPerState[YAFFS_BLOCK_STATE_ALLOCATING] >
+			(dev->coldAllocationBlock > 0 ? 2 : 1))
 		T(YAFFS_TRACE_VERIFY, (TSTR("Too many allocating blocks"TENDSTR)));
 
 	for (i = 0; i < YAFFS_NUMBER_OF_BLOCK_STATES; i++)
@@ -1039,11 +1057,15 @@ static int yaffs_WriteNewChunkWithTagsToNAND(struct yaffs_DeviceStruct *dev,
 		/* Copy the data into the robustification buffer */
 		yaffs_HandleWriteChunkOk(dev, chunk, data, tags);
 
+		yaffs_SummaryAdd(dev, tags, chunk);
+
 	} while (writeOk != YAFFS_OK &&
 		(yaffs_wr_attempts <= 0 || attempts <= yaffs_wr_attempts));
 
 	if (!writeOk)
 		chunk = -1;
+	else if (!dev->gcCopying)
+		dev->nHostWrites++;
 
 	if (attempts > 1) {
 		T(YAFFS_TRACE_ERROR,
@@ -1260,8 +1282,196 @@ static __u16 yaffs_CalcNameSum(const YCHAR *name)
 	return sum;
 }
 
+/*---------------- Directory index functions ------------
+ *
+ * Large directories get a hash index of their children keyed on the
+ * name sum so that lookups don't walk the whole child list. The index
+ * is built lazily by the first lookup, which may run under a shared
+ * lock, so building is serialised on YAFFS_LOCK_INDEX and the index is
+ * only published once complete. All changes to a published index are
+ * made by exclusive operations.
+ *
+ * Every child of an indexed directory has its details loaded, so lazy
+ * loading never changes the sum of an indexed object under a reader.
+ */
+
+#define YAFFS_DIR_INDEX_MIN_CHILDREN	32
+#define YAFFS_DIR_INDEX_MIN_BUCKETS	16
+
+static yaffs_DirIndex *yaffs_DirIndexOf(yaffs_Object *dir)
+{
+	if (dir && dir->variantType == YAFFS_OBJECT_TYPE_DIRECTORY)
+		return dir->variant.directoryVariant.index;
+	return NULL;
+}
+
+static __u32 yaffs_DirIndexBucket(const yaffs_DirIndex *index, __u16 sum)
+{
+	/* The sum is a weighted byte sum; spread it over the table. */
+	return (((__u32)sum * 0x9E3779B1U) >> 16) & (index->nBuckets - 1);
+}
+
+static void yaffs_DirIndexLink(yaffs_DirIndex *index, yaffs_Object *obj)
+{
+	__u32 bucket = yaffs_DirIndexBucket(index, obj->sum);
+
+	obj->indexNext = index->buckets[bucket];
+	index->buckets[bucket] = obj;
+	index->nEntries++;
+}
+
+static void yaffs_DirIndexUnlink(yaffs_DirIndex *index, yaffs_Object *obj)
+{
+	yaffs_Object **p;
+
+	p = &index->buckets[yaffs_DirIndexBucket(index, obj->sum)];
+	while (*p && *p != obj)
+		p = &(*p)->indexNext;
+
+	if (*p) {
+		*p = obj->indexNext;
+		index->nEntries--;
+	}
+	obj->indexNext = NULL;
+}
+
+static void yaffs_DirIndexResize(yaffs_Device *dev, yaffs_DirIndex *index,
+				__u32 nBuckets)
+{
+	yaffs_Object **oldBuckets = index->buckets;
+	__u32 oldNBuckets = index->nBuckets;
+	yaffs_Object *obj;
+	__u32 i;
+
+	index->buckets = YMALLOC(nBuckets * sizeof(yaffs_Object *));
+	if (!index->buckets) {
+		/* Keep going with longer chains */
+		index->buckets = oldBuckets;
+		return;
+	}
+	memset(index->buckets, 0, nBuckets * sizeof(yaffs_Object *));
+	index->nBuckets = nBuckets;
+	index->nEntries = 0;
+
+	for (i = 0; i < oldNBuckets; i++) {
+		while (oldBuckets[i]) {
+			obj = oldBuckets[i];
+			oldBuckets[i] = obj->indexNext;
+			yaffs_DirIndexLink(index, obj);
+		}
+	}
+	YFREE(oldBuckets);
+
+	dev->dirIndexBytes += (nBuckets - oldNBuckets) * sizeof(yaffs_Object *);
+}
+
+static yaffs_DirIndex *yaffs_BuildDirIndex(yaffs_Object *directory)
+{
+	yaffs_Device *dev = directory->myDev;
+	yaffs_DirIndex *index;
+	yaffs_Object **buckets;
+	struct ylist_head *i;
+	__u32 nChildren = 0;
+	__u32 nBuckets = YAFFS_DIR_INDEX_MIN_BUCKETS;
+
+	/* Small directories are quicker to just walk */
+	ylist_for_each(i, &directory->variant.directoryVariant.children) {
+		if (++nChildren >= YAFFS_DIR_INDEX_MIN_CHILDREN)
+			break;
+	}
+	if (nChildren < YAFFS_DIR_INDEX_MIN_CHILDREN)
+		return NULL;
+
+	yaffs_Lock(dev, YAFFS_LOCK_INDEX);
+
+	/* Another reader may have beaten us to it. */
+	index = directory->variant.directoryVariant.index;
+	if (index)
+		goto out;
+
+	nChildren = 0;
+	ylist_for_each(i, &directory->variant.directoryVariant.children)
+		nChildren++;
+	while (nBuckets < nChildren)
+		nBuckets <<= 1;
+
+	index = YMALLOC(sizeof(yaffs_DirIndex));
+	buckets = YMALLOC(nBuckets * sizeof(yaffs_Object *));
+	if (!index || !buckets) {
+		if (index)
+			YFREE(index);
+		if (buckets)
+			YFREE(buckets);
+		index = NULL;
+		goto out;
+	}
+	memset(buckets, 0, nBuckets * sizeof(yaffs_Object *));
+	index->nBuckets = nBuckets;
+	index->nEntries = 0;
+	index->buckets = buckets;
+
+	ylist_for_each(i, &directory->variant.directoryVariant.children) {
+		yaffs_Object *l = ylist_entry(i, yaffs_Object, siblings);
+
+		yaffs_CheckObjectDetailsLoaded(l);
+		yaffs_DirIndexLink(index, l);
+	}
+
+	dev->nDirIndexes++;
+	dev->dirIndexBytes += sizeof(yaffs_DirIndex) +
+				nBuckets * sizeof(yaffs_Object *);
+
+	/* Lockless readers must never see a partly built index */
+	Y_WRITE_BARRIER();
+	directory->variant.directoryVariant.index = index;
+out:
+	yaffs_Unlock(dev, YAFFS_LOCK_INDEX);
+	return index;
+}
+
+static void yaffs_FreeDirIndex(yaffs_Object *directory)
+{
+	yaffs_Device *dev = directory->myDev;
+	yaffs_DirIndex *index = yaffs_DirIndexOf(directory);
+
+	if (!index)
+		return;
+
+	dev->nDirIndexes--;
+	dev->dirIndexBytes -= sizeof(yaffs_DirIndex) +
+				index->nBuckets * sizeof(yaffs_Object *);
+	YFREE(index->buckets);
+	YFREE(index);
+	directory->variant.directoryVariant.index = NULL;
+}
+
+/* Names that yaffs_GetObjectName makes up for objects with no header */
+static int yaffs_IsMadeUpName(const YCHAR *name)
+{
+	int prefixLength = sizeof(YAFFS_LOSTNFOUND_PREFIX) - 1;
+
+	if (yaffs_strncmp(name, _Y(YAFFS_LOSTNFOUND_PREFIX), prefixLength) != 0)
+		return 0;
+
+	name += prefixLength;
+	if (!*name)
+		return 0;
+	while (*name) {
+		if (*name < _Y('0') || *name > _Y('9'))
+			return 0;
+		name++;
+	}
+	return 1;
+}
+
 static void yaffs_SetObjectName(yaffs_Object *obj, const YCHAR *name)
 {
+	yaffs_DirIndex *index = yaffs_DirIndexOf(obj->parent);
+
+	/* The sum is the index key, so move the object to its new bucket */
+	if (index)
+		yaffs_DirIndexUnlink(index, obj);
+
 #ifdef CONFIG_YAFFS_SHORT_NAMES_IN_RAM
 	memset(obj->shortName, 0, sizeof(YCHAR) * (YAFFS_SHORT_NAME_LENGTH+1));
 	if (name && yaffs_strnlen(name,YAFFS_SHORT_NAME_LENGTH+1) <= YAFFS_SHORT_NAME_LENGTH)
@@ -1270,6 +1480,9 @@ static void yaffs_SetObjectName(yaffs_Object *obj, const YCHAR *name)
 		obj->shortName[0] = _Y('\0');
 #endif
 	obj->sum = yaffs_CalcNameSum(name);
+
+	if (index)
+		yaffs_DirIndexLink(index, obj);
 }
 
 /*-------------------- TNODES -------------------
@@ -2179,6 +2392,7 @@ static void yaffs_FreeObject(yaffs_Object *tn)
 		return;
 	}
 
+	yaffs_FreeDirIndex(tn);
 	yaffs_UnhashObject(tn);
 
 #ifdef CONFIG_YAFFS_VALGRIND_TEST
@@ -2379,6 +2593,7 @@ yaffs_Object *yaffs_CreateNewObject(yaffs_Device *dev, int number,
 					children);
 			YINIT_LIST_HEAD(&theObject->variant.directoryVariant.
 					dirty);
+			theObject->variant.directoryVariant.index = NULL;
 			break;
 		case YAFFS_OBJECT_TYPE_SYMLINK:
 		case YAFFS_OBJECT_TYPE_HARDLINK:
@@ -2712,6 +2927,7 @@ static int yaffs_InitialiseBlocks(yaffs_Device *dev)
 	dev->chunkBits = NULL;
 
 	dev->allocationBlock = -1;	/* force it to get a new one */
+	dev->coldAllocationBlock = -1;
 
 	/* If the first allocation strategy fails, thry the alternate one */
 	dev->blockInfo = YMALLOC(nBlocks * sizeof(yaffs_BlockInfo));
@@ -2865,6 +3081,7 @@ static void yaffs_BlockBecameDirty(yaffs_Device *dev, int blockNo)
 	if(blockNo == dev->gcDirtiest){
 		dev->gcDirtiest = 0;
 		dev->gcPagesInUse = 0;
+		dev->gcDirtiestScore = 0;
 	}
 
 	if (!bi->needsRetiring) {
@@ -3024,16 +3241,185 @@ static int yaffs_CheckSpaceForAllocation(yaffs_Device *dev, int nChunks)
 	return (dev->nFreeChunks > (reservedChunks + nChunks));
 }
 
+/*------------------------ Block summaries ----------------------------------
+ * The tags of each chunk written to the allocation block are collected in
+ * dev->summaryTags. Once all but the last chunk of the block are written,
+ * the summary goes into the last chunk. The summary chunk is deleted as soon
+ * as it is written so it never holds up garbage collection; a scan still
+ * finds it because yaffs2 doesn't mark deletions on NAND.
+ *
+ * A block that was already part written when we mounted doesn't get a
+ * summary, as we don't know the tags of its earlier chunks.
+ */
+
+static __u32 yaffs_SummaryChecksum(const yaffs_SummaryTags *entries,
+				int nEntries)
+{
+	const __u32 *w = (const __u32 *)entries;
+	int nWords = nEntries * sizeof(yaffs_SummaryTags) / sizeof(__u32);
+	__u32 sum = 0;
+	int i;
+
+	for (i = 0; i < nWords; i++)
+		sum = ((sum << 1) | (sum >> 31)) ^ w[i];
+
+	return sum;
+}
+
+static void yaffs_SummaryClear(yaffs_Device *dev)
+{
+	if (dev->chunksPerSummary < 1)
+		return;
+
+	memset(dev->summaryTags, 0,
+		dev->chunksPerSummary * sizeof(yaffs_SummaryTags));
+	dev->summaryValid = 1;
+}
+
+static void yaffs_SummaryWrite(yaffs_Device *dev, int block)
+{
+	yaffs_BlockInfo *bi = yaffs_GetBlockInfo(dev, block);
+	yaffs_ExtendedTags tags;
+	yaffs_SummaryHeader hdr;
+	int nBytes = dev->chunksPerSummary * sizeof(yaffs_SummaryTags);
+	__u8 *buffer;
+	int chunk;
+
+	dev->summaryValid = 0;
+
+	chunk = yaffs_AllocateChunk(dev, 1, &bi);
+	if (chunk < 0)
+		return;
+
+	hdr.magic = YAFFS_SUMMARY_MAGIC;
+	hdr.sequenceNumber = bi->sequenceNumber;
+	hdr.nEntries = dev->chunksPerSummary;
+	hdr.checksum = yaffs_SummaryChecksum(dev->summaryTags,
+					dev->chunksPerSummary);
+
+	buffer = yaffs_GetTempBuffer(dev, __LINE__);
+	memset(buffer, 0xFF, dev->nDataBytesPerChunk);
+	memcpy(buffer, &hdr, sizeof(hdr));
+	memcpy(buffer + sizeof(hdr), dev->summaryTags, nBytes);
+
+	yaffs_InitialiseTags(&tags);
+	tags.objectId = YAFFS_OBJECTID_SUMMARY;
+	tags.chunkId = 1;
+	tags.byteCount = sizeof(hdr) + nBytes;
+
+	if (yaffs_WriteChunkWithTagsToNAND(dev, chunk, buffer, &tags) == YAFFS_OK) {
+		dev->summaryWrites++;
+		yaffs_DeleteChunk(dev, chunk, 1, __LINE__);
+	} else {
+		yaffs_HandleWriteChunkError(dev, chunk, 1);
+	}
+
+	yaffs_ReleaseTempBuffer(dev, buffer, __LINE__);
+}
+
+/* Record a chunk just written, and write the summary once the block is done */
+static void yaffs_SummaryAdd(yaffs_Device *dev, const yaffs_ExtendedTags *tags,
+				int chunk)
+{
+	yaffs_PackedTags2TagsPart pt;
+	int block = chunk / dev->param.nChunksPerBlock;
+	int page = chunk % dev->param.nChunksPerBlock;
+
+	if (!dev->summaryValid || block != dev->allocationBlock ||
+	    page >= dev->chunksPerSummary)
+		return;
+
+	yaffs_PackTags2TagsPart(&pt, tags);
+	dev->summaryTags[page].objectId = pt.objectId;
+	dev->summaryTags[page].chunkId = pt.chunkId;
+	dev->summaryTags[page].byteCount = pt.byteCount;
+
+	if (dev->allocationPage == dev->chunksPerSummary)
+		yaffs_SummaryWrite(dev, block);
+}
+
+/* Load the summary of a block into dev->summaryTags, if it has a good one */
+static int yaffs_SummaryRead(yaffs_Device *dev, int block, __u32 sequenceNumber)
+{
+	yaffs_ExtendedTags tags;
+	yaffs_SummaryHeader hdr;
+	__u8 *buffer;
+	int chunk;
+	int ok;
+
+	if (dev->chunksPerSummary < 1)
+		return 0;
+
+	chunk = block * dev->param.nChunksPerBlock + dev->chunksPerSummary;
+	buffer = yaffs_GetTempBuffer(dev, __LINE__);
+
+	ok = yaffs_ReadChunkWithTagsFromNAND(dev, chunk, buffer, &tags) == YAFFS_OK &&
+		tags.chunkUsed &&
+		tags.objectId == YAFFS_OBJECTID_SUMMARY &&
+		tags.eccResult != YAFFS_ECC_RESULT_UNFIXED;
+
+	if (ok) {
+		memcpy(&hdr, buffer, sizeof(hdr));
+		memcpy(dev->summaryTags, buffer + sizeof(hdr),
+			dev->chunksPerSummary * sizeof(yaffs_SummaryTags));
+
+		ok = hdr.magic == YAFFS_SUMMARY_MAGIC &&
+			hdr.sequenceNumber == sequenceNumber &&
+			hdr.nEntries == dev->chunksPerSummary &&
+			hdr.checksum == yaffs_SummaryChecksum(dev->summaryTags,
+							dev->chunksPerSummary);
+	}
+
+	yaffs_ReleaseTempBuffer(dev, buffer, __LINE__);
+
+	if (ok)
+		dev->summaryScans++;
+	return ok;
+}
+
+/* Tags of a chunk as given by the block summary loaded by yaffs_SummaryRead */
+static void yaffs_SummaryFetch(yaffs_Device *dev, yaffs_ExtendedTags *tags,
+				int page, __u32 sequenceNumber)
+{
+	yaffs_PackedTags2TagsPart pt;
+
+	pt.sequenceNumber = sequenceNumber;
+	if (page < dev->chunksPerSummary) {
+		pt.objectId = dev->summaryTags[page].objectId;
+		pt.chunkId = dev->summaryTags[page].chunkId;
+		pt.byteCount = dev->summaryTags[page].byteCount;
+	} else {
+		/* The summary chunk itself */
+		pt.objectId = YAFFS_OBJECTID_SUMMARY;
+		pt.chunkId = 1;
+		pt.byteCount = 0;
+	}
+
+	yaffs_UnpackTags2TagsPart(tags, &pt);
+	tags->eccResult = YAFFS_ECC_RESULT_NO_ERROR;
+}
+
 static int yaffs_AllocateChunk(yaffs_Device *dev, int useReserve,
 		yaffs_BlockInfo **blockUsedPtr)
 {
 	int retVal;
 	yaffs_BlockInfo *bi;
 
+	if (dev->allocationBlock < 0 && dev->writingCold &&
+	    !yaffs_ColdBlockAffordable(dev)) {
+		/* Too close to the reserve, copy to the hot block instead */
+		yaffs_SwapAllocationStreams(dev);
+	}
+
 	if (dev->allocationBlock < 0) {
 		/* Get next block to allocate off */
 		dev->allocationBlock = yaffs_FindBlockForAllocation(dev);
 		dev->allocationPage = 0;
+		yaffs_SummaryClear(dev);
+		if (dev->writingCold && dev->allocationBlock >= 0) {
+			dev->nColdBlocks++;
+			yaffs_SkipRestOfAltBlock(dev);
+		}
 	}
 
 	if (!useReserve && !yaffs_CheckSpaceForAllocation(dev, 1)) {
@@ -3087,6 +3473,9 @@ static int yaffs_GetErasedChunks(yaffs_Device *dev)
 	if (dev->allocationBlock > 0)
 		n += (dev->param.nChunksPerBlock - dev->allocationPage);
 
+	if (dev->coldAllocationBlock > 0)
+		n += (dev->param.nChunksPerBlock - dev->coldAllocationPage);
+
 	return n;
 
 }
@@ -3106,6 +3495,79 @@ static void yaffs_SkipRestOfBlock(yaffs_Device *dev)
 	}
 }
 
+/*
+ * Hot/cold separation.
+ * Chunks that survive gc tend to be long lived, so yaffs2 gives gc copies
+ * their own allocation block (the cold stream) rather than mixing them back
+ * in with freshly written data. Blocks then fill with data of similar age
+ * and are either mostly dead or mostly live when they come up for gc.
+ *
+ * Scanning takes the chunk in the block with the higher sequence number to
+ * be the newer one, so the streams have to be kept in order:
+ * - When the cold stream opens a block, the hot block is closed so that hot
+ *   writes carry on in a block newer than anything the cold stream holds.
+ * - A victim is only copied to the cold block if it is older than the cold
+ *   block. Otherwise the copies go to the hot block, which is always the
+ *   newest.
+ * A new cold block also costs the rest of the hot block, so near the
+ * reserve no cold block is opened and copies go to the hot block.
+ */
+static void yaffs_SwapAllocationStreams(yaffs_Device *dev)
+{
+	int block = dev->allocationBlock;
+	__u32 page = dev->allocationPage;
+	int summaryValid = dev->summaryValid;
+	yaffs_SummaryTags *summaryTags = dev->summaryTags;
+
+	dev->allocationBlock = dev->coldAllocationBlock;
+	dev->allocationPage = dev->coldAllocationPage;
+	dev->summaryValid = dev->coldSummaryValid;
+	dev->summaryTags = dev->coldSummaryTags;
+
+	dev->coldAllocationBlock = block;
+	dev->coldAllocationPage = page;
+	dev->coldSummaryValid = summaryValid;
+	dev->coldSummaryTags = summaryTags;
+
+	dev->writingCold = !dev->writingCold;
+}
+
+/* Close the allocation block of the stream not being written */
+static void yaffs_SkipRestOfAltBlock(yaffs_Device *dev)
+{
+	yaffs_SwapAllocationStreams(dev);
+	yaffs_SkipRestOfBlock(dev);
+	yaffs_SwapAllocationStreams(dev);
+}
+
+/* Opening a cold block closes the hot block too, so it costs two blocks */
+static int yaffs_ColdBlockAffordable(yaffs_Device *dev)
+{
+	return dev->nErasedBlocks >= dev->param.nReservedBlocks + 2;
+}
+
+static void yaffs_BeginColdWrites(yaffs_Device *dev, yaffs_BlockInfo *victim)
+{
+	if (!dev->param.isYaffs2 || dev->param.disableColdStream)
+		return;
+
+	if (dev->coldAllocationBlock > 0) {
+		if (yaffs_GetBlockInfo(dev, dev->coldAllocationBlock)->
+				sequenceNumber <= victim->sequenceNumber)
+			return;
+	} else if (!yaffs_ColdBlockAffordable(dev)) {
+		return;
+	}
+
+	yaffs_SwapAllocationStreams(dev);
+}
+
+static void yaffs_EndColdWrites(yaffs_Device *dev)
+{
+	if (dev->writingCold)
+		yaffs_SwapAllocationStreams(dev);
+}
+
 
 static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 		int wholeBlock)
@@ -3114,8 +3576,6 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 	int newChunk;
 	int markNAND;
 	int retVal = YAFFS_OK;
-	int cleanups = 0;
-	int i;
 	int isCheckpointBlock;
 	int matchingChunk;
 	int maxCopies;
@@ -3164,11 +3624,15 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 		maxCopies = (wholeBlock) ? dev->param.nChunksPerBlock : 5;
 		oldChunk = block * dev->param.nChunksPerBlock + dev->gcChunk;
 
+		dev->gcCopying = 1;
+		yaffs_BeginColdWrites(dev, bi);
+
 		for (/* init already done */;
 		     retVal == YAFFS_OK &&
 		     dev->gcChunk < dev->param.nChunksPerBlock &&
 		     (bi->blockState == YAFFS_BLOCK_STATE_COLLECTING) &&
-		     maxCopies > 0;
+		     maxCopies > 0 &&
+		     dev->nGCCleanups < dev->param.nChunksPerBlock;
 		     dev->gcChunk++, oldChunk++) {
 			if (yaffs_CheckChunkBit(dev, block, dev->gcChunk)) {
 
@@ -3237,9 +3701,9 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 
 					if (object->nDataChunks <= 0) {
 						/* remeber to clean up the object */
-						dev->gcCleanupList[cleanups] =
+						dev->gcCleanupList[dev->nGCCleanups] =
 						    tags.objectId;
-						cleanups++;
+						dev->nGCCleanups++;
 					}
 					markNAND = 0;
 				} else if (0) {
@@ -3301,6 +3765,7 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 
 						/* Ok, now fix up the Tnodes etc. */
 
+						yaffs_Lock(dev, YAFFS_LOCK_MAP);
 						if (tags.chunkId == 0) {
 							/* It's a header */
 							object->hdrChunk =  newChunk;
@@ -3313,6 +3778,7 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 							     tags.chunkId,
 							     newChunk, 0);
 						}
+						yaffs_Unlock(dev, YAFFS_LOCK_MAP);
 					}
 				}
 
@@ -3322,30 +3788,14 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 			}
 		}
 
-		yaffs_ReleaseTempBuffer(dev, buffer, __LINE__);
+		yaffs_EndColdWrites(dev);
+		dev->gcCopying = 0;
 
+		yaffs_ReleaseTempBuffer(dev, buffer, __LINE__);
 
-		/* Do any required cleanups */
-		for (i = 0; i < cleanups; i++) {
-			/* Time to delete the file too */
-			object =
-			    yaffs_FindObjectByNumber(dev,
-						     dev->gcCleanupList[i]);
-			if (object) {
-				yaffs_FreeTnode(dev,
-						object->variant.fileVariant.
-						top);
-				object->variant.fileVariant.top = NULL;
-				T(YAFFS_TRACE_GC,
-				  (TSTR
-				   ("yaffs: About to finally delete object %d"
-				    TENDSTR), object->objectId));
-				yaffs_DoGenericObjectDeletion(object);
-				object->myDev->nDeletedFiles--;
-			}
-
-		}
-
+		/* Readers may be looking objects up, leave it to later */
+		if (!dev->gcShared)
+			yaffs_FinishGarbageCollection(dev);
 	}
 
 	yaffs_VerifyCollectedBlock(dev, bi, block);
@@ -3376,9 +3826,59 @@ static int yaffs_GarbageCollectBlock(yaffs_Device *dev, int block,
 	return retVal;
 }
 
+/* Do any cleanups left by gc */
+void yaffs_FinishGarbageCollection(yaffs_Device *dev)
+{
+	yaffs_Object *object;
+	int i;
+
+	for (i = 0; i < dev->nGCCleanups; i++) {
+		/* Time to delete the file too */
+		object =
+		    yaffs_FindObjectByNumber(dev,
+					     dev->gcCleanupList[i]);
+		if (object) {
+			yaffs_FreeTnode(dev,
+					object->variant.fileVariant.
+					top);
+			object->variant.fileVariant.top = NULL;
+			T(YAFFS_TRACE_GC,
+			  (TSTR
+			   ("yaffs: About to finally delete object %d"
+			    TENDSTR), object->objectId));
+			yaffs_DoGenericObjectDeletion(object);
+			object->myDev->nDeletedFiles--;
+		}
+
+	}
+	dev->nGCCleanups = 0;
+}
+
+/*
+ * Cost-benefit score for collecting a block: the space reclaimed times how
+ * long the block has been left alone, over the cost of reading and rewriting
+ * the live chunks. Old blocks hold data that has stopped changing, so it is
+ * worth moving out of the way even when they are only moderately dirty,
+ * whereas young blocks will get dirtier by themselves if we wait.
+ */
+static __u32 yaffs_GCScore(yaffs_Device *dev, yaffs_BlockInfo *bi,
+				int pagesUsed)
+{
+	__u32 age = 1;
+
+	if (dev->param.isYaffs2 && dev->sequenceNumber > bi->sequenceNumber)
+		age += dev->sequenceNumber - bi->sequenceNumber;
+	if (age > YAFFS_GC_MAX_AGE)
+		age = YAFFS_GC_MAX_AGE;
+
+	return (dev->param.nChunksPerBlock - pagesUsed) * age /
+		(1 + 2 * pagesUsed);
+}
+
 /*
  * FindBlockForgarbageCollection is used to select the dirtiest block (or close enough)
- * for garbage collection.
+ * for garbage collection. Passive collection uses the cost-benefit score above
+ * unless the gc-greedy mount option asks for plain dirtiest-first.
  */
 
 static unsigned yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
@@ -3396,6 +3896,7 @@ static unsigned yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
 	/* First let's see if we need to grab a prioritised block */
 	if (dev->hasPendingPrioritisedGCs && !aggressive) {
 		dev->gcDirtiest = 0;
+		dev->gcDirtiestScore = 0;
 		bi = dev->blockInfo;
 		for (i = dev->internalStartBlock;
 			i <= dev->internalEndBlock && !selected;
@@ -3436,6 +3937,9 @@ static unsigned yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
 	if (!selected){
 		int pagesUsed;
 		int nBlocks = dev->internalEndBlock - dev->internalStartBlock + 1;
+		int costBenefit = !aggressive && !dev->param.gcGreedy;
+		int better;
+		__u32 score = 0;
 		if (aggressive){
 			threshold = dev->param.nChunksPerBlock;
 			iterations = nBlocks;
@@ -3467,12 +3971,28 @@ static unsigned yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
 
 			pagesUsed = bi->pagesInUse - bi->softDeletions;
 
-			if (bi->blockState == YAFFS_BLOCK_STATE_FULL &&
-				pagesUsed < dev->param.nChunksPerBlock &&
-				(dev->gcDirtiest < 1 || pagesUsed < dev->gcPagesInUse) &&
-				yaffs_BlockNotDisqualifiedFromGC(dev, bi)) {
+			/*
+			 * Only blocks that could be selected are compared, or a
+			 * block scoring high on age alone would hold the slot
+			 * while being too full to pass the threshold below.
+			 */
+			if (bi->blockState != YAFFS_BLOCK_STATE_FULL ||
+				pagesUsed >= dev->param.nChunksPerBlock ||
+				pagesUsed > threshold)
+				continue;
+
+			if (costBenefit) {
+				score = yaffs_GCScore(dev, bi, pagesUsed);
+				better = (dev->gcDirtiest < 1 ||
+					score > dev->gcDirtiestScore);
+			} else
+				better = (dev->gcDirtiest < 1 ||
+					pagesUsed < dev->gcPagesInUse);
+
+			if (better && yaffs_BlockNotDisqualifiedFromGC(dev, bi)) {
 				dev->gcDirtiest = dev->gcBlockFinder;
 				dev->gcPagesInUse = pagesUsed;
+				dev->gcDirtiestScore = score;
 			}
 		}
 
@@ -3509,11 +4029,18 @@ static unsigned yaffs_FindBlockForGarbageCollection(yaffs_Device *dev,
 			dev->backgroundGCs++;
 		dev->gcDirtiest = 0;
 		dev->gcPagesInUse = 0;
+		dev->gcDirtiestScore = 0;
 		dev->gcNotDone = 0;
 		if(dev->refreshSkip > 0)
 			dev->refreshSkip--;
 	} else{
 		dev->gcNotDone++;
+		/* A candidate kept from a laxer pass can't be taken now */
+		if(dev->gcPagesInUse > threshold){
+			dev->gcDirtiest = 0;
+			dev->gcPagesInUse = 0;
+			dev->gcDirtiestScore = 0;
+		}
 		T(YAFFS_TRACE_GC,
 		  (TSTR("GC none: finder %d skip %d threshold %d dirtiest %d using %d oldest %d%s" TENDSTR),
 		  dev->gcBlockFinder, dev->gcNotDone,
@@ -3635,7 +4162,9 @@ int yaffs_BackgroundGarbageCollect(yaffs_Device *dev, unsigned urgency)
 
 	T(YAFFS_TRACE_BACKGROUND, (TSTR("Background gc %u" TENDSTR),urgency));
 
+	dev->gcShared = 1;
 	yaffs_CheckGarbageCollection(dev, 1);
+	dev->gcShared = 0;
 	return erasedChunks > dev->nFreeChunks/2;
 }
 
@@ -3904,20 +4433,29 @@ static int yaffs_PutChunkIntoFile(yaffs_Object *in, int chunkInInode,
 static int yaffs_ReadChunkDataFromObject(yaffs_Object *in, int chunkInInode,
 					__u8 *buffer)
 {
-	int chunkInNAND = yaffs_FindChunkInFile(in, chunkInInode, NULL);
+	yaffs_Device *dev = in->myDev;
+	int chunkInNAND;
+	int retVal = 0;
+
+	/* Background gc must not move the chunk while we read it */
+	yaffs_LockShared(dev, YAFFS_LOCK_MAP);
+
+	chunkInNAND = yaffs_FindChunkInFile(in, chunkInInode, NULL);
 
 	if (chunkInNAND >= 0)
-		return yaffs_ReadChunkWithTagsFromNAND(in->myDev, chunkInNAND,
+		retVal = yaffs_ReadChunkWithTagsFromNAND(dev, chunkInNAND,
 						buffer, NULL);
 	else {
 		T(YAFFS_TRACE_NANDACCESS,
 		  (TSTR("Chunk %d not found zero instead" TENDSTR),
 		   chunkInNAND));
 		/* get sane (zero) data if you read a hole */
-		memset(buffer, 0, in->myDev->nDataBytesPerChunk);
-		return 0;
+		memset(buffer, 0, dev->nDataBytesPerChunk);
 	}
 
+	yaffs_UnlockShared(dev, YAFFS_LOCK_MAP);
+
+	return retVal;
 }
 
 void yaffs_DeleteChunk(yaffs_Device *dev, int chunkId, int markNAND, int lyn)
@@ -4225,19 +4763,76 @@ int yaffs_UpdateObjectHeader(yaffs_Object *in, const YCHAR *name, int force,
  *   In Linux, the page cache provides read buffering aand the short op cache provides write
  *   buffering.
  *
- *   There are a limited number (~10) of cache chunks per device so that we don't
- *   need a very intelligent search.
+ *   The cache can be large, so entries in use are hashed on (object, chunk)
+ *   and kept on an LRU list, most recently used first. Empty entries are
+ *   kept on a free list.
  */
 
+static __u32 yaffs_ChunkCacheHash(yaffs_Device *dev, const yaffs_Object *obj,
+				int chunkId)
+{
+	return (obj->objectId * 0x9E3779B1U + chunkId) & dev->srCacheHashMask;
+}
+
+static void yaffs_UnhashChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache)
+{
+	yaffs_ChunkCache **p;
+
+	p = &dev->srCacheHash[yaffs_ChunkCacheHash(dev, cache->object,
+						cache->chunkId)];
+	while (*p && *p != cache)
+		p = &(*p)->hashNext;
+	if (*p)
+		*p = cache->hashNext;
+	cache->hashNext = NULL;
+}
+
+/* Give a cache entry to a chunk of an object. It becomes the most recently used. */
+static void yaffs_AttachChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
+				yaffs_Object *obj, int chunkId)
+{
+	__u32 bucket;
+
+	if (cache->object)
+		yaffs_UnhashChunkCache(dev, cache);
+
+	cache->object = obj;
+	cache->chunkId = chunkId;
+	cache->dirty = 0;
+	cache->locked = 0;
+
+	bucket = yaffs_ChunkCacheHash(dev, obj, chunkId);
+	cache->hashNext = dev->srCacheHash[bucket];
+	dev->srCacheHash[bucket] = cache;
+
+	ylist_del(&cache->lruLink);
+	ylist_add(&cache->lruLink, &dev->srCacheLru);
+}
+
+/* Empty a cache entry, without writing it out */
+static void yaffs_ReleaseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache)
+{
+	if (cache->object)
+		yaffs_UnhashChunkCache(dev, cache);
+
+	cache->object = NULL;
+	cache->dirty = 0;
+
+	ylist_del(&cache->lruLink);
+	ylist_add(&cache->lruLink, &dev->srCacheFree);
+}
+
 static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
+	struct ylist_head *i;
 	yaffs_ChunkCache *cache;
-	int nCaches = obj->myDev->param.nShortOpCaches;
 
-	for (i = 0; i < nCaches; i++) {
-		cache = &dev->srCache[i];
+	if (dev->param.nShortOpCaches < 1)
+		return 0;
+
+	ylist_for_each(i, &dev->srCacheLru) {
+		cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
 		if (cache->object == obj &&
 		    cache->dirty)
 			return 1;
@@ -4247,48 +4842,59 @@ static int yaffs_ObjectHasCachedWriteData(yaffs_Object *obj)
 }
 
 
+static int yaffs_ChunkCacheCompare(const void *a, const void *b)
+{
+	const yaffs_ChunkCache *ca = *(const yaffs_ChunkCache **)a;
+	const yaffs_ChunkCache *cb = *(const yaffs_ChunkCache **)b;
+
+	return ca->chunkId - cb->chunkId;
+}
+
 static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
 {
 	yaffs_Device *dev = obj->myDev;
-	int lowest = -99;	/* Stop compiler whining. */
-	int i;
+	struct ylist_head *i;
 	yaffs_ChunkCache *cache;
-	int chunkWritten = 0;
-	int nCaches = obj->myDev->param.nShortOpCaches;
-
-	if (nCaches > 0) {
-		do {
-			cache = NULL;
-
-			/* Find the dirty cache for this object with the lowest chunk id. */
-			for (i = 0; i < nCaches; i++) {
-				if (dev->srCache[i].object == obj &&
-				    dev->srCache[i].dirty) {
-					if (!cache
-					    || dev->srCache[i].chunkId <
-					    lowest) {
-						cache = &dev->srCache[i];
-						lowest = cache->chunkId;
-					}
-				}
-			}
+	int nDirty = 0;
+	int n;
+	int chunkWritten = 1;
 
-			if (cache && !cache->locked) {
-				/* Write it out and free it up */
+	if (dev->param.nShortOpCaches > 0) {
+		/* Gather the object's dirty chunks and write them out in
+		 * chunk order, in one pass over the cache.
+		 */
+		ylist_for_each(i, &dev->srCacheLru) {
+			cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+			if (cache->object == obj && cache->dirty)
+				dev->srCacheFlush[nDirty++] = cache;
+		}
 
-				chunkWritten =
-				    yaffs_WriteChunkDataToObject(cache->object,
-								 cache->chunkId,
-								 cache->data,
-								 cache->nBytes,
-								 1);
-				cache->dirty = 0;
-				cache->object = NULL;
-			}
+		if (nDirty > 1)
+			yaffs_qsort(dev->srCacheFlush, nDirty,
+				sizeof(yaffs_ChunkCache *),
+				yaffs_ChunkCacheCompare);
+
+		for (n = 0; n < nDirty && chunkWritten > 0; n++) {
+			cache = dev->srCacheFlush[n];
+
+			/* Writing may have released it, eg. through gc */
+			if (cache->object != obj || !cache->dirty)
+				continue;
+
+			if (cache->locked)
+				break;
 
-		} while (cache && chunkWritten > 0);
+			/* Write it out and free it up */
+			chunkWritten =
+			    yaffs_WriteChunkDataToObject(cache->object,
+							 cache->chunkId,
+							 cache->data,
+							 cache->nBytes,
+							 1);
+			yaffs_ReleaseChunkCache(dev, cache);
+		}
 
-		if (cache) {
+		if (chunkWritten <= 0 || n < nDirty) {
 			/* Hoosterman, disk full while writing cache out. */
 			T(YAFFS_TRACE_ERROR,
 			  (TSTR("yaffs tragedy: no space during cache write" TENDSTR)));
@@ -4306,19 +4912,23 @@ static void yaffs_FlushFilesChunkCache(yaffs_Object *obj)
 void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
 {
 	yaffs_Object *obj;
-	int nCaches = dev->param.nShortOpCaches;
-	int i;
+	struct ylist_head *i;
+	yaffs_ChunkCache *cache;
+
+	if (dev->param.nShortOpCaches < 1)
+		return;
 
 	/* Find a dirty object in the cache and flush it...
 	 * until there are no further dirty objects.
 	 */
 	do {
 		obj = NULL;
-		for (i = 0; i < nCaches && !obj; i++) {
-			if (dev->srCache[i].object &&
-			    dev->srCache[i].dirty)
-				obj = dev->srCache[i].object;
-
+		ylist_for_each(i, &dev->srCacheLru) {
+			cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+			if (cache->dirty) {
+				obj = cache->object;
+				break;
+			}
 		}
 		if (obj)
 			yaffs_FlushFilesChunkCache(obj);
@@ -4335,14 +4945,9 @@ void yaffs_FlushEntireDeviceCache(yaffs_Device *dev)
  */
 static yaffs_ChunkCache *yaffs_GrabChunkCacheWorker(yaffs_Device *dev)
 {
-	int i;
-
-	if (dev->param.nShortOpCaches > 0) {
-		for (i = 0; i < dev->param.nShortOpCaches; i++) {
-			if (!dev->srCache[i].object)
-				return &dev->srCache[i];
-		}
-	}
+	if (dev->param.nShortOpCaches > 0 && !ylist_empty(&dev->srCacheFree))
+		return ylist_entry(dev->srCacheFree.next, yaffs_ChunkCache,
+				lruLink);
 
 	return NULL;
 }
@@ -4350,10 +4955,7 @@ static yaffs_ChunkCache *yaffs_GrabChunkCacheWorker(yaffs_Device *dev)
 static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev)
 {
 	yaffs_ChunkCache *cache;
-	yaffs_Object *theObj;
-	int usage;
-	int i;
-	int pushout;
+	struct ylist_head *i;
 
 	if (dev->param.nShortOpCaches > 0) {
 		/* Try find a non-dirty one... */
@@ -4361,33 +4963,25 @@ static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev)
 		cache = yaffs_GrabChunkCacheWorker(dev);
 
 		if (!cache) {
-			/* They were all dirty, find the last recently used object and flush
-			 * its cache, then  find again.
+			/* They were all in use, take the least recently used
+			 * one. If that is dirty, flush its object and find again.
 			 * NB what's here is not very accurate, we actually flush the object
 			 * the last recently used page.
 			 */
 
-			/* With locking we can't assume we can use entry zero */
-
-			theObj = NULL;
-			usage = -1;
-			cache = NULL;
-			pushout = -1;
-
-			for (i = 0; i < dev->param.nShortOpCaches; i++) {
-				if (dev->srCache[i].object &&
-				    !dev->srCache[i].locked &&
-				    (dev->srCache[i].lastUse < usage || !cache)) {
-					usage = dev->srCache[i].lastUse;
-					theObj = dev->srCache[i].object;
-					cache = &dev->srCache[i];
-					pushout = i;
-				}
+			/* With locking we can't assume we can use the tail */
+			for (i = dev->srCacheLru.prev; i != &dev->srCacheLru;
+			     i = i->prev) {
+				cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+				if (!cache->locked)
+					break;
+				cache = NULL;
 			}
 
 			if (!cache || cache->dirty) {
 				/* Flush and try again */
-				yaffs_FlushFilesChunkCache(theObj);
+				if (cache)
+					yaffs_FlushFilesChunkCache(cache->object);
 				cache = yaffs_GrabChunkCacheWorker(dev);
 			}
 
@@ -4398,23 +4992,58 @@ static yaffs_ChunkCache *yaffs_GrabChunkCache(yaffs_Device *dev)
 
 }
 
+/* Grab a cache chunk that can be reused without flushing: an empty one, or
+ * else the least recently used clean one. Returns NULL if all are dirty.
+ */
+static yaffs_ChunkCache *yaffs_GrabCleanChunkCache(yaffs_Device *dev)
+{
+	yaffs_ChunkCache *cache;
+	struct ylist_head *i;
+
+	cache = yaffs_GrabChunkCacheWorker(dev);
+	if (cache || dev->param.nShortOpCaches < 1)
+		return cache;
+
+	for (i = dev->srCacheLru.prev; i != &dev->srCacheLru; i = i->prev) {
+		cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+		if (!cache->dirty && !cache->locked)
+			return cache;
+	}
+
+	return NULL;
+}
+
+/* Look up a cached chunk, without touching the statistics */
+static yaffs_ChunkCache *yaffs_LookupChunkCache(const yaffs_Object *obj,
+					      int chunkId)
+{
+	yaffs_Device *dev = obj->myDev;
+	yaffs_ChunkCache *cache = NULL;
+
+	if (dev->param.nShortOpCaches > 0) {
+		cache = dev->srCacheHash[yaffs_ChunkCacheHash(dev, obj, chunkId)];
+		while (cache &&
+		       (cache->object != obj || cache->chunkId != chunkId))
+			cache = cache->hashNext;
+	}
+	return cache;
+}
+
 /* Find a cached chunk */
 static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object *obj,
 					      int chunkId)
 {
 	yaffs_Device *dev = obj->myDev;
-	int i;
-	if (dev->param.nShortOpCaches > 0) {
-		for (i = 0; i < dev->param.nShortOpCaches; i++) {
-			if (dev->srCache[i].object == obj &&
-			    dev->srCache[i].chunkId == chunkId) {
-				dev->cacheHits++;
+	yaffs_ChunkCache *cache = NULL;
 
-				return &dev->srCache[i];
-			}
-		}
+	if (dev->param.nShortOpCaches > 0) {
+		cache = yaffs_LookupChunkCache(obj, chunkId);
+		if (cache)
+			dev->cacheHits++;
+		else
+			dev->cacheMisses++;
 	}
-	return NULL;
+	return cache;
 }
 
 /* Mark the chunk for the least recently used algorithym */
@@ -4423,18 +5052,8 @@ static void yaffs_UseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
 {
 
 	if (dev->param.nShortOpCaches > 0) {
-		if (dev->srLastUse < 0 || dev->srLastUse > 100000000) {
-			/* Reset the cache usages */
-			int i;
-			for (i = 1; i < dev->param.nShortOpCaches; i++)
-				dev->srCache[i].lastUse = 0;
-
-			dev->srLastUse = 0;
-		}
-
-		dev->srLastUse++;
-
-		cache->lastUse = dev->srLastUse;
+		ylist_del(&cache->lruLink);
+		ylist_add(&cache->lruLink, &dev->srCacheLru);
 
 		if (isAWrite)
 			cache->dirty = 1;
@@ -4448,10 +5067,10 @@ static void yaffs_UseChunkCache(yaffs_Device *dev, yaffs_ChunkCache *cache,
 static void yaffs_InvalidateChunkCache(yaffs_Object *object, int chunkId)
 {
 	if (object->myDev->param.nShortOpCaches > 0) {
-		yaffs_ChunkCache *cache = yaffs_FindChunkCache(object, chunkId);
+		yaffs_ChunkCache *cache = yaffs_LookupChunkCache(object, chunkId);
 
 		if (cache)
-			cache->object = NULL;
+			yaffs_ReleaseChunkCache(object->myDev, cache);
 	}
 }
 
@@ -4460,14 +5079,17 @@ static void yaffs_InvalidateChunkCache(yaffs_Object *object, int chunkId)
  */
 static void yaffs_InvalidateWholeChunkCache(yaffs_Object *in)
 {
-	int i;
+	struct ylist_head *i;
+	struct ylist_head *n;
+	yaffs_ChunkCache *cache;
 	yaffs_Device *dev = in->myDev;
 
 	if (dev->param.nShortOpCaches > 0) {
 		/* Invalidate it. */
-		for (i = 0; i < dev->param.nShortOpCaches; i++) {
-			if (dev->srCache[i].object == in)
-				dev->srCache[i].object = NULL;
+		ylist_for_each_safe(i, n, &dev->srCacheLru) {
+			cache = ylist_entry(i, yaffs_ChunkCache, lruLink);
+			if (cache->object == in)
+				yaffs_ReleaseChunkCache(dev, cache);
 		}
 	}
 }
@@ -4997,11 +5619,16 @@ int yaffs_CheckpointSave(yaffs_Device *dev)
 
 	T(YAFFS_TRACE_CHECKPOINT, (TSTR("save entry: isCheckpointed %d"TENDSTR), dev->isCheckpointed));
 
+	/* Don't checkpoint objects that only wait to be freed */
+	yaffs_FinishGarbageCollection(dev);
+
 	yaffs_VerifyObjects(dev);
 	yaffs_VerifyBlocks(dev);
 	yaffs_VerifyFreeChunks(dev);
 
 	if (!dev->isCheckpointed) {
+		/* The checkpoint only records one allocation block */
+		yaffs_SkipRestOfAltBlock(dev);
 		yaffs_InvalidateCheckpoint(dev);
 		yaffs_WriteCheckpointData(dev);
 	}
@@ -5068,6 +5695,9 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 		else
 			nToCopy = dev->nDataBytesPerChunk - start;
 
+		/* Readers may run concurrently, see yaffs_LockType */
+		yaffs_Lock(dev, YAFFS_LOCK_CACHE);
+
 		cache = yaffs_FindChunkCache(in, chunk);
 
 		/* If the chunk is already in the cache or it is less than a whole chunk
@@ -5075,22 +5705,24 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 		 * else bypass the cache.
 		 */
 		if (cache || nToCopy != dev->nDataBytesPerChunk || dev->param.inbandTags) {
-			if (dev->param.nShortOpCaches > 0) {
-
-				/* If we can't find the data in the cache, then load it up. */
 
-				if (!cache) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+			/* If we can't find the data in the cache, then load it
+			 * up. A read must not flush, so only into an entry that
+			 * is free or clean.
+			 */
+			if (!cache && dev->param.nShortOpCaches > 0) {
+				cache = yaffs_GrabCleanChunkCache(dev);
+				if (cache) {
+					yaffs_AttachChunkCache(dev, cache,
+							in, chunk);
 					yaffs_ReadChunkDataFromObject(in, chunk,
 								      cache->
 								      data);
 					cache->nBytes = 0;
 				}
+			}
 
+			if (cache) {
 				yaffs_UseChunkCache(dev, cache, 0);
 
 				cache->locked = 1;
@@ -5099,11 +5731,16 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 				memcpy(buffer, &cache->data[start], nToCopy);
 
 				cache->locked = 0;
+
+				yaffs_Unlock(dev, YAFFS_LOCK_CACHE);
 			} else {
 				/* Read into the local buffer then copy..*/
 
-				__u8 *localBuffer =
-				    yaffs_GetTempBuffer(dev, __LINE__);
+				__u8 *localBuffer;
+
+				yaffs_Unlock(dev, YAFFS_LOCK_CACHE);
+
+				localBuffer = yaffs_GetTempBuffer(dev, __LINE__);
 				yaffs_ReadChunkDataFromObject(in, chunk,
 							      localBuffer);
 
@@ -5115,6 +5752,7 @@ int yaffs_ReadDataFromFile(yaffs_Object *in, __u8 *buffer, loff_t offset,
 			}
 
 		} else {
+			yaffs_Unlock(dev, YAFFS_LOCK_CACHE);
 
 			/* A full chunk. Read directly into the supplied buffer. */
 			yaffs_ReadChunkDataFromObject(in, chunk, buffer);
@@ -5208,10 +5846,8 @@ int yaffs_DoWriteDataToFile(yaffs_Object *in, const __u8 *buffer, loff_t offset,
 				if (!cache
 				    && yaffs_CheckSpaceForAllocation(dev, 1)) {
 					cache = yaffs_GrabChunkCache(dev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
+					yaffs_AttachChunkCache(dev, cache,
+							in, chunk);
 					yaffs_ReadChunkDataFromObject(in, chunk,
 								      cache->data);
 				} else if (cache &&
@@ -6515,11 +7151,24 @@ static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
 		in->lazyLoaded ? "not yet" : "already"));
 #endif
 
-	if (in->lazyLoaded && in->hdrChunk > 0) {
-		in->lazyLoaded = 0;
+	if (!in->lazyLoaded || in->hdrChunk <= 0) {
+		/*
+		 * Pairs with the write barrier below, in case a reader
+		 * just loaded it: don't read the details before the flag.
+		 */
+		Y_READ_BARRIER();
+		return;
+	}
+
+	yaffs_Lock(dev, YAFFS_LOCK_OBJECT);
+
+	/* Another reader may have beaten us to it. */
+	if (in->lazyLoaded) {
 		chunkData = yaffs_GetTempBuffer(dev, __LINE__);
 
+		yaffs_LockShared(dev, YAFFS_LOCK_MAP);
 		result = yaffs_ReadChunkWithTagsFromNAND(dev, in->hdrChunk, chunkData, &tags);
+		yaffs_UnlockShared(dev, YAFFS_LOCK_MAP);
 		oh = (yaffs_ObjectHeader *) chunkData;
 
 		in->yst_mode = oh->yst_mode;
@@ -6549,7 +7198,17 @@ static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
 		}
 
 		yaffs_ReleaseTempBuffer(dev, chunkData, __LINE__);
+
+		/*
+		 * Only now that the details are there. The lock-free check
+		 * at the top relies on this order, which the unlock does
+		 * not give us.
+		 */
+		Y_WRITE_BARRIER();
+		in->lazyLoaded = 0;
 	}
+
+	yaffs_Unlock(dev, YAFFS_LOCK_OBJECT);
 }
 
 static int yaffs_ScanBackwards(yaffs_Device *dev)
@@ -6579,6 +7238,7 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 	int fileSize;
 	int isShrink;
 	int foundChunksInBlock;
+	int summaryAvailable;
 	int equivalentObjectId;
 	int alloc_failed = 0;
 
@@ -6733,6 +7393,10 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 		deleted = 0;
 
+		/* A full block with a summary needs one read, not one per chunk */
+		summaryAvailable = state == YAFFS_BLOCK_STATE_NEEDS_SCANNING &&
+			yaffs_SummaryRead(dev, blk, bi->sequenceNumber);
+
 		/* For each chunk in each block that needs scanning.... */
 		foundChunksInBlock = 0;
 		for (c = dev->param.nChunksPerBlock - 1;
@@ -6745,8 +7409,13 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 			chunk = blk * dev->param.nChunksPerBlock + c;
 
-			result = yaffs_ReadChunkWithTagsFromNAND(dev, chunk, NULL,
-							&tags);
+			if (summaryAvailable) {
+				yaffs_SummaryFetch(dev, &tags, c,
+						bi->sequenceNumber);
+				result = YAFFS_OK;
+			} else
+				result = yaffs_ReadChunkWithTagsFromNAND(dev,
+							chunk, NULL, &tags);
 
 			/* Let's have a good look at this chunk... */
 
@@ -6802,6 +7471,11 @@ static int yaffs_ScanBackwards(yaffs_Device *dev)
 
 				  dev->nFreeChunks++;
 
+			} else if (tags.objectId == YAFFS_OBJECTID_SUMMARY) {
+				/* A block summary, deleted as soon as written */
+				foundChunksInBlock = 1;
+				dev->nFreeChunks++;
+
 			} else if (tags.chunkId > 0) {
 				/* chunkId > 0 so it is a data chunk... */
 				unsigned int endpos;
@@ -7352,6 +8026,8 @@ static void yaffs_RemoveObjectFromDirectory(yaffs_Object *obj)
 	if (dev && dev->param.removeObjectCallback)
 		dev->param.removeObjectCallback(obj);
 
+	if (yaffs_DirIndexOf(parent))
+		yaffs_DirIndexUnlink(yaffs_DirIndexOf(parent), obj);
 
 	ylist_del_init(&obj->siblings);
 	obj->parent = NULL;
@@ -7362,6 +8038,8 @@ static void yaffs_RemoveObjectFromDirectory(yaffs_Object *obj)
 static void yaffs_AddObjectToDirectory(yaffs_Object *directory,
 					yaffs_Object *obj)
 {
+	yaffs_DirIndex *index;
+
 	if (!directory) {
 		T(YAFFS_TRACE_ALWAYS,
 		  (TSTR
@@ -7386,6 +8064,11 @@ static void yaffs_AddObjectToDirectory(yaffs_Object *directory,
 
 	yaffs_VerifyDirectory(directory);
 
+	/* Children of an indexed directory are always fully loaded */
+	index = yaffs_DirIndexOf(directory);
+	if (index)
+		yaffs_CheckObjectDetailsLoaded(obj);
+
 	yaffs_RemoveObjectFromDirectory(obj);
 
 
@@ -7393,6 +8076,13 @@ static void yaffs_AddObjectToDirectory(yaffs_Object *directory,
 	ylist_add(&obj->siblings, &directory->variant.directoryVariant.children);
 	obj->parent = directory;
 
+	if (index) {
+		yaffs_DirIndexLink(index, obj);
+		if (index->nEntries > 2 * index->nBuckets)
+			yaffs_DirIndexResize(obj->myDev, index,
+					index->nBuckets * 2);
+	}
+
 	if (directory == obj->myDev->unlinkedDir
 			|| directory == obj->myDev->deletedDir) {
 		obj->unlinked = 1;
@@ -7411,6 +8101,7 @@ yaffs_Object *yaffs_FindObjectByName(yaffs_Object *directory,
 
 	struct ylist_head *i;
 	YCHAR buffer[YAFFS_MAX_NAME_LENGTH + 1];
+	yaffs_DirIndex *index;
 
 	yaffs_Object *l;
 
@@ -7434,6 +8125,35 @@ yaffs_Object *yaffs_FindObjectByName(yaffs_Object *directory,
 
 	sum = yaffs_CalcNameSum(name);
 
+	index = directory->variant.directoryVariant.index;
+	if (index)
+		Y_READ_BARRIER();
+	else
+		index = yaffs_BuildDirIndex(directory);
+
+	/* Made up names don't match the sum, so they need the full walk */
+	if (index && !yaffs_IsMadeUpName(name)) {
+		yaffs_Object *lostNFound = directory->myDev->lostNFoundDir;
+
+		/* Special case for lost-n-found */
+		if (yaffs_strcmp(name, YAFFS_LOSTNFOUND_NAME) == 0 &&
+		    lostNFound && lostNFound->parent == directory)
+			return lostNFound;
+
+		l = index->buckets[yaffs_DirIndexBucket(index, sum)];
+		for (; l; l = l->indexNext) {
+			if (l->objectId == YAFFS_OBJECTID_LOSTNFOUND ||
+			    !yaffs_SumCompare(l->sum, sum))
+				continue;
+
+			yaffs_GetObjectName(l, buffer,
+					    YAFFS_MAX_NAME_LENGTH + 1);
+			if (yaffs_strncmp(name, buffer, YAFFS_MAX_NAME_LENGTH) == 0)
+				return l;
+		}
+		return NULL;
+	}
+
 	ylist_for_each(i, &directory->variant.directoryVariant.children) {
 		if (i) {
 			l = ylist_entry(i, yaffs_Object, siblings);
@@ -7550,11 +8270,13 @@ int yaffs_GetObjectName(yaffs_Object *obj, YCHAR *name, int buffSize)
 
 		memset(buffer, 0, obj->myDev->nDataBytesPerChunk);
 
+		yaffs_LockShared(obj->myDev, YAFFS_LOCK_MAP);
 		if (obj->hdrChunk > 0) {
 			result = yaffs_ReadChunkWithTagsFromNAND(obj->myDev,
 							obj->hdrChunk, buffer,
 							NULL);
 		}
+		yaffs_UnlockShared(obj->myDev, YAFFS_LOCK_MAP);
 		yaffs_strncpy(name, oh->name, buffSize - 1);
 		name[buffSize-1]=0;
 
@@ -7959,37 +8681,55 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 
 	dev->srCache = NULL;
 	dev->gcCleanupList = NULL;
+	dev->nGCCleanups = 0;
+	dev->gcShared = 0;
 
 
 	if (!init_failed &&
 	    dev->param.nShortOpCaches > 0) {
 		int i;
 		void *buf;
-		int srCacheBytes = dev->param.nShortOpCaches * sizeof(yaffs_ChunkCache);
+		int srCacheBytes;
+		int nBuckets = 1;
 
 		if (dev->param.nShortOpCaches > YAFFS_MAX_SHORT_OP_CACHES)
 			dev->param.nShortOpCaches = YAFFS_MAX_SHORT_OP_CACHES;
 
+		srCacheBytes = dev->param.nShortOpCaches * sizeof(yaffs_ChunkCache);
+		while (nBuckets < dev->param.nShortOpCaches)
+			nBuckets <<= 1;
+
+		YINIT_LIST_HEAD(&dev->srCacheLru);
+		YINIT_LIST_HEAD(&dev->srCacheFree);
+		dev->srCacheHashMask = nBuckets - 1;
+		dev->srCacheHash = YMALLOC(nBuckets * sizeof(yaffs_ChunkCache *));
 		dev->srCache =  YMALLOC(srCacheBytes);
+		dev->srCacheFlush = YMALLOC(dev->param.nShortOpCaches *
+					sizeof(yaffs_ChunkCache *));
 
 		buf = (__u8 *) dev->srCache;
+		if (!dev->srCacheHash || !dev->srCacheFlush)
+			buf = NULL;
 
 		if (dev->srCache)
 			memset(dev->srCache, 0, srCacheBytes);
+		if (dev->srCacheHash)
+			memset(dev->srCacheHash, 0,
+				nBuckets * sizeof(yaffs_ChunkCache *));
 
 		for (i = 0; i < dev->param.nShortOpCaches && buf; i++) {
 			dev->srCache[i].object = NULL;
-			dev->srCache[i].lastUse = 0;
 			dev->srCache[i].dirty = 0;
 			dev->srCache[i].data = buf = YMALLOC_DMA(dev->param.totalBytesPerChunk);
+			ylist_add_tail(&dev->srCache[i].lruLink,
+					&dev->srCacheFree);
 		}
 		if (!buf)
 			init_failed = 1;
-
-		dev->srLastUse = 0;
 	}
 
 	dev->cacheHits = 0;
+	dev->cacheMisses = 0;
 
 	if (!init_failed) {
 		dev->gcCleanupList = YMALLOC(dev->param.nChunksPerBlock * sizeof(__u32));
@@ -8000,6 +8740,26 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	if (dev->param.isYaffs2)
 		dev->param.useHeaderFileSize = 1;
 
+	/* Block summaries, if the summary fits in one chunk */
+	dev->chunksPerSummary = 0;
+	dev->summaryValid = 0;
+	dev->summaryTags = NULL;
+	dev->coldSummaryValid = 0;
+	dev->coldSummaryTags = NULL;
+	dev->summaryWrites = 0;
+	dev->summaryScans = 0;
+	if (!init_failed && dev->param.isYaffs2 && !dev->param.disableSummary &&
+	    sizeof(yaffs_SummaryHeader) + (dev->param.nChunksPerBlock - 1) *
+	    sizeof(yaffs_SummaryTags) <= dev->nDataBytesPerChunk) {
+		dev->chunksPerSummary = dev->param.nChunksPerBlock - 1;
+		dev->summaryTags = YMALLOC(dev->chunksPerSummary *
+					sizeof(yaffs_SummaryTags));
+		dev->coldSummaryTags = YMALLOC(dev->chunksPerSummary *
+					sizeof(yaffs_SummaryTags));
+		if (!dev->summaryTags || !dev->coldSummaryTags)
+			init_failed = 1;
+	}
+
 	if (!init_failed && !yaffs_InitialiseBlocks(dev))
 		init_failed = 1;
 
@@ -8031,6 +8791,7 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 				dev->nFreeChunks = 0;
 				dev->allocationBlock = -1;
 				dev->allocationPage = -1;
+				dev->coldAllocationBlock = -1;
 				dev->nDeletedFiles = 0;
 				dev->nUnlinkedFiles = 0;
 				dev->nBackgroundDeletions = 0;
@@ -8070,6 +8831,8 @@ int yaffs_GutsInitialise(yaffs_Device *dev)
 	dev->nPageWrites = 0;
 	dev->nBlockErasures = 0;
 	dev->nGCCopies = 0;
+	dev->nHostWrites = 0;
+	dev->nColdBlocks = 0;
 	dev->nRetriedWrites = 0;
 
 	dev->nRetiredBlocks = 0;
@@ -8091,6 +8854,14 @@ void yaffs_Deinitialise(yaffs_Device *dev)
 {
 	if (dev->isMounted) {
 		int i;
+		struct ylist_head *lh;
+
+		/* Objects are about to be freed wholesale, drop their indexes */
+		for (i = 0; i < YAFFS_NOBJECT_BUCKETS; i++) {
+			ylist_for_each(lh, &dev->objectBucket[i].list)
+				yaffs_FreeDirIndex(ylist_entry(lh, yaffs_Object,
+							hashLink));
+		}
 
 		yaffs_DeinitialiseBlocks(dev);
 		yaffs_DeinitialiseTnodes(dev);
@@ -8106,10 +8877,21 @@ void yaffs_Deinitialise(yaffs_Device *dev)
 
 			YFREE(dev->srCache);
 			dev->srCache = NULL;
+			YFREE(dev->srCacheHash);
+			dev->srCacheHash = NULL;
+			YFREE(dev->srCacheFlush);
+			dev->srCacheFlush = NULL;
 		}
 
 		YFREE(dev->gcCleanupList);
 
+		if (dev->summaryTags)
+			YFREE(dev->summaryTags);
+		dev->summaryTags = NULL;
+		if (dev->coldSummaryTags)
+			YFREE(dev->coldSummaryTags);
+		dev->coldSummaryTags = NULL;
+
 		for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++)
 			YFREE(dev->tempBuffer[i].buffer);
 
@@ -86,8 +86,12 @@
 #define YAFFS_OBJECTID_CHECKPOINT_DATA	0x20
 #define YAFFS_SEQUENCE_CHECKPOINT_DATA  0x21
 
+/* Pseudo object id for block summary chunks */
+#define YAFFS_OBJECTID_SUMMARY		0x30
+#define YAFFS_SUMMARY_MAGIC		0x5953554D
 
-#define YAFFS_MAX_SHORT_OP_CACHES	20
+
+#define YAFFS_MAX_SHORT_OP_CACHES	256
 
 #define YAFFS_N_TEMP_BUFFERS		6
 
@@ -110,15 +114,34 @@
 /* Special sequence number for bad block that failed to be marked bad */
 #define YAFFS_SEQUENCE_BAD_BLOCK	0xFFFF0000
 
-/* ChunkCache is used for short read/write operations.*/
+/*
+ * A yaffs2 block that fills up gets a summary in its last chunk: the packed
+ * tags of every other chunk in the block, so that a scan can read one chunk
+ * per block instead of the tags of every chunk.
+ */
 typedef struct {
+	__u32 objectId;
+	__u32 chunkId;
+	__u32 byteCount;
+} yaffs_SummaryTags;
+
+typedef struct {
+	__u32 magic;
+	__u32 sequenceNumber;	/* of the block */
+	__u32 nEntries;
+	__u32 checksum;		/* of the entries */
+} yaffs_SummaryHeader;
+
+/* ChunkCache is used for short read/write operations.*/
+typedef struct yaffs_ChunkCacheStruct {
 	struct yaffs_ObjectStruct *object;
 	int chunkId;
-	int lastUse;
 	int dirty;
 	int nBytes;		/* Only valid if the cache is dirty */
 	int locked;		/* Can't push out or flush while locked. */
 	__u8 *data;
+	struct ylist_head lruLink;	/* on the LRU list, or free if no object */
+	struct yaffs_ChunkCacheStruct *hashNext;
 } yaffs_ChunkCache;
 
 
@@ -384,9 +407,20 @@ typedef struct {
 	yaffs_Tnode *top;
 } yaffs_FileStructure;
 
+/*
+ * Hash index of a large directory's children, keyed on the name sum.
+ * Built on the first lookup once the directory has enough children.
+ */
+typedef struct {
+	__u32 nBuckets;			/* power of two */
+	__u32 nEntries;
+	struct yaffs_ObjectStruct **buckets;
+} yaffs_DirIndex;
+
 typedef struct {
 	struct ylist_head children;     /* list of child links */
 	struct ylist_head dirty;	/* Entry for list of dirty directories */
+	yaffs_DirIndex *index;		/* NULL until built */
 } yaffs_DirectoryStructure;
 
 typedef struct {
@@ -441,6 +475,7 @@ struct yaffs_ObjectStruct {
 	/* also used for linking up the free list */
 	struct yaffs_ObjectStruct *parent;
 	struct ylist_head siblings;
+	struct yaffs_ObjectStruct *indexNext;	/* chain in parent's index */
 
 	/* Where's my object header in NAND? */
 	int hdrChunk;
@@ -527,6 +562,26 @@ typedef struct {
 
 /*----------------- Device ---------------------------------*/
 
+/*
+ * Device state that read-only operations update, each behind its own lock
+ * so that such operations can run alongside each other. Locks are nested
+ * in this order.
+ *
+ * YAFFS_LOCK_MAP covers where the chunks of objects are: the tnodes and
+ * the header chunks. Readers hold it shared from looking a chunk up until
+ * they are done reading it. Background gc, which runs alongside readers,
+ * holds it exclusively while it points an object at the copy of a chunk,
+ * so that no reader is left with the old chunk once that gets erased.
+ */
+typedef enum {
+	YAFFS_LOCK_INDEX,	/* building directory indexes */
+	YAFFS_LOCK_OBJECT,	/* lazy loading of object details */
+	YAFFS_LOCK_CACHE,	/* short op cache */
+	YAFFS_LOCK_MAP,		/* chunk locations, may be taken shared */
+	YAFFS_LOCK_NAND,	/* NAND access and the state it updates */
+	YAFFS_LOCK_BUFFERS	/* temporary buffers, must not sleep */
+} yaffs_LockType;
+
 
 struct yaffs_DeviceParamStruct {
 	const char *name;
@@ -548,8 +603,16 @@ struct yaffs_DeviceParamStruct {
 
 
 	int nShortOpCaches;	/* If <= 0, then short op caching is disabled, else
-				 * the number of short op caches (don't use too many).
-                                 * 10 to 20 is a good bet.
+				 * the number of short op caches, at most
+				 * YAFFS_MAX_SHORT_OP_CACHES. 10 to 20 is a good bet
+				 * for small systems.
+				 */
+	int disableSummary;	/* Don't write block summaries (yaffs2 only) */
+	int gcGreedy;		/* Pick gc victims by dirtiness alone rather
+				 * than by cost-benefit.
+				 */
+	int disableColdStream;	/* Don't keep gc copies apart from new writes
+				 * (yaffs2 only)
 				 */
 	int useNANDECC;		/* Flag to decide whether or not to use NANDECC on data (yaffs1) */
 	int noTagsECC;		/* Flag to decide whether or not to do ECC on packed tags (yaffs2) */ 
@@ -602,6 +665,22 @@ struct yaffs_DeviceParamStruct {
 	/*  Callback to control garbage collection. */
 	unsigned (*gcControl)(struct yaffs_DeviceStruct *dev);
 
+	/* Callbacks to take and release the yaffs_LockType locks. OS
+	 * flavours that run read-only operations (reading file data, looking
+	 * up names, reading symlinks) concurrently must supply these, all
+	 * others may leave them NULL. Operations that change the file system
+	 * must still be run one at a time and exclusive of any reader.
+	 */
+	void (*lock)(struct yaffs_DeviceStruct *dev, yaffs_LockType which);
+	void (*unlock)(struct yaffs_DeviceStruct *dev, yaffs_LockType which);
+	/* Same, shared with other holders. Only YAFFS_LOCK_MAP is taken
+	 * shared, if NULL it is taken exclusively instead.
+	 */
+	void (*lockShared)(struct yaffs_DeviceStruct *dev,
+				yaffs_LockType which);
+	void (*unlockShared)(struct yaffs_DeviceStruct *dev,
+				yaffs_LockType which);
+
         /* Debug control flags. Don't use unless you know what you're doing */
 	int useHeaderFileSize;	/* Flag to determine if we should use file sizes from the header */
 	int disableLazyLoad;	/* Disable lazy loading on this device */
@@ -684,6 +763,16 @@ struct yaffs_DeviceStruct {
 	__u32 allocationPage;
 	int allocationBlockFinder;	/* Used to search for next allocation block */
 
+	/* The cold stream takes gc copies so that long lived data is not
+	 * mixed back in with new writes. While gc is copying the two streams
+	 * are swapped, see yaffs_BeginColdWrites().
+	 */
+	int coldAllocationBlock;
+	__u32 coldAllocationPage;
+	int coldSummaryValid;
+	yaffs_SummaryTags *coldSummaryTags;
+	int writingCold;
+
 	int nTnodesCreated;
 	yaffs_Tnode *freeTnodes;
 	int nFreeTnodes;
@@ -704,12 +793,18 @@ struct yaffs_DeviceStruct {
 
 	/* Garbage collection control */
 	__u32 *gcCleanupList;	/* objects to delete at the end of a GC. */
+	int nGCCleanups;	/* entries in gcCleanupList */
+	int gcShared;		/* gc runs alongside readers, see
+				 * yaffs_BackgroundGarbageCollect()
+				 */
 
 	unsigned hasPendingPrioritisedGCs; /* We think this device might have pending prioritised gcs */
 	unsigned gcDisable;
 	unsigned gcBlockFinder;
 	unsigned gcDirtiest;
 	unsigned gcPagesInUse;
+	__u32 gcDirtiestScore;
+	unsigned gcCopying;	/* Writes are gc copies, not host writes */
 	unsigned gcNotDone;
 	unsigned gcBlock;
 	unsigned gcChunk;
@@ -728,7 +823,16 @@ struct yaffs_DeviceStruct {
 	int doingBufferedBlockRewrite;
 
 	yaffs_ChunkCache *srCache;
-	int srLastUse;
+	yaffs_ChunkCache **srCacheHash;
+	__u32 srCacheHashMask;
+	yaffs_ChunkCache **srCacheFlush;	/* scratch for flushing in order */
+	struct ylist_head srCacheLru;	/* entries in use, most recent first */
+	struct ylist_head srCacheFree;
+
+	/* Block summary of the block being allocated from */
+	int chunksPerSummary;	/* chunks covered, 0 if no summaries */
+	int summaryValid;	/* every chunk so far has an entry */
+	yaffs_SummaryTags *summaryTags;
 
 	/* Stuff for background deletion and unlinked files.*/
 	yaffs_Object *unlinkedDir;	/* Directory where unlinked and deleted files live. */
@@ -763,6 +867,8 @@ struct yaffs_DeviceStruct {
 	__u32 nBlockErasures;
 	__u32 nErasureFailures;
 	__u32 nGCCopies;
+	__u32 nHostWrites;	/* chunks written other than by gc copying */
+	__u32 nColdBlocks;	/* blocks opened by the cold stream */
 	__u32 allGCs;
 	__u32 passiveGCs;
 	__u32 oldestDirtyGCs;
@@ -776,12 +882,46 @@ struct yaffs_DeviceStruct {
 	__u32 nDeletions;
 	__u32 nUnmarkedDeletions;
 	__u32 refreshCount;
+	__u32 summaryWrites;
+	__u32 summaryScans;
 	__u32 cacheHits;
+	__u32 cacheMisses;
+	__u32 nDirIndexes;
+	__u32 dirIndexBytes;
 
 };
 
 typedef struct yaffs_DeviceStruct yaffs_Device;
 
+static Y_INLINE void yaffs_Lock(yaffs_Device *dev, yaffs_LockType which)
+{
+	if (dev->param.lock)
+		dev->param.lock(dev, which);
+}
+
+static Y_INLINE void yaffs_Unlock(yaffs_Device *dev, yaffs_LockType which)
+{
+	if (dev->param.unlock)
+		dev->param.unlock(dev, which);
+}
+
+static Y_INLINE void yaffs_LockShared(yaffs_Device *dev, yaffs_LockType which)
+{
+	if (dev->param.lockShared)
+		dev->param.lockShared(dev, which);
+	else
+		yaffs_Lock(dev, which);
+}
+
+static Y_INLINE void yaffs_UnlockShared(yaffs_Device *dev,
+					yaffs_LockType which)
+{
+	if (dev->param.unlockShared)
+		dev->param.unlockShared(dev, which);
+	else
+		yaffs_Unlock(dev, which);
+}
+
 /* The static layout of block usage etc is stored in the super block header */
 typedef struct {
 	int StructType;
@@ -899,7 +1039,13 @@ void yaffs_HandleDeferedFree(yaffs_Object *obj);
 
 void yaffs_UpdateDirtyDirectories(yaffs_Device *dev);
 
+/*
+ * Background gc only excludes other changes to the file system, readers
+ * may run alongside it. Objects it finishes deleting are only freed by
+ * yaffs_FinishGarbageCollection(), which needs the device to itself.
+ */
 int yaffs_BackgroundGarbageCollect(yaffs_Device *dev, unsigned urgency);
+void yaffs_FinishGarbageCollection(yaffs_Device *dev);
 
 /* Debug dump  */
 int yaffs_DumpObject(yaffs_Object *obj);
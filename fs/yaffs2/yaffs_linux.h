@@ -16,6 +16,10 @@
 #ifndef __YAFFS_LINUX_H__
 #define __YAFFS_LINUX_H__
 
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/spinlock.h>
+
 #include "devextras.h"
 #include "yportenv.h"
 
@@ -25,7 +29,24 @@ struct yaffs_LinuxContext {
 	struct super_block * superBlock;
 	struct task_struct *bgThread; /* Background thread for this device */
 	int bgRunning;
-        struct semaphore grossLock;     /* Gross locking semaphore */
+	/*
+	 * Held for reading by operations that only read (file data, name
+	 * lookup, symlinks, inode fill) and by background gc, and for
+	 * writing by everything else. Readers serialise the few things they
+	 * update on the locks below, see yaffs_LockType.
+	 */
+	struct rw_semaphore grossLock;
+	struct mutex indexLock;
+	struct mutex objectLock;
+	struct mutex cacheLock;
+	struct rw_semaphore mapLock;
+	struct mutex nandLock;
+	spinlock_t bufferLock;
+	/*
+	 * Chunk allocation and gc, when grossLock is only held for reading.
+	 * Taken after grossLock, before the yaffs_LockType locks.
+	 */
+	struct mutex gcLock;
 	__u8 *spareBuffer;      /* For mtdif2 use. Don't know the size of the buffer
 				 * at compile time so we have to allocate it.
 				 */
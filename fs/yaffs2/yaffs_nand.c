@@ -26,6 +26,8 @@ int yaffs_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 
 	int realignedChunkInNAND = chunkInNAND - dev->chunkOffset;
 
+	yaffs_Lock(dev, YAFFS_LOCK_NAND);
+
 	dev->nPageReads++;
 
 	/* If there are no tags provided, use local tags to get prioritised gc working */
@@ -48,6 +50,8 @@ int yaffs_ReadChunkWithTagsFromNAND(yaffs_Device *dev, int chunkInNAND,
 		yaffs_HandleChunkError(dev, bi);
 	}
 
+	yaffs_Unlock(dev, YAFFS_LOCK_NAND);
+
 	return result;
 }
 
@@ -56,6 +60,10 @@ int yaffs_WriteChunkWithTagsToNAND(yaffs_Device *dev,
 						   const __u8 *buffer,
 						   yaffs_ExtendedTags *tags)
 {
+	int result;
+
+	/* Background gc writes while readers read */
+	yaffs_Lock(dev, YAFFS_LOCK_NAND);
 
 	dev->nPageWrites++;
 
@@ -79,24 +87,35 @@ int yaffs_WriteChunkWithTagsToNAND(yaffs_Device *dev,
 	}
 
 	if (dev->param.writeChunkWithTagsToNAND)
-		return dev->param.writeChunkWithTagsToNAND(dev, chunkInNAND, buffer,
+		result = dev->param.writeChunkWithTagsToNAND(dev, chunkInNAND, buffer,
 						     tags);
 	else
-		return yaffs_TagsCompatabilityWriteChunkWithTagsToNAND(dev,
+		result = yaffs_TagsCompatabilityWriteChunkWithTagsToNAND(dev,
 								       chunkInNAND,
 								       buffer,
 								       tags);
+
+	yaffs_Unlock(dev, YAFFS_LOCK_NAND);
+
+	return result;
 }
 
 int yaffs_MarkBlockBad(yaffs_Device *dev, int blockNo)
 {
+	int result;
+
 	blockNo -= dev->blockOffset;
 
+	yaffs_Lock(dev, YAFFS_LOCK_NAND);
 
 	if (dev->param.markNANDBlockBad)
-		return dev->param.markNANDBlockBad(dev, blockNo);
+		result = dev->param.markNANDBlockBad(dev, blockNo);
 	else
-		return yaffs_TagsCompatabilityMarkNANDBlockBad(dev, blockNo);
+		result = yaffs_TagsCompatabilityMarkNANDBlockBad(dev, blockNo);
+
+	yaffs_Unlock(dev, YAFFS_LOCK_NAND);
+
+	return result;
 }
 
 int yaffs_QueryInitialBlockState(yaffs_Device *dev,
@@ -122,10 +141,14 @@ int yaffs_EraseBlockInNAND(struct yaffs_DeviceStruct *dev,
 
 	blockInNAND -= dev->blockOffset;
 
+	yaffs_Lock(dev, YAFFS_LOCK_NAND);
+
 	dev->nBlockErasures++;
 
 	result = dev->param.eraseBlockInNAND(dev, blockInNAND);
 
+	yaffs_Unlock(dev, YAFFS_LOCK_NAND);
+
 	return result;
 }
 
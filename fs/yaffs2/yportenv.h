@@ -73,6 +73,8 @@
 
 #define YYIELD() schedule()
 #define Y_DUMP_STACK() dump_stack()
+#define Y_READ_BARRIER() smp_rmb()
+#define Y_WRITE_BARRIER() smp_wmb()
 
 #define YAFFS_ROOT_MODE			0755
 #define YAFFS_LOSTNFOUND_MODE		0700
@@ -157,6 +159,14 @@
 #define Y_DUMP_STACK() do { } while (0)
 #endif
 
+#ifndef Y_READ_BARRIER
+#define Y_READ_BARRIER() do { } while (0)
+#endif
+
+#ifndef Y_WRITE_BARRIER
+#define Y_WRITE_BARRIER() do { } while (0)
+#endif
+
 #ifndef YBUG
 #define YBUG() do {\
 	T(YAFFS_TRACE_BUG,\
@@ -0,0 +1,92 @@
+/* include/linux/hotplug_policy.h
+ *
+ * CPU hotplug decision from a window of load and run-queue samples.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Nothing here depends on a particular SoC or on the running system, so
+ * the policy can be fed made-up samples on any machine, as
+ * lib/hotplug_policy_test.c does.
+ */
+
+#ifndef _LINUX_HOTPLUG_POLICY_H
+#define _LINUX_HOTPLUG_POLICY_H
+
+#include <linux/kernel.h>
+
+/* Most load samples kept per CPU */
+#define HOTPLUG_HISTORY_MAX	16
+
+/*
+ * Tunables. Decisions are taken on the average load and run-queue depth
+ * over the last 'window' samples. A CPU is taken online when the load is
+ * above 'load_h', or at once when the number of runnable tasks exceeds
+ * the online CPUs by 'nr_run_fast'. It is taken offline when the load is
+ * below 'load_l' and the online CPUs outnumber the runnable tasks, but
+ * not sooner than 'down_delay' ms after the last hotplug. At or below
+ * 'low_freq' one CPU is deemed enough whatever the load.
+ */
+struct hotplug_tunables {
+	unsigned int window;		/* samples */
+	unsigned int load_l;		/* % */
+	unsigned int load_h;		/* % */
+	unsigned int nr_run_fast;	/* tasks */
+	unsigned int down_delay;	/* ms */
+	unsigned int low_freq;		/* kHz */
+};
+
+/* What the decision is taken on, averaged over the sample window */
+struct hotplug_stats {
+	unsigned int online;		/* online CPUs */
+	unsigned int possible;		/* CPUs that can be online */
+	unsigned int samples;		/* samples in the window */
+	unsigned int load;		/* average load of the online CPUs */
+	unsigned int nr_run;		/* average runnable tasks, x100 */
+	unsigned int nr_run_now;	/* runnable tasks at the last sample */
+	unsigned int freq;		/* kHz */
+	unsigned int since_change;	/* ms since the last hotplug */
+};
+
+enum hotplug_action {
+	HOTPLUG_NOP,
+	HOTPLUG_IN,
+	HOTPLUG_OUT,
+};
+
+static inline enum hotplug_action
+hotplug_decide(const struct hotplug_stats *st,
+	       const struct hotplug_tunables *t)
+{
+	unsigned int window = clamp_t(unsigned int, t->window, 1,
+				      HOTPLUG_HISTORY_MAX);
+
+	if (st->online < st->possible && st->freq > t->low_freq) {
+		/* Tasks are queueing up: don't wait for the load to show. */
+		if (st->nr_run_now >= st->online + t->nr_run_fast)
+			return HOTPLUG_IN;
+
+		if (st->samples >= window && st->load > t->load_h)
+			return HOTPLUG_IN;
+	}
+
+	if (st->online > 1 && st->samples >= window &&
+	    st->since_change >= t->down_delay) {
+		/*
+		 * The window of samples is what keeps bursty loads from
+		 * flipping a CPU on and off, taking one offline while
+		 * there are still more tasks than CPUs to run them would
+		 * only bring it back at the next sample.
+		 */
+		if (st->freq <= t->low_freq)
+			return HOTPLUG_OUT;
+
+		if (st->load < t->load_l && st->nr_run < st->online * 100)
+			return HOTPLUG_OUT;
+	}
+
+	return HOTPLUG_NOP;
+}
+
+#endif /* _LINUX_HOTPLUG_POLICY_H */
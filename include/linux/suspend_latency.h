@@ -0,0 +1,46 @@
+#ifndef _LINUX_SUSPEND_LATENCY_H
+#define _LINUX_SUSPEND_LATENCY_H
+
+#include <linux/types.h>
+
+/*
+ * Suspend/resume latency records, read from debugfs suspend_latency as an
+ * array of struct pm_latency_record, oldest first. See
+ * tools/power/suspend-latency.c for a parser.
+ */
+enum pm_latency_type {
+	PM_LATENCY_DEVICE,		/* callbacks of a device, @event is the
+					 * PM_EVENT_* of the transition */
+	PM_LATENCY_DEVICE_NOIRQ,	/* noirq callbacks of a device */
+	PM_LATENCY_SUSPEND_ENTER,	/* suspend_enter(), the time spent
+					 * asleep is not counted */
+	PM_LATENCY_WAKE_LOCK,		/* a wake lock blocked suspend, for
+					 * how long it had been held */
+};
+
+#define PM_LATENCY_NAME_LEN	32
+
+struct pm_latency_record {
+	__u64	time_ns;	/* end of the event, CLOCK_MONOTONIC */
+	__u64	duration_ns;
+	__u32	type;
+	__u32	event;
+	__s32	error;
+	__u32	reserved;
+	char	name[PM_LATENCY_NAME_LEN];	/* NUL padded, may be cut
+						 * off without a NUL */
+};
+
+#ifdef __KERNEL__
+#include <linux/ktime.h>
+
+#ifdef CONFIG_PM_SUSPEND_LATENCY
+extern void pm_latency_record(int type, int event, const char *name,
+			      ktime_t start, int error);
+#else
+static inline void pm_latency_record(int type, int event, const char *name,
+				     ktime_t start, int error) {}
+#endif
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_SUSPEND_LATENCY_H */
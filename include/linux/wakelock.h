@@ -17,6 +17,7 @@
 #define _LINUX_WAKELOCK_H
 
 #include <linux/list.h>
+#include <linux/rbtree.h>
 #include <linux/ktime.h>
 
 /* A wake_lock prevents the system from entering suspend or other low power
@@ -35,6 +36,7 @@ enum {
 struct wake_lock {
 #ifdef CONFIG_HAS_WAKELOCK
 	struct list_head    link;
+	struct rb_node      expire_node;
 	int                 flags;
 	const char         *name;
 	unsigned long       expires;
@@ -52,6 +54,27 @@ struct wake_lock {
 #endif
 };
 
+/* Layout of /proc/wakelocks_bin, one fixed size record per wake lock with
+ * the same fields as /proc/wakelocks. Times are in nanoseconds. A read at
+ * offset 0 takes a fresh snapshot of all locks, so a reader polling the
+ * stats can keep the file open and use pread().
+ */
+#define WAKE_LOCK_STAT_NAME_LEN 40
+
+struct wake_lock_stat_record {
+	char                name[WAKE_LOCK_STAT_NAME_LEN]; /* may be cut off,
+							    * NUL padded */
+	__u32               count;
+	__u32               expire_count;
+	__u32               wakeup_count;
+	__u32               active;
+	__s64               active_time;
+	__s64               total_time;
+	__s64               sleep_time;
+	__s64               max_time;
+	__s64               last_change;
+};
+
 #ifdef CONFIG_HAS_WAKELOCK
 
 void wake_lock_init(struct wake_lock *lock, int type, const char *name);
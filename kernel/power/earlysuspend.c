@@ -13,10 +13,14 @@
  *
  */
 
+#include <linux/async.h>
+#include <linux/debugfs.h>
 #include <linux/earlysuspend.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/rtc.h>
+#include <linux/seq_file.h>
 #include <linux/syscalls.h> /* sys_sync */
 #include <linux/wakelock.h>
 #include <linux/workqueue.h>
@@ -30,6 +34,10 @@ enum {
 static int debug_mask = DEBUG_USER_STATE;
 module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
+/* Run the handlers of one level concurrently */
+static int parallel = 1;
+module_param(parallel, int, S_IRUGO | S_IWUSR | S_IWGRP);
+
 static DEFINE_MUTEX(early_suspend_lock);
 static LIST_HEAD(early_suspend_handlers);
 static void early_suspend(struct work_struct *work);
@@ -44,6 +52,51 @@ enum {
 };
 static int state;
 
+static LIST_HEAD(early_suspend_domain);
+static s64 early_suspend_ns;	/* last pass over all handlers */
+static s64 late_resume_ns;
+
+static void call_suspend(void *data, async_cookie_t cookie)
+{
+	struct early_suspend *h = data;
+	ktime_t start = ktime_get();
+
+	h->suspend(h);
+	h->suspend_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (h->suspend_ns > h->max_suspend_ns)
+		h->max_suspend_ns = h->suspend_ns;
+}
+
+static void call_resume(void *data, async_cookie_t cookie)
+{
+	struct early_suspend *h = data;
+	ktime_t start = ktime_get();
+
+	h->resume(h);
+	h->resume_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (h->resume_ns > h->max_resume_ns)
+		h->max_resume_ns = h->resume_ns;
+}
+
+/*
+ * Levels are still handled one after the other, but the handlers of a
+ * level are scheduled on early_suspend_domain together, so the level
+ * takes as long as its slowest handler rather than the sum of them.
+ * Caller must hold early_suspend_lock.
+ */
+static void schedule_handler(struct early_suspend *h, async_func_ptr *func,
+			     struct early_suspend **prev)
+{
+	if (*prev && (*prev)->level != h->level)
+		async_synchronize_full_domain(&early_suspend_domain);
+	*prev = h;
+
+	if (parallel)
+		async_schedule_domain(func, h, &early_suspend_domain);
+	else
+		func(h, 0);
+}
+
 void register_early_suspend(struct early_suspend *handler)
 {
 	struct list_head *pos;
@@ -72,7 +125,8 @@ EXPORT_SYMBOL(unregister_early_suspend);
 
 static void early_suspend(struct work_struct *work)
 {
-	struct early_suspend *pos;
+	struct early_suspend *pos, *prev = NULL;
+	ktime_t start;
 	unsigned long irqflags;
 	int abort = 0;
 
@@ -93,10 +147,13 @@ static void early_suspend(struct work_struct *work)
 
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("early_suspend: call handlers\n");
+	start = ktime_get();
 	list_for_each_entry(pos, &early_suspend_handlers, link) {
 		if (pos->suspend != NULL)
-			pos->suspend(pos);
+			schedule_handler(pos, call_suspend, &prev);
 	}
+	async_synchronize_full_domain(&early_suspend_domain);
+	early_suspend_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
 	mutex_unlock(&early_suspend_lock);
 
 	if (debug_mask & DEBUG_SUSPEND)
@@ -112,7 +169,8 @@ abort:
 
 static void late_resume(struct work_struct *work)
 {
-	struct early_suspend *pos;
+	struct early_suspend *pos, *prev = NULL;
+	ktime_t start;
 	unsigned long irqflags;
 	int abort = 0;
 
@@ -131,9 +189,12 @@ static void late_resume(struct work_struct *work)
 	}
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: call handlers\n");
+	start = ktime_get();
 	list_for_each_entry_reverse(pos, &early_suspend_handlers, link)
 		if (pos->resume != NULL)
-			pos->resume(pos);
+			schedule_handler(pos, call_resume, &prev);
+	async_synchronize_full_domain(&early_suspend_domain);
+	late_resume_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: done\n");
 abort:
@@ -176,3 +237,45 @@ suspend_state_t get_suspend_state(void)
 {
 	return requested_suspend_state;
 }
+
+#ifdef CONFIG_DEBUG_FS
+static int early_suspend_stats_show(struct seq_file *m, void *unused)
+{
+	struct early_suspend *pos;
+
+	mutex_lock(&early_suspend_lock);
+	seq_printf(m, "early_suspend %lld ns, late_resume %lld ns\n",
+		   early_suspend_ns, late_resume_ns);
+	seq_puts(m, "level\tsuspend_ns\tmax_suspend_ns\tresume_ns"
+		 "\tmax_resume_ns\thandler\n");
+	list_for_each_entry(pos, &early_suspend_handlers, link)
+		seq_printf(m, "%d\t%lld\t%lld\t%lld\t%lld\t%pf\n",
+			   pos->level, pos->suspend_ns, pos->max_suspend_ns,
+			   pos->resume_ns, pos->max_resume_ns,
+			   pos->suspend ? (void *)pos->suspend :
+					  (void *)pos->resume);
+	mutex_unlock(&early_suspend_lock);
+	return 0;
+}
+
+static int early_suspend_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, early_suspend_stats_show, NULL);
+}
+
+static const struct file_operations early_suspend_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = early_suspend_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init early_suspend_debugfs_init(void)
+{
+	debugfs_create_file("early_suspend_stats", S_IRUGO, NULL, NULL,
+			    &early_suspend_stats_fops);
+	return 0;
+}
+late_initcall(early_suspend_debugfs_init);
+#endif
@@ -22,6 +22,7 @@
 #include <linux/mm.h>
 #include <linux/slab.h>
 #include <linux/suspend.h>
+#include <linux/suspend_latency.h>
 
 #include "power.h"
 
@@ -199,8 +200,9 @@ static int suspend_enter(suspend_state_t state)
  */
 int suspend_devices_and_enter(suspend_state_t state)
 {
-	int error;
+	int error, enter_error;
 	gfp_t saved_mask;
+	ktime_t starttime;
 
 	if (!suspend_ops)
 		return -ENOSYS;
@@ -222,7 +224,10 @@ int suspend_devices_and_enter(suspend_state_t state)
 	if (suspend_test(TEST_DEVICES))
 		goto Recover_platform;
 
-	suspend_enter(state);
+	starttime = ktime_get();
+	enter_error = suspend_enter(state);
+	pm_latency_record(PM_LATENCY_SUSPEND_ENTER, PM_EVENT_SUSPEND,
+			  "suspend_enter", starttime, enter_error);
 
  Resume_devices:
 	suspend_test_start();
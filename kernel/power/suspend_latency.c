@@ -0,0 +1,126 @@
+/*
+ * kernel/power/suspend_latency.c - Ring buffer of suspend/resume latencies.
+ *
+ * This file is released under the GPLv2.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/hrtimer.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/suspend_latency.h>
+#include <linux/vmalloc.h>
+
+#define PM_LATENCY_RECORDS	CONFIG_PM_SUSPEND_LATENCY_RECORDS
+
+static struct pm_latency_record records[PM_LATENCY_RECORDS];
+static unsigned int next_record;	/* oldest one once the ring is full */
+static unsigned int nr_records;
+static DEFINE_SPINLOCK(records_lock);
+
+/*
+ * Record an event that started at @start and ends now. Called from device
+ * callbacks that may run concurrently and with interrupts disabled.
+ */
+void pm_latency_record(int type, int event, const char *name,
+		       ktime_t start, int error)
+{
+	struct pm_latency_record *r;
+	unsigned long flags;
+	ktime_t now = ktime_get();
+
+	spin_lock_irqsave(&records_lock, flags);
+	r = &records[next_record];
+	next_record = (next_record + 1) % PM_LATENCY_RECORDS;
+	if (nr_records < PM_LATENCY_RECORDS)
+		nr_records++;
+
+	r->time_ns = ktime_to_ns(now);
+	r->duration_ns = ktime_to_ns(ktime_sub(now, start));
+	r->type = type;
+	r->event = event;
+	r->error = error;
+	r->reserved = 0;
+	strncpy(r->name, name, sizeof(r->name));
+	spin_unlock_irqrestore(&records_lock, flags);
+}
+
+struct pm_latency_snapshot {
+	size_t size;
+	struct pm_latency_record records[0];
+};
+
+/*
+ * Each open takes a snapshot of the ring, in chronological order, that
+ * reads are served from.
+ */
+static int suspend_latency_open(struct inode *inode, struct file *file)
+{
+	struct pm_latency_snapshot *s;
+	unsigned long flags;
+	unsigned int i, first;
+
+	s = vmalloc(sizeof(*s) + sizeof(records));
+	if (!s)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&records_lock, flags);
+	first = (next_record + PM_LATENCY_RECORDS - nr_records) %
+		PM_LATENCY_RECORDS;
+	for (i = 0; i < nr_records; i++)
+		s->records[i] = records[(first + i) % PM_LATENCY_RECORDS];
+	s->size = nr_records * sizeof(records[0]);
+	spin_unlock_irqrestore(&records_lock, flags);
+
+	file->private_data = s;
+	return 0;
+}
+
+static ssize_t suspend_latency_read(struct file *file, char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	struct pm_latency_snapshot *s = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, s->records, s->size);
+}
+
+/* Writing anything clears the ring */
+static ssize_t suspend_latency_write(struct file *file,
+				     const char __user *buf, size_t count,
+				     loff_t *ppos)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&records_lock, flags);
+	next_record = 0;
+	nr_records = 0;
+	spin_unlock_irqrestore(&records_lock, flags);
+
+	return count;
+}
+
+static int suspend_latency_release(struct inode *inode, struct file *file)
+{
+	vfree(file->private_data);
+	return 0;
+}
+
+static const struct file_operations suspend_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = suspend_latency_open,
+	.read = suspend_latency_read,
+	.write = suspend_latency_write,
+	.llseek = default_llseek,
+	.release = suspend_latency_release,
+};
+
+static int __init suspend_latency_init(void)
+{
+	debugfs_create_file("suspend_latency", S_IRUSR | S_IWUSR, NULL, NULL,
+			    &suspend_latency_fops);
+	return 0;
+}
+late_initcall(suspend_latency_init);
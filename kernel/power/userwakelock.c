@@ -17,6 +17,7 @@
 #include <linux/module.h>
 #include <linux/wakelock.h>
 #include <linux/slab.h>
+#include <linux/jhash.h>
 
 #include "power.h"
 
@@ -30,22 +31,57 @@ enum {
 static int debug_mask = DEBUG_FAILURE;
 module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
-static DEFINE_MUTEX(tree_lock);
+/*
+ * Userspace wake locks are never destroyed by userspace, so their number
+ * is capped. Beyond it the least recently used lock that is not held is
+ * freed to make room.
+ */
+static int max_user_wake_locks = 256;
+module_param_named(max_user_wake_locks, max_user_wake_locks, int,
+		   S_IRUGO | S_IWUSR | S_IWGRP);
+
+#define USER_WAKE_LOCK_HASH_BITS	6
+#define USER_WAKE_LOCK_HASH_SIZE	(1 << USER_WAKE_LOCK_HASH_BITS)
+
+static DEFINE_MUTEX(user_wake_locks_lock);
 
 struct user_wake_lock {
-	struct rb_node		node;
+	struct hlist_node	hash_node;
+	struct list_head	lru;
 	struct wake_lock	wake_lock;
 	char			name[0];
 };
-struct rb_root user_wake_locks;
+static struct hlist_head user_wake_lock_hash[USER_WAKE_LOCK_HASH_SIZE];
+static LIST_HEAD(user_wake_lock_lru);	/* most recently used first */
+static int user_wake_lock_count;
+
+/* Caller must hold user_wake_locks_lock */
+static int gc_user_wake_lock(void)
+{
+	struct user_wake_lock *l;
+
+	list_for_each_entry_reverse(l, &user_wake_lock_lru, lru) {
+		if (wake_lock_active(&l->wake_lock))
+			continue;
+		if (debug_mask & DEBUG_NEW)
+			pr_info("gc_user_wake_lock: free %s\n", l->name);
+		/* Its stats are kept in deleted_wake_locks */
+		wake_lock_destroy(&l->wake_lock);
+		hlist_del(&l->hash_node);
+		list_del(&l->lru);
+		kfree(l);
+		user_wake_lock_count--;
+		return 1;
+	}
+	return 0;
+}
 
 static struct user_wake_lock *lookup_wake_lock_name(
 	const char *buf, int allocate, long *timeoutptr)
 {
-	struct rb_node **p = &user_wake_locks.rb_node;
-	struct rb_node *parent = NULL;
+	struct hlist_head *bucket;
+	struct hlist_node *pos;
 	struct user_wake_lock *l;
-	int diff;
 	u64 timeout;
 	int name_len;
 	const char *arg;
@@ -78,32 +114,34 @@ static struct user_wake_lock *lookup_wake_lock_name(
 	else if (timeoutptr)
 		*timeoutptr = 0;
 
-	/* Lookup wake lock in rbtree */
-	while (*p) {
-		parent = *p;
-		l = rb_entry(parent, struct user_wake_lock, node);
-		diff = strncmp(buf, l->name, name_len);
-		if (!diff && l->name[name_len])
-			diff = -1;
-		if (debug_mask & DEBUG_ERROR)
-			pr_info("lookup_wake_lock_name: compare %.*s %s %d\n",
-				name_len, buf, l->name, diff);
-
-		if (diff < 0)
-			p = &(*p)->rb_left;
-		else if (diff > 0)
-			p = &(*p)->rb_right;
-		else
+	/* Lookup wake lock in hash table */
+	bucket = &user_wake_lock_hash[jhash(buf, name_len, 0) &
+				      (USER_WAKE_LOCK_HASH_SIZE - 1)];
+	hlist_for_each_entry(l, pos, bucket, hash_node) {
+		if (debug_mask & DEBUG_LOOKUP)
+			pr_info("lookup_wake_lock_name: compare %.*s %s\n",
+				name_len, buf, l->name);
+		if (!strncmp(buf, l->name, name_len) && !l->name[name_len]) {
+			list_move(&l->lru, &user_wake_lock_lru);
 			return l;
+		}
 	}
 
-	/* Allocate and add new wakelock to rbtree */
+	/* Allocate and add new wakelock to hash table */
 	if (!allocate) {
 		if (debug_mask & DEBUG_ERROR)
 			pr_info("lookup_wake_lock_name: %.*s not found\n",
 				name_len, buf);
 		return ERR_PTR(-EINVAL);
 	}
+	if (user_wake_lock_count >= max_user_wake_locks &&
+	    !gc_user_wake_lock()) {
+		if (debug_mask & DEBUG_FAILURE)
+			pr_err("lookup_wake_lock_name: %d wake locks held, "
+				"cannot add %.*s\n", user_wake_lock_count,
+				name_len, buf);
+		return ERR_PTR(-ENOSPC);
+	}
 	l = kzalloc(sizeof(*l) + name_len + 1, GFP_KERNEL);
 	if (l == NULL) {
 		if (debug_mask & DEBUG_FAILURE)
@@ -115,8 +153,9 @@ static struct user_wake_lock *lookup_wake_lock_name(
 	if (debug_mask & DEBUG_NEW)
 		pr_info("lookup_wake_lock_name: new wake lock %s\n", l->name);
 	wake_lock_init(&l->wake_lock, WAKE_LOCK_SUSPEND, l->name);
-	rb_link_node(&l->node, parent, p);
-	rb_insert_color(&l->node, &user_wake_locks);
+	hlist_add_head(&l->hash_node, bucket);
+	list_add(&l->lru, &user_wake_lock_lru);
+	user_wake_lock_count++;
 	return l;
 
 bad_arg:
@@ -131,19 +170,17 @@ ssize_t wake_lock_show(
 {
 	char *s = buf;
 	char *end = buf + PAGE_SIZE;
-	struct rb_node *n;
 	struct user_wake_lock *l;
 
-	mutex_lock(&tree_lock);
+	mutex_lock(&user_wake_locks_lock);
 
-	for (n = rb_first(&user_wake_locks); n != NULL; n = rb_next(n)) {
-		l = rb_entry(n, struct user_wake_lock, node);
+	list_for_each_entry(l, &user_wake_lock_lru, lru) {
 		if (wake_lock_active(&l->wake_lock))
 			s += scnprintf(s, end - s, "%s ", l->name);
 	}
 	s += scnprintf(s, end - s, "\n");
 
-	mutex_unlock(&tree_lock);
+	mutex_unlock(&user_wake_locks_lock);
 	return (s - buf);
 }
 
@@ -154,7 +191,7 @@ ssize_t wake_lock_store(
 	long timeout;
 	struct user_wake_lock *l;
 
-	mutex_lock(&tree_lock);
+	mutex_lock(&user_wake_locks_lock);
 	l = lookup_wake_lock_name(buf, 1, &timeout);
 	if (IS_ERR(l)) {
 		n = PTR_ERR(l);
@@ -169,7 +206,7 @@ ssize_t wake_lock_store(
 	else
 		wake_lock(&l->wake_lock);
 bad_name:
-	mutex_unlock(&tree_lock);
+	mutex_unlock(&user_wake_locks_lock);
 	return n;
 }
 
@@ -179,19 +216,17 @@ ssize_t wake_unlock_show(
 {
 	char *s = buf;
 	char *end = buf + PAGE_SIZE;
-	struct rb_node *n;
 	struct user_wake_lock *l;
 
-	mutex_lock(&tree_lock);
+	mutex_lock(&user_wake_locks_lock);
 
-	for (n = rb_first(&user_wake_locks); n != NULL; n = rb_next(n)) {
-		l = rb_entry(n, struct user_wake_lock, node);
+	list_for_each_entry(l, &user_wake_lock_lru, lru) {
 		if (!wake_lock_active(&l->wake_lock))
 			s += scnprintf(s, end - s, "%s ", l->name);
 	}
 	s += scnprintf(s, end - s, "\n");
 
-	mutex_unlock(&tree_lock);
+	mutex_unlock(&user_wake_locks_lock);
 	return (s - buf);
 }
 
@@ -201,7 +236,7 @@ ssize_t wake_unlock_store(
 {
 	struct user_wake_lock *l;
 
-	mutex_lock(&tree_lock);
+	mutex_lock(&user_wake_locks_lock);
 	l = lookup_wake_lock_name(buf, 0, NULL);
 	if (IS_ERR(l)) {
 		n = PTR_ERR(l);
@@ -213,7 +248,7 @@ ssize_t wake_unlock_store(
 
 	wake_unlock(&l->wake_lock);
 not_found:
-	mutex_unlock(&tree_lock);
+	mutex_unlock(&user_wake_locks_lock);
 	return n;
 }
 
@@ -17,6 +17,7 @@
 #include <linux/platform_device.h>
 #include <linux/rtc.h>
 #include <linux/suspend.h>
+#include <linux/suspend_latency.h>
 #include <linux/syscalls.h> /* sys_sync */
 #include <linux/wakelock.h>
 #ifdef CONFIG_WAKELOCK_STAT
@@ -40,9 +41,23 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 #define WAKE_LOCK_AUTO_EXPIRE            (1U << 10)
 #define WAKE_LOCK_PREVENTING_SUSPEND     (1U << 11)
 
+/*
+ * Active locks of one type. Locks without a timeout are only counted,
+ * locks with one are also kept in a tree ordered by expiry with its
+ * first and last nodes cached, so that deciding whether a type is held
+ * and for how long never walks the locks.
+ */
+struct wake_lock_set {
+	struct list_head locks;
+	int untimed;
+	struct rb_root timed;
+	struct rb_node *first;
+	struct rb_node *last;
+};
+
 static DEFINE_SPINLOCK(list_lock);
 static LIST_HEAD(inactive_locks);
-static struct list_head active_wake_locks[WAKE_LOCK_TYPE_COUNT];
+static struct wake_lock_set active_wake_locks[WAKE_LOCK_TYPE_COUNT];
 static int current_event_num;
 struct workqueue_struct *suspend_work_queue;
 struct wake_lock main_wake_lock;
@@ -81,7 +96,9 @@ int get_expired_time(struct wake_lock *lock, ktime_t *expire_time)
 }
 
 
-static int print_lock_stat(struct seq_file *m, struct wake_lock *lock)
+/* Caller must acquire the list_lock spinlock */
+static void get_lock_stat(struct wake_lock *lock,
+			  struct wake_lock_stat_record *r)
 {
 	int lock_count = lock->stat.count;
 	int expire_count = lock->stat.expire_count;
@@ -109,13 +126,37 @@ static int print_lock_stat(struct seq_file *m, struct wake_lock *lock)
 			max_time = add_time;
 	}
 
+	r->count = lock_count;
+	r->expire_count = expire_count;
+	r->wakeup_count = lock->stat.wakeup_count;
+	r->active = !!(lock->flags & WAKE_LOCK_ACTIVE);
+	r->active_time = ktime_to_ns(active_time);
+	r->total_time = ktime_to_ns(total_time);
+	r->sleep_time = ktime_to_ns(prevent_suspend_time);
+	r->max_time = ktime_to_ns(max_time);
+	r->last_change = ktime_to_ns(lock->stat.last_time);
+}
+
+static int print_lock_stat(struct seq_file *m, struct wake_lock *lock)
+{
+	struct wake_lock_stat_record r;
+
+	get_lock_stat(lock, &r);
 	return seq_printf(m,
 		     "\"%s\"\t%d\t%d\t%d\t%lld\t%lld\t%lld\t%lld\t%lld\n",
-		     lock->name, lock_count, expire_count,
-		     lock->stat.wakeup_count, ktime_to_ns(active_time),
-		     ktime_to_ns(total_time),
-		     ktime_to_ns(prevent_suspend_time), ktime_to_ns(max_time),
-		     ktime_to_ns(lock->stat.last_time));
+		     lock->name, r.count, r.expire_count, r.wakeup_count,
+		     r.active_time, r.total_time, r.sleep_time, r.max_time,
+		     r.last_change);
+}
+
+static int write_lock_stat(struct seq_file *m, struct wake_lock *lock)
+{
+	struct wake_lock_stat_record r;
+
+	memset(&r, 0, sizeof(r));
+	get_lock_stat(lock, &r);
+	strncpy(r.name, lock->name, sizeof(r.name));
+	return seq_write(m, &r, sizeof(r));
 }
 
 static int wakelock_stats_show(struct seq_file *m, void *unused)
@@ -132,13 +173,30 @@ static int wakelock_stats_show(struct seq_file *m, void *unused)
 	list_for_each_entry(lock, &inactive_locks, link)
 		ret = print_lock_stat(m, lock);
 	for (type = 0; type < WAKE_LOCK_TYPE_COUNT; type++) {
-		list_for_each_entry(lock, &active_wake_locks[type], link)
+		list_for_each_entry(lock, &active_wake_locks[type].locks, link)
 			ret = print_lock_stat(m, lock);
 	}
 	spin_unlock_irqrestore(&list_lock, irqflags);
 	return 0;
 }
 
+static int wakelock_stats_bin_show(struct seq_file *m, void *unused)
+{
+	unsigned long irqflags;
+	struct wake_lock *lock;
+	int type;
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	list_for_each_entry(lock, &inactive_locks, link)
+		write_lock_stat(m, lock);
+	for (type = 0; type < WAKE_LOCK_TYPE_COUNT; type++) {
+		list_for_each_entry(lock, &active_wake_locks[type].locks, link)
+			write_lock_stat(m, lock);
+	}
+	spin_unlock_irqrestore(&list_lock, irqflags);
+	return 0;
+}
+
 static void wake_unlock_stat_locked(struct wake_lock *lock, int expired)
 {
 	ktime_t duration;
@@ -173,7 +231,8 @@ static void update_sleep_wait_stats_locked(int done)
 
 	now = ktime_get();
 	elapsed = ktime_sub(now, last_sleep_time_update);
-	list_for_each_entry(lock, &active_wake_locks[WAKE_LOCK_SUSPEND], link) {
+	list_for_each_entry(lock, &active_wake_locks[WAKE_LOCK_SUSPEND].locks,
+			    link) {
 		expired = get_expired_time(lock, &etime);
 		if (lock->flags & WAKE_LOCK_PREVENTING_SUSPEND) {
 			if (expired)
@@ -193,13 +252,71 @@ static void update_sleep_wait_stats_locked(int done)
 #endif
 
 
+/* Caller must acquire the list_lock spinlock */
+static void add_active_lock(struct wake_lock *lock)
+{
+	struct wake_lock_set *set;
+	struct rb_node **p, *parent = NULL;
+	bool leftmost = true, rightmost = true;
+
+	set = &active_wake_locks[lock->flags & WAKE_LOCK_TYPE_MASK];
+	list_add(&lock->link, &set->locks);
+	if (!(lock->flags & WAKE_LOCK_AUTO_EXPIRE)) {
+		set->untimed++;
+		return;
+	}
+
+	p = &set->timed.rb_node;
+	while (*p) {
+		struct wake_lock *l;
+
+		parent = *p;
+		l = rb_entry(parent, struct wake_lock, expire_node);
+		if ((long)(lock->expires - l->expires) < 0) {
+			p = &parent->rb_left;
+			rightmost = false;
+		} else {
+			p = &parent->rb_right;
+			leftmost = false;
+		}
+	}
+	rb_link_node(&lock->expire_node, parent, p);
+	rb_insert_color(&lock->expire_node, &set->timed);
+	if (leftmost)
+		set->first = &lock->expire_node;
+	if (rightmost)
+		set->last = &lock->expire_node;
+}
+
+/* Caller must acquire the list_lock spinlock */
+static void remove_active_lock(struct wake_lock *lock)
+{
+	struct wake_lock_set *set;
+
+	list_del(&lock->link);
+	if (!(lock->flags & WAKE_LOCK_ACTIVE))
+		return;
+
+	set = &active_wake_locks[lock->flags & WAKE_LOCK_TYPE_MASK];
+	if (!(lock->flags & WAKE_LOCK_AUTO_EXPIRE)) {
+		set->untimed--;
+		return;
+	}
+
+	if (set->first == &lock->expire_node)
+		set->first = rb_next(&lock->expire_node);
+	if (set->last == &lock->expire_node)
+		set->last = rb_prev(&lock->expire_node);
+	rb_erase(&lock->expire_node, &set->timed);
+}
+
 static void expire_wake_lock(struct wake_lock *lock)
 {
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_unlock_stat_locked(lock, 1);
 #endif
+	remove_active_lock(lock);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
 	if (debug_mask & (DEBUG_WAKE_LOCK | DEBUG_EXPIRE))
 		pr_info("expired wake lock %s\n", lock->name);
@@ -212,7 +329,7 @@ static void print_active_locks(int type)
 	bool print_expired = true;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry(lock, &active_wake_locks[type], link) {
+	list_for_each_entry(lock, &active_wake_locks[type].locks, link) {
 		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
 			long timeout = lock->expires - jiffies;
 			if (timeout > 0)
@@ -228,23 +345,31 @@ static void print_active_locks(int type)
 	}
 }
 
+/*
+ * Expires the timed locks that are due. Each lock expires at most once
+ * per activation, so this is constant time amortized over the calls
+ * to wake_lock_timeout().
+ */
 static long has_wake_lock_locked(int type)
 {
-	struct wake_lock *lock, *n;
-	long max_timeout = 0;
+	struct wake_lock_set *set;
+	struct wake_lock *lock;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
-	list_for_each_entry_safe(lock, n, &active_wake_locks[type], link) {
-		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
-			long timeout = lock->expires - jiffies;
-			if (timeout <= 0)
-				expire_wake_lock(lock);
-			else if (timeout > max_timeout)
-				max_timeout = timeout;
-		} else
-			return -1;
+	set = &active_wake_locks[type];
+	while (set->first) {
+		lock = rb_entry(set->first, struct wake_lock, expire_node);
+		if ((long)(lock->expires - jiffies) > 0)
+			break;
+		expire_wake_lock(lock);
 	}
-	return max_timeout;
+
+	if (set->untimed)
+		return -1;
+	if (!set->last)
+		return 0;
+	lock = rb_entry(set->last, struct wake_lock, expire_node);
+	return lock->expires - jiffies;
 }
 
 long has_wake_lock(int type)
@@ -259,12 +384,44 @@ long has_wake_lock(int type)
 	return ret;
 }
 
+#ifdef CONFIG_PM_SUSPEND_LATENCY
+/* Record a wake lock that keeps the system from suspending */
+static void record_blocking_wake_lock(void)
+{
+	unsigned long irqflags;
+	struct wake_lock_set *set = &active_wake_locks[WAKE_LOCK_SUSPEND];
+	struct wake_lock *lock = NULL, *l;
+	ktime_t held_since = ktime_get();
+
+	spin_lock_irqsave(&list_lock, irqflags);
+	list_for_each_entry(l, &set->locks, link) {
+		if (!(l->flags & WAKE_LOCK_AUTO_EXPIRE)) {
+			lock = l;
+			break;
+		}
+	}
+	if (!lock && set->last)
+		lock = rb_entry(set->last, struct wake_lock, expire_node);
+	if (lock) {
+#ifdef CONFIG_WAKELOCK_STAT
+		held_since = lock->stat.last_time;
+#endif
+		pm_latency_record(PM_LATENCY_WAKE_LOCK, PM_EVENT_SUSPEND,
+				  lock->name, held_since, -EAGAIN);
+	}
+	spin_unlock_irqrestore(&list_lock, irqflags);
+}
+#else
+static inline void record_blocking_wake_lock(void) {}
+#endif
+
 static void suspend(struct work_struct *work)
 {
 	int ret;
 	int entry_event_num;
 
 	if (has_wake_lock(WAKE_LOCK_SUSPEND)) {
+		record_blocking_wake_lock();
 		if (debug_mask & DEBUG_SUSPEND)
 			pr_info("suspend: abort suspend\n");
 		return;
@@ -325,6 +482,8 @@ static DEFINE_TIMER(expire_timer, expire_wake_locks, 0, 0);
 static int power_suspend_late(struct device *dev)
 {
 	int ret = has_wake_lock(WAKE_LOCK_SUSPEND) ? -EAGAIN : 0;
+	if (ret)
+		record_blocking_wake_lock();
 #ifdef CONFIG_WAKELOCK_STAT
 	wait_for_wakeup = 1;
 #endif
@@ -395,7 +554,8 @@ void wake_lock_destroy(struct wake_lock *lock)
 				  lock->stat.max_time);
 	}
 #endif
-	list_del(&lock->link);
+	remove_active_lock(lock);
+	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
 	spin_unlock_irqrestore(&list_lock, irqflags);
 }
 EXPORT_SYMBOL(wake_lock_destroy);
@@ -424,13 +584,13 @@ static void wake_lock_internal(
 		lock->stat.last_time = ktime_get();
 	}
 #endif
+	remove_active_lock(lock);
 	if (!(lock->flags & WAKE_LOCK_ACTIVE)) {
 		lock->flags |= WAKE_LOCK_ACTIVE;
 #ifdef CONFIG_WAKELOCK_STAT
 		lock->stat.last_time = ktime_get();
 #endif
 	}
-	list_del(&lock->link);
 	if (has_timeout) {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d, timeout %ld.%03lu\n",
@@ -438,14 +598,13 @@ static void wake_lock_internal(
 				(timeout % HZ) * MSEC_PER_SEC / HZ);
 		lock->expires = jiffies + timeout;
 		lock->flags |= WAKE_LOCK_AUTO_EXPIRE;
-		list_add_tail(&lock->link, &active_wake_locks[type]);
 	} else {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d\n", lock->name, type);
 		lock->expires = LONG_MAX;
 		lock->flags &= ~WAKE_LOCK_AUTO_EXPIRE;
-		list_add(&lock->link, &active_wake_locks[type]);
 	}
+	add_active_lock(lock);
 	if (type == WAKE_LOCK_SUSPEND) {
 		current_event_num++;
 #ifdef CONFIG_WAKELOCK_STAT
@@ -498,8 +657,8 @@ void wake_unlock(struct wake_lock *lock)
 #endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_unlock: %s\n", lock->name);
+	remove_active_lock(lock);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
-	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
 	if (type == WAKE_LOCK_SUSPEND) {
 		long has_lock = has_wake_lock_locked(type);
@@ -547,13 +706,30 @@ static const struct file_operations wakelock_stats_fops = {
 	.release = single_release,
 };
 
+#ifdef CONFIG_WAKELOCK_STAT
+static int wakelock_stats_bin_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, wakelock_stats_bin_show, NULL);
+}
+
+static const struct file_operations wakelock_stats_bin_fops = {
+	.owner = THIS_MODULE,
+	.open = wakelock_stats_bin_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+#endif
+
 static int __init wakelocks_init(void)
 {
 	int ret;
 	int i;
 
-	for (i = 0; i < ARRAY_SIZE(active_wake_locks); i++)
-		INIT_LIST_HEAD(&active_wake_locks[i]);
+	for (i = 0; i < ARRAY_SIZE(active_wake_locks); i++) {
+		INIT_LIST_HEAD(&active_wake_locks[i].locks);
+		active_wake_locks[i].timed = RB_ROOT;
+	}
 
 #ifdef CONFIG_WAKELOCK_STAT
 	wake_lock_init(&deleted_wake_locks, WAKE_LOCK_SUSPEND,
@@ -582,6 +758,7 @@ static int __init wakelocks_init(void)
 
 #ifdef CONFIG_WAKELOCK_STAT
 	proc_create("wakelocks", S_IRUGO, NULL, &wakelock_stats_fops);
+	proc_create("wakelocks_bin", S_IRUGO, NULL, &wakelock_stats_bin_fops);
 #endif
 
 	return 0;
@@ -602,6 +779,7 @@ err_platform_device_register:
 static void  __exit wakelocks_exit(void)
 {
 #ifdef CONFIG_WAKELOCK_STAT
+	remove_proc_entry("wakelocks_bin", NULL);
 	remove_proc_entry("wakelocks", NULL);
 #endif
 	destroy_workqueue(suspend_work_queue);
@@ -0,0 +1,107 @@
+/*
+ * Test module for the CPU hotplug decision in <linux/hotplug_policy.h>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Feeds hotplug_decide() made-up sample windows and checks what it
+ * decides. Nothing is taken on or offline, so it can be loaded on any
+ * machine.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/hotplug_policy.h>
+
+static const struct hotplug_tunables test_tunables = {
+	.load_l		= 20,
+	.load_h		= 60,
+	.nr_run_fast	= 2,
+	.down_delay	= 2000,
+	.low_freq	= 200000,
+};
+
+struct hotplug_test {
+	const char *name;
+	unsigned int window;		/* samples */
+	struct hotplug_stats st;
+	enum hotplug_action expect;
+};
+
+#define ST(on, sam, ld, nr, now, f, since)				\
+	{ .online = on, .possible = 2, .samples = sam, .load = ld,	\
+	  .nr_run = nr, .nr_run_now = now, .freq = f,			\
+	  .since_change = since }
+
+static const struct hotplug_test hotplug_tests[] = {
+	{ "high load brings a CPU in", 5,
+	  ST(1, 5, 80, 100, 1, 800000, 0), HOTPLUG_IN },
+	{ "high load needs a full window", 5,
+	  ST(1, 4, 80, 100, 1, 800000, 0), HOTPLUG_NOP },
+	{ "queued tasks bring a CPU in at once", 5,
+	  ST(1, 1, 10, 100, 3, 800000, 0), HOTPLUG_IN },
+	{ "nothing left to bring in", 5,
+	  ST(2, 5, 90, 400, 4, 800000, 5000), HOTPLUG_NOP },
+	{ "low load takes a CPU out", 5,
+	  ST(2, 5, 10, 50, 1, 800000, 3000), HOTPLUG_OUT },
+	{ "not out before down_delay", 5,
+	  ST(2, 5, 10, 50, 1, 800000, 500), HOTPLUG_NOP },
+	{ "not out with more tasks than CPUs", 5,
+	  ST(2, 5, 10, 300, 3, 800000, 3000), HOTPLUG_NOP },
+	{ "low load needs a full window to go out", 5,
+	  ST(2, 3, 10, 50, 1, 800000, 3000), HOTPLUG_NOP },
+	{ "one CPU at low_freq whatever the load", 5,
+	  ST(2, 5, 95, 300, 3, 200000, 3000), HOTPLUG_OUT },
+	{ "no CPU brought in at low_freq", 5,
+	  ST(1, 5, 95, 300, 4, 200000, 3000), HOTPLUG_NOP },
+	{ "the last CPU stays", 5,
+	  ST(1, 5, 0, 0, 0, 800000, 3000), HOTPLUG_NOP },
+	{ "window of 0 counts as 1", 0,
+	  ST(1, 1, 80, 100, 1, 800000, 0), HOTPLUG_IN },
+	{ "window capped to the history", 100,
+	  ST(1, HOTPLUG_HISTORY_MAX, 80, 100, 1, 800000, 0), HOTPLUG_IN },
+};
+
+static int __init hotplug_policy_test_init(void)
+{
+	struct hotplug_tunables t;
+	enum hotplug_action got;
+	int failed = 0;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(hotplug_tests); i++) {
+		const struct hotplug_test *test = &hotplug_tests[i];
+
+		t = test_tunables;
+		t.window = test->window;
+
+		got = hotplug_decide(&test->st, &t);
+		if (got != test->expect) {
+			printk(KERN_ERR "hotplug_policy_test: %s: got %d, "
+			       "expected %d\n", test->name, got, test->expect);
+			failed++;
+		}
+	}
+
+	if (failed) {
+		printk(KERN_ERR "hotplug_policy_test: %d of %zu failed\n",
+		       failed, ARRAY_SIZE(hotplug_tests));
+		return -EINVAL;
+	}
+
+	printk(KERN_INFO "hotplug_policy_test: %zu passed\n",
+	       ARRAY_SIZE(hotplug_tests));
+	return 0;
+}
+
+static void __exit hotplug_policy_test_exit(void)
+{
+}
+
+module_init(hotplug_policy_test_init);
+module_exit(hotplug_policy_test_exit);
+
+MODULE_DESCRIPTION("CPU hotplug policy test");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,229 @@
+/*
+ * ashmem-pin.c -- pin and unpin ashmem ranges from many threads, with or
+ * without the shrinker purging them
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* $(CROSS_COMPILE)gcc -Wall -Wextra -O2 -g -pthread -o ashmem-pin ashmem-pin.c */
+
+/*
+ * Usage: ashmem-pin [-t threads] [-p pages] [-s seconds] [-m]
+ *
+ * Every thread creates its own area of pages pages, maps it, and then
+ * repeatedly unpins one page, pins it back and writes to it. At the end
+ * the pin/unpin pairs per second of all threads, the slowest ASHMEM_PIN
+ * and the number of pages found purged are printed.
+ *
+ * With -m another thread keeps writing 2 to /proc/sys/vm/drop_caches,
+ * which runs every shrinker including ashmem's, so the pins race with
+ * purges of the unpinned pages. This needs root.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/types.h>
+
+/* Not exported to userspace */
+#include "../../include/linux/ashmem.h"
+
+struct worker {
+	pthread_t thread;
+	unsigned int id;
+	unsigned long pairs;
+	unsigned long purged;
+	unsigned long long max_pin_ns;
+	int error;
+};
+
+static unsigned int nr_threads = 4;
+static unsigned int nr_pages = 64;
+static unsigned int seconds = 5;
+static volatile int stop;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	long page_size = sysconf(_SC_PAGESIZE);
+	size_t size = (size_t)nr_pages * page_size;
+	struct ashmem_pin pin;
+	unsigned long long start, ns;
+	char name[ASHMEM_NAME_LEN];
+	unsigned int page = 0;
+	char *map;
+	int fd, ret;
+
+	fd = open("/dev/ashmem", O_RDWR);
+	if (fd < 0) {
+		perror("/dev/ashmem");
+		goto fail;
+	}
+	snprintf(name, sizeof(name), "ashmem-pin-%u", w->id);
+	if (ioctl(fd, ASHMEM_SET_NAME, name) < 0 ||
+	    ioctl(fd, ASHMEM_SET_SIZE, size) < 0) {
+		perror("ashmem setup");
+		goto fail;
+	}
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		goto fail;
+	}
+	memset(map, w->id, size);
+
+	while (!stop) {
+		pin.offset = page * page_size;
+		pin.len = page_size;
+
+		if (ioctl(fd, ASHMEM_UNPIN, &pin) < 0) {
+			perror("ASHMEM_UNPIN");
+			goto fail;
+		}
+
+		start = now_ns();
+		ret = ioctl(fd, ASHMEM_PIN, &pin);
+		ns = now_ns() - start;
+		if (ret < 0) {
+			perror("ASHMEM_PIN");
+			goto fail;
+		}
+		if (ret == ASHMEM_WAS_PURGED)
+			w->purged++;
+		if (ns > w->max_pin_ns)
+			w->max_pin_ns = ns;
+
+		/* Fault the page back in so the next purge has work to do */
+		map[pin.offset] = w->id;
+		w->pairs++;
+		page = (page + 1) % nr_pages;
+	}
+
+	munmap(map, size);
+	close(fd);
+	return NULL;
+
+fail:
+	w->error = 1;
+	if (fd >= 0)
+		close(fd);
+	return NULL;
+}
+
+static void *pressure_thread(void *arg)
+{
+	int fd;
+
+	(void)arg;
+	while (!stop) {
+		fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+		if (fd < 0 || write(fd, "2", 1) != 1) {
+			perror("/proc/sys/vm/drop_caches");
+			if (fd >= 0)
+				close(fd);
+			return (void *)1;
+		}
+		close(fd);
+		usleep(10000);
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long start, elapsed, max_pin_ns = 0;
+	unsigned long pairs = 0, purged = 0;
+	struct worker *workers;
+	pthread_t pressure;
+	int opt, error = 0, pressure_on = 0;
+	unsigned int i;
+	void *ret;
+
+	while ((opt = getopt(argc, argv, "t:p:s:m")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			nr_pages = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			pressure_on = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t threads] [-p pages] "
+				"[-s seconds] [-m]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (!nr_threads || !nr_pages) {
+		fprintf(stderr, "threads and pages must not be 0\n");
+		return 1;
+	}
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		return 1;
+	}
+
+	start = now_ns();
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].id = i;
+		if (pthread_create(&workers[i].thread, NULL, worker_thread,
+				   &workers[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			return 1;
+		}
+	}
+	if (pressure_on &&
+	    pthread_create(&pressure, NULL, pressure_thread, NULL)) {
+		fprintf(stderr, "pthread_create failed\n");
+		return 1;
+	}
+
+	sleep(seconds);
+	stop = 1;
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		error |= workers[i].error;
+		pairs += workers[i].pairs;
+		purged += workers[i].purged;
+		if (workers[i].max_pin_ns > max_pin_ns)
+			max_pin_ns = workers[i].max_pin_ns;
+	}
+	elapsed = now_ns() - start;
+	if (pressure_on) {
+		pthread_join(pressure, &ret);
+		if (ret)
+			error = 1;
+	}
+
+	printf("threads %u pages %u pressure %s\n",
+	       nr_threads, nr_pages, pressure_on ? "on" : "off");
+	printf("unpin/pin %.0f/s slowest pin %llu us purged %lu\n",
+	       pairs * 1e9 / elapsed, max_pin_ns / 1000, purged);
+	return error;
+}
@@ -0,0 +1,399 @@
+/*
+ * binder-contention.c -- drive binder transactions from several clients
+ * at once and report throughput and latency
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * $(CROSS_COMPILE)gcc -Wall -Wextra -O2 -g -pthread \
+ *	-o binder-contention binder-contention.c
+ */
+
+/*
+ * Usage: binder-contention [-c clients] [-s size] [-n count] [-d device]
+ *
+ * Forks a server that becomes the context manager, with one looper
+ * thread per client, then one process per client, each sending count
+ * synchronous transactions of size bytes to handle 0 and waiting for the
+ * empty reply. Each client has its own process, so any scaling comes
+ * from the driver and not from contention inside the benchmark.
+ *
+ * Only one context manager can exist, so run it where no servicemanager
+ * is running, e.g. an SMP QEMU guest booted to a shell. Compare runs
+ * with -c 1 and -c <ncpus>, and with small and large -s: the size is
+ * what the copy done outside binder_lock scales with.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Not exported to userspace */
+#include "../../drivers/staging/android/binder.h"
+
+#define MAP_SIZE	(4 * 1024 * 1024)
+
+struct client_result {
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+	unsigned long done;
+	int error;
+};
+
+static const char *device = "/dev/binder";
+static unsigned int nr_clients = 2;
+static size_t size = 128;
+static unsigned long count = 10000;
+static int server_fd;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int binder_open(size_t map_size)
+{
+	struct binder_version version;
+	int fd;
+
+	fd = open(device, O_RDWR);
+	if (fd < 0) {
+		perror(device);
+		return -1;
+	}
+	if (ioctl(fd, BINDER_VERSION, &version) < 0 ||
+	    version.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "%s: protocol version mismatch\n", device);
+		close(fd);
+		return -1;
+	}
+	if (mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0) == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int write_read(int fd, void *wbuf, size_t wsize,
+		      void *rbuf, size_t rsize, size_t *consumed)
+{
+	struct binder_write_read bwr;
+
+	memset(&bwr, 0, sizeof(bwr));
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.write_size = wsize;
+	bwr.read_buffer = (unsigned long)rbuf;
+	bwr.read_size = rsize;
+
+	while (bwr.write_consumed < bwr.write_size || rsize) {
+		if (ioctl(fd, BINDER_WRITE_READ, &bwr) == 0)
+			break;
+		if (errno != EINTR)
+			return -1;
+	}
+	if (consumed)
+		*consumed = bwr.read_consumed;
+	return 0;
+}
+
+/*
+ * Looper: free every incoming buffer and answer with an empty reply.
+ * Commands we are not interested in are skipped using the size encoded
+ * in the command itself.
+ */
+static void *server_thread(void *arg)
+{
+	uint32_t rbuf[64];
+	struct {
+		uint32_t free_cmd;
+		const void *buffer;
+		uint32_t reply_cmd;
+		struct binder_transaction_data tr;
+	} __attribute__((packed)) reply;
+	uint32_t cmd = BC_ENTER_LOOPER;
+	size_t consumed;
+
+	(void)arg;
+	if (write_read(server_fd, &cmd, sizeof(cmd), NULL, 0, NULL) < 0) {
+		perror("BC_ENTER_LOOPER");
+		return NULL;
+	}
+
+	for (;;) {
+		char *p, *end;
+
+		if (write_read(server_fd, NULL, 0, rbuf, sizeof(rbuf),
+			       &consumed) < 0) {
+			perror("server BINDER_WRITE_READ");
+			return NULL;
+		}
+
+		p = (char *)rbuf;
+		end = p + consumed;
+		while (p + sizeof(uint32_t) <= end) {
+			struct binder_transaction_data *tr;
+
+			memcpy(&cmd, p, sizeof(cmd));
+			p += sizeof(cmd);
+			if (cmd != BR_TRANSACTION) {
+				p += _IOC_SIZE(cmd);
+				continue;
+			}
+
+			tr = (struct binder_transaction_data *)p;
+			p += sizeof(*tr);
+
+			memset(&reply, 0, sizeof(reply));
+			reply.free_cmd = BC_FREE_BUFFER;
+			reply.buffer = tr->data.ptr.buffer;
+			reply.reply_cmd = BC_REPLY;
+			if (write_read(server_fd, &reply, sizeof(reply),
+				       NULL, 0, NULL) < 0) {
+				perror("BC_REPLY");
+				return NULL;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void run_server(int ready)
+{
+	pthread_t thread;
+	unsigned int i;
+	int zero = 0;
+
+	server_fd = binder_open(MAP_SIZE);
+	if (server_fd < 0)
+		exit(1);
+	if (ioctl(server_fd, BINDER_SET_MAX_THREADS, &zero) < 0 ||
+	    ioctl(server_fd, BINDER_SET_CONTEXT_MGR, &zero) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR (is servicemanager running?)");
+		exit(1);
+	}
+
+	for (i = 0; i < nr_clients; i++) {
+		if (pthread_create(&thread, NULL, server_thread, NULL)) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+	}
+
+	if (write(ready, "", 1) != 1)
+		exit(1);
+	pause();
+	exit(0);
+}
+
+static void run_client(struct client_result *res)
+{
+	uint32_t rbuf[64];
+	struct {
+		uint32_t free_cmd;
+		const void *buffer;
+		uint32_t cmd;
+		struct binder_transaction_data tr;
+	} __attribute__((packed)) wbuf;
+	const void *reply_buffer = NULL;
+	unsigned long long start, ns;
+	size_t consumed;
+	char *payload;
+	int fd;
+
+	fd = binder_open(128 * 1024);
+	if (fd < 0) {
+		res->error = 1;
+		exit(1);
+	}
+	payload = calloc(1, size ? size : 1);
+	if (!payload) {
+		res->error = 1;
+		exit(1);
+	}
+
+	while (res->done < count) {
+		char *wstart = (char *)&wbuf;
+		int replied = 0;
+
+		/* Free the previous reply in the same call as the next send */
+		memset(&wbuf, 0, sizeof(wbuf));
+		wbuf.free_cmd = BC_FREE_BUFFER;
+		wbuf.buffer = reply_buffer;
+		wbuf.cmd = BC_TRANSACTION;
+		wbuf.tr.target.handle = 0;
+		wbuf.tr.code = 1;
+		wbuf.tr.data_size = size;
+		wbuf.tr.data.ptr.buffer = payload;
+		if (!reply_buffer)
+			wstart += sizeof(wbuf.free_cmd) + sizeof(wbuf.buffer);
+
+		start = now_ns();
+		if (write_read(fd, wstart, (char *)(&wbuf + 1) - wstart,
+			       NULL, 0, NULL) < 0)
+			goto fail;
+
+		while (!replied) {
+			char *p, *end;
+
+			if (write_read(fd, NULL, 0, rbuf, sizeof(rbuf),
+				       &consumed) < 0)
+				goto fail;
+
+			p = (char *)rbuf;
+			end = p + consumed;
+			while (p + sizeof(uint32_t) <= end) {
+				struct binder_transaction_data *tr;
+				uint32_t cmd;
+
+				memcpy(&cmd, p, sizeof(cmd));
+				p += sizeof(cmd);
+				switch (cmd) {
+				case BR_REPLY:
+					tr = (struct binder_transaction_data *)p;
+					reply_buffer = tr->data.ptr.buffer;
+					replied = 1;
+					break;
+				case BR_DEAD_REPLY:
+				case BR_FAILED_REPLY:
+					fprintf(stderr, "transaction failed\n");
+					res->error = 1;
+					exit(1);
+				}
+				p += _IOC_SIZE(cmd);
+			}
+		}
+
+		ns = now_ns() - start;
+		res->total_ns += ns;
+		if (ns > res->max_ns)
+			res->max_ns = ns;
+		res->done++;
+	}
+	exit(0);
+
+fail:
+	perror("client BINDER_WRITE_READ");
+	res->error = 1;
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	struct client_result *results;
+	unsigned long long start, elapsed, total_ns = 0, max_ns = 0;
+	unsigned long done = 0;
+	unsigned int i;
+	int pipefd[2];
+	pid_t server;
+	char c;
+	int opt, error = 0;
+
+	while ((opt = getopt(argc, argv, "c:s:n:d:")) != -1) {
+		switch (opt) {
+		case 'c':
+			nr_clients = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c clients] [-s size] "
+				"[-n count] [-d device]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (!nr_clients || nr_clients * size > MAP_SIZE / 2) {
+		fprintf(stderr, "clients * size must fit in %d bytes\n",
+			MAP_SIZE / 2);
+		return 1;
+	}
+
+	results = mmap(NULL, nr_clients * sizeof(*results),
+		       PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+		       -1, 0);
+	if (results == MAP_FAILED || pipe(pipefd) < 0) {
+		perror("setup");
+		return 1;
+	}
+	memset(results, 0, nr_clients * sizeof(*results));
+
+	server = fork();
+	if (server < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (!server)
+		run_server(pipefd[1]);
+	if (read(pipefd[0], &c, 1) != 1) {
+		fprintf(stderr, "server failed to start\n");
+		waitpid(server, NULL, 0);
+		return 1;
+	}
+
+	start = now_ns();
+	for (i = 0; i < nr_clients; i++) {
+		pid_t pid = fork();
+
+		if (pid < 0) {
+			perror("fork");
+			break;
+		}
+		if (!pid)
+			run_client(&results[i]);
+	}
+	while (i) {
+		pid_t pid = wait(NULL);
+
+		if (pid < 0 || pid == server) {
+			fprintf(stderr, "server exited early\n");
+			error = 1;
+			break;
+		}
+		i--;
+	}
+	elapsed = now_ns() - start;
+	kill(server, SIGTERM);
+	waitpid(server, NULL, 0);
+
+	for (i = 0; i < nr_clients; i++) {
+		error |= results[i].error;
+		done += results[i].done;
+		total_ns += results[i].total_ns;
+		if (results[i].max_ns > max_ns)
+			max_ns = results[i].max_ns;
+	}
+	if (!done) {
+		fprintf(stderr, "no transaction completed\n");
+		return 1;
+	}
+
+	printf("clients %u size %zu transactions %lu\n",
+	       nr_clients, size, done);
+	printf("throughput %.0f/s latency avg %llu us max %llu us\n",
+	       done * 1e9 / elapsed, total_ns / done / 1000, max_ns / 1000);
+	return error;
+}
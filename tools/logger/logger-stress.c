@@ -0,0 +1,279 @@
+/*
+ * logger-stress.c -- concurrent writers against an Android log device
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * $(CROSS_COMPILE)gcc -Wall -Wextra -O2 -g -pthread \
+ *	-o logger-stress logger-stress.c
+ */
+
+/*
+ * Usage: logger-stress [-w writers] [-n count] [-s size] [-d device]
+ *
+ * Starts writers threads that each log count entries of size bytes of
+ * message, the way liblog does: one writev() of priority, tag and
+ * message. It prints the entries per second written by all of them.
+ *
+ * A reader thread follows the log meanwhile and checks every entry it
+ * sees from this process: the message must be intact and the sequence
+ * numbers of each writer must only go up. Entries overwritten before
+ * the reader got to them are counted as lost, not as errors; use a
+ * bigger log or fewer entries if the reader should see all of them.
+ *
+ * The default device is /dev/log/main. Compare -w 1 with -w <ncpus>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Not exported to userspace */
+#include "../../drivers/staging/android/logger.h"
+
+#define TAG		"logger-stress"
+#define PRIO_INFO	4
+
+static const char *device = "/dev/log/main";
+static unsigned int nr_writers = 4;
+static unsigned long count = 100000;
+static size_t size = 64;
+static int done;
+
+struct reader_stats {
+	unsigned long entries;
+	unsigned long lost;
+	unsigned long bad;
+	unsigned long last_seq[256];
+	int seen[256];
+};
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Message: "<writer> <seq> " followed by the writer's letter up to size,
+ * so a torn or interleaved entry shows up as a wrong fill character.
+ */
+static size_t format_msg(char *msg, unsigned int writer, unsigned long seq)
+{
+	int len;
+
+	len = snprintf(msg, size, "%u %lu ", writer, seq);
+	if (len < 0 || (size_t)len >= size)
+		len = size - 1;
+	memset(msg + len, 'a' + writer % 26, size - 1 - len);
+	msg[size - 1] = '\0';
+	return size;
+}
+
+static int check_msg(const char *msg, size_t len, struct reader_stats *st)
+{
+	unsigned int writer;
+	unsigned long seq;
+	char *end;
+	size_t i;
+
+	if (!len || msg[len - 1] != '\0')
+		return -1;
+	writer = strtoul(msg, &end, 10);
+	if (*end != ' ' || writer >= nr_writers)
+		return -1;
+	seq = strtoul(end + 1, &end, 10);
+	if (*end != ' ')
+		return -1;
+	for (i = end + 1 - msg; i < len - 1; i++)
+		if (msg[i] != 'a' + (char)(writer % 26))
+			return -1;
+
+	if (st->seen[writer] && seq <= st->last_seq[writer])
+		return -1;
+	if (st->seen[writer])
+		st->lost += seq - st->last_seq[writer] - 1;
+	else
+		st->lost += seq;
+	st->seen[writer] = 1;
+	st->last_seq[writer] = seq;
+	return 0;
+}
+
+static void *reader_thread(void *arg)
+{
+	struct reader_stats *st = arg;
+	char buf[LOGGER_ENTRY_MAX_LEN + 1];
+	struct logger_entry *entry = (struct logger_entry *)buf;
+	pid_t pid = getpid();
+	int fd;
+
+	fd = open(device, O_RDONLY | O_NONBLOCK);
+	if (fd < 0) {
+		perror(device);
+		return NULL;
+	}
+
+	for (;;) {
+		const char *tag, *msg;
+		int finished;
+		ssize_t ret;
+
+		finished = __sync_fetch_and_add(&done, 0);
+		ret = read(fd, buf, LOGGER_ENTRY_MAX_LEN);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN) {
+				perror("read");
+				break;
+			}
+			/* Writers were done before this read found nothing */
+			if (finished)
+				break;
+			usleep(1000);
+			continue;
+		}
+		if ((size_t)ret < sizeof(*entry) ||
+		    (size_t)ret < sizeof(*entry) + entry->len)
+			continue;
+		if (entry->pid != pid)
+			continue;
+
+		/* Payload: priority, tag, message */
+		buf[sizeof(*entry) + entry->len] = '\0';
+		tag = entry->msg + 1;
+		if (strcmp(tag, TAG))
+			continue;
+		msg = tag + sizeof(TAG);
+		st->entries++;
+		if (msg > entry->msg + entry->len ||
+		    check_msg(msg, entry->msg + entry->len - msg, st))
+			st->bad++;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static void *writer_thread(void *arg)
+{
+	unsigned int writer = (unsigned long)arg;
+	unsigned char prio = PRIO_INFO;
+	struct iovec vec[3];
+	unsigned long seq;
+	char *msg;
+	int fd;
+
+	msg = malloc(size);
+	fd = open(device, O_WRONLY);
+	if (!msg || fd < 0) {
+		perror(device);
+		return (void *)1;
+	}
+
+	vec[0].iov_base = &prio;
+	vec[0].iov_len = 1;
+	vec[1].iov_base = TAG;
+	vec[1].iov_len = sizeof(TAG);
+	vec[2].iov_base = msg;
+
+	for (seq = 0; seq < count; seq++) {
+		vec[2].iov_len = format_msg(msg, writer, seq);
+		if (writev(fd, vec, 3) < 0 && errno != EINTR) {
+			perror("writev");
+			return (void *)1;
+		}
+	}
+
+	close(fd);
+	free(msg);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	static struct reader_stats stats;
+	pthread_t reader, *writers;
+	unsigned long long start, elapsed;
+	unsigned int i;
+	void *ret;
+	int opt, error = 0;
+
+	while ((opt = getopt(argc, argv, "w:n:s:d:")) != -1) {
+		switch (opt) {
+		case 'w':
+			nr_writers = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-w writers] [-n count] "
+				"[-s size] [-d device]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (!nr_writers || nr_writers > 256) {
+		fprintf(stderr, "between 1 and 256 writers\n");
+		return 1;
+	}
+	if (size < 2 || size > LOGGER_ENTRY_MAX_PAYLOAD - 1 - sizeof(TAG)) {
+		fprintf(stderr, "size must be between 2 and %zu\n",
+			LOGGER_ENTRY_MAX_PAYLOAD - 1 - sizeof(TAG));
+		return 1;
+	}
+
+	writers = calloc(nr_writers, sizeof(*writers));
+	if (!writers || pthread_create(&reader, NULL, reader_thread, &stats)) {
+		fprintf(stderr, "setup failed\n");
+		return 1;
+	}
+
+	start = now_ns();
+	for (i = 0; i < nr_writers; i++) {
+		if (pthread_create(&writers[i], NULL, writer_thread,
+				   (void *)(unsigned long)i)) {
+			fprintf(stderr, "pthread_create failed\n");
+			return 1;
+		}
+	}
+	for (i = 0; i < nr_writers; i++) {
+		pthread_join(writers[i], &ret);
+		if (ret)
+			error = 1;
+	}
+	elapsed = now_ns() - start;
+
+	__sync_fetch_and_add(&done, 1);
+	pthread_join(reader, NULL);
+
+	/* Entries overwritten after the last one the reader saw */
+	for (i = 0; i < nr_writers; i++)
+		stats.lost += count - (stats.seen[i] ? stats.last_seq[i] + 1 : 0);
+
+	printf("writers %u size %zu entries %lu\n",
+	       nr_writers, size, nr_writers * count);
+	printf("write rate %.0f entries/s\n",
+	       nr_writers * count * 1e9 / elapsed);
+	printf("read %lu lost %lu bad %lu\n",
+	       stats.entries, stats.lost, stats.bad);
+	return error || stats.bad;
+}
@@ -0,0 +1,160 @@
+/*
+ * cpufreq-wakeups.c -- count timer activity of a cpufreq governor and
+ * the local timer interrupts of each CPU over an interval
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* $(CROSS_COMPILE)gcc -Wall -Wextra -g -o cpufreq-wakeups cpufreq-wakeups.c */
+
+/*
+ * Usage: cpufreq-wakeups [-s seconds] [pattern]
+ *
+ * Samples /proc/timer_stats (CONFIG_TIMER_STATS) for seconds, 10 by
+ * default, and prints per second how many timers were armed whose start
+ * or expiry function contains pattern, "cpufreq_interactive" by default,
+ * split into deferrable ones, which never wake an idle CPU, and the
+ * others. The LOC line of /proc/interrupts gives the local timer
+ * interrupts per CPU over the same interval, i.e. how often each CPU
+ * actually woke up for a timer.
+ *
+ * Run it on an otherwise idle system with the governor selected, once
+ * on each kernel to compare. Needs root.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_CPUS	64
+
+static int read_loc(unsigned long long *loc)
+{
+	char line[4096];
+	FILE *f;
+	int n = -1;
+
+	f = fopen("/proc/interrupts", "r");
+	if (!f) {
+		perror("/proc/interrupts");
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		char *p = line, *end;
+
+		while (*p == ' ')
+			p++;
+		if (strncmp(p, "LOC:", 4))
+			continue;
+		p += 4;
+		for (n = 0; n < MAX_CPUS; n++) {
+			loc[n] = strtoull(p, &end, 10);
+			if (end == p)
+				break;
+			p = end;
+		}
+		break;
+	}
+	fclose(f);
+	if (n < 0)
+		fprintf(stderr, "no LOC line in /proc/interrupts\n");
+	return n;
+}
+
+static int write_timer_stats(const char *val)
+{
+	FILE *f;
+
+	f = fopen("/proc/timer_stats", "w");
+	if (!f || fputs(val, f) < 0 || fclose(f)) {
+		perror("/proc/timer_stats");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Entry lines look like
+ *	"  12D,     0 swapper          start_func (expire_func)"
+ * with the D present for deferrable timers.
+ */
+static int read_timer_stats(const char *pattern, unsigned long *deferrable,
+			    unsigned long *plain, unsigned long *total)
+{
+	char line[512];
+	FILE *f;
+
+	f = fopen("/proc/timer_stats", "r");
+	if (!f) {
+		perror("/proc/timer_stats");
+		return -1;
+	}
+	*deferrable = *plain = *total = 0;
+	while (fgets(line, sizeof(line), f)) {
+		unsigned long count;
+		char *end;
+
+		count = strtoul(line, &end, 10);
+		if (end == line || (*end != ',' && *end != 'D'))
+			continue;
+		*total += count;
+		if (!strstr(end, pattern))
+			continue;
+		if (*end == 'D')
+			*deferrable += count;
+		else
+			*plain += count;
+	}
+	fclose(f);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long before[MAX_CPUS], after[MAX_CPUS], sum = 0;
+	unsigned long deferrable, plain, total;
+	const char *pattern = "cpufreq_interactive";
+	unsigned int seconds = 10;
+	int opt, cpus, i;
+
+	while ((opt = getopt(argc, argv, "s:")) != -1) {
+		switch (opt) {
+		case 's':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind < argc)
+		pattern = argv[optind++];
+	if (optind < argc || !seconds)
+		goto usage;
+
+	cpus = read_loc(before);
+	if (cpus < 0 || write_timer_stats("1\n"))
+		return 1;
+	sleep(seconds);
+	if (write_timer_stats("0\n") || read_loc(after) != cpus ||
+	    read_timer_stats(pattern, &deferrable, &plain, &total))
+		return 1;
+
+	printf("timers armed/s: %s %.1f deferrable %.1f, all %.1f\n",
+	       pattern, (double)plain / seconds,
+	       (double)deferrable / seconds, (double)total / seconds);
+	printf("local timer irqs/s:");
+	for (i = 0; i < cpus; i++) {
+		printf(" cpu%d %.1f", i,
+		       (double)(after[i] - before[i]) / seconds);
+		sum += after[i] - before[i];
+	}
+	printf(", all %.1f\n", (double)sum / seconds);
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-s seconds] [pattern]\n", argv[0]);
+	return 1;
+}
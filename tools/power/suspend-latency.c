@@ -0,0 +1,201 @@
+/*
+ * suspend-latency.c -- print the suspend/resume latency records kept by
+ * CONFIG_PM_SUSPEND_LATENCY
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* $(CROSS_COMPILE)gcc -Wall -Wextra -g -o suspend-latency suspend-latency.c */
+
+/*
+ * Usage: suspend-latency [-t usecs] [-n count] [file]
+ *
+ * Prints every record of file, /sys/kernel/debug/suspend_latency by
+ * default, that took at least usecs, then the count slowest devices of
+ * each phase. A test cycle without wakeup hardware, e.g. in QEMU:
+ *
+ *	boot with test_suspend=mem (CONFIG_PM_TEST_SUSPEND)
+ *	suspend-latency -t 1000
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/suspend_latency.h>
+
+/* From <linux/pm.h>, which is not exported */
+static const struct {
+	unsigned int event;
+	const char *name;
+} events[] = {
+	{ 0x0001, "freeze" },
+	{ 0x0002, "suspend" },
+	{ 0x0004, "hibernate" },
+	{ 0x0008, "quiesce" },
+	{ 0x0010, "resume" },
+	{ 0x0020, "thaw" },
+	{ 0x0040, "restore" },
+	{ 0x0080, "recover" },
+};
+
+static const char *const types[] = {
+	[PM_LATENCY_DEVICE]		= "device",
+	[PM_LATENCY_DEVICE_NOIRQ]	= "noirq",
+	[PM_LATENCY_SUSPEND_ENTER]	= "enter",
+	[PM_LATENCY_WAKE_LOCK]		= "wakelock",
+};
+
+static const char *event_name(unsigned int event)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(events) / sizeof(events[0]); i++)
+		if (events[i].event == event)
+			return events[i].name;
+	return "?";
+}
+
+static const char *type_name(unsigned int type)
+{
+	if (type < sizeof(types) / sizeof(types[0]) && types[type])
+		return types[type];
+	return "?";
+}
+
+static struct pm_latency_record *read_records(const char *path, size_t *nr)
+{
+	struct pm_latency_record *recs = NULL;
+	size_t size = 0, len = 0;
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+
+	for (;;) {
+		if (len == size) {
+			size = size ? size * 2 : 64 * sizeof(*recs);
+			recs = realloc(recs, size);
+			if (!recs) {
+				perror("realloc");
+				break;
+			}
+		}
+		ret = read(fd, (char *)recs + len, size - len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			perror(path);
+			free(recs);
+			recs = NULL;
+			break;
+		}
+		if (!ret)
+			break;
+		len += ret;
+	}
+
+	close(fd);
+	*nr = len / sizeof(*recs);
+	return recs;
+}
+
+static int by_duration(const void *a, const void *b)
+{
+	const struct pm_latency_record *ra = a, *rb = b;
+
+	if (ra->duration_ns != rb->duration_ns)
+		return ra->duration_ns < rb->duration_ns ? 1 : -1;
+	return 0;
+}
+
+/* The slowest devices of each device phase seen */
+static void print_slowest(struct pm_latency_record *recs, size_t nr,
+			  unsigned int count)
+{
+	unsigned int type, shown;
+	size_t i;
+
+	qsort(recs, nr, sizeof(*recs), by_duration);
+
+	for (type = PM_LATENCY_DEVICE; type <= PM_LATENCY_DEVICE_NOIRQ;
+	     type++) {
+		unsigned int e;
+
+		for (e = 0; e < sizeof(events) / sizeof(events[0]); e++) {
+			shown = 0;
+			for (i = 0; i < nr && shown < count; i++) {
+				struct pm_latency_record *r = &recs[i];
+
+				if (r->type != type ||
+				    r->event != events[e].event)
+					continue;
+				if (!shown++)
+					printf("\nslowest %s %s callbacks:\n",
+					       type_name(type), events[e].name);
+				printf("%12.3f ms  %.*s\n",
+				       r->duration_ns / 1e6,
+				       PM_LATENCY_NAME_LEN, r->name);
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = "/sys/kernel/debug/suspend_latency";
+	unsigned long long threshold_ns = 0;
+	unsigned int count = 10;
+	struct pm_latency_record *recs;
+	size_t nr, i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:n:h")) != -1) {
+		switch (opt) {
+		case 't':
+			threshold_ns = strtoull(optarg, NULL, 0) * 1000;
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t usecs] [-n count] "
+				"[file]\n", argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind < argc)
+		path = argv[optind];
+
+	recs = read_records(path, &nr);
+	if (!recs)
+		return 1;
+
+	printf("%17s %-8s %-9s %12s %6s  %s\n", "time", "type", "event",
+	       "duration_ms", "error", "name");
+	for (i = 0; i < nr; i++) {
+		struct pm_latency_record *r = &recs[i];
+
+		if (r->duration_ns < threshold_ns)
+			continue;
+		printf("%17.6f %-8s %-9s %12.3f %6d  %.*s\n",
+		       r->time_ns / 1e9, type_name(r->type),
+		       event_name(r->event), r->duration_ns / 1e6, r->error,
+		       PM_LATENCY_NAME_LEN, r->name);
+	}
+
+	if (count)
+		print_slowest(recs, nr, count);
+
+	free(recs);
+	return 0;
+}
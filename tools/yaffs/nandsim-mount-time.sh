@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+# nandsim-mount-time.sh -- time yaffs2 mounts of a populated nandsim
+# image, with and without block summaries
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as
+# published by the Free Software Foundation.
+#
+# Usage: nandsim-mount-time.sh mountpoint [files [KiB]]
+#
+# For block-summary-off and then block-summary-on, starts from an empty
+# nandsim (see nandsim-yaffs.sh), writes files files of KiB each, 2000
+# of 64KiB by default, and unmounts. It then times a mount that reads
+# the checkpoint and one with no-checkpoint-read, which has to scan
+# every block, and prints the summaryScans count of the latter: blocks
+# whose tags came from their summary chunk rather than a full read.
+#
+# Assumes the nandsim mount is the only yaffs2 device, and needs GNU
+# date for the nanoseconds.
+
+set -e
+
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 mountpoint [files [KiB]]" >&2
+	exit 1
+fi
+
+mnt=$1
+files=${2:-2000}
+kib=${3:-64}
+dir=$(dirname "$0")
+
+ms_since() {
+	echo $((($(date +%s%N) - $1) / 1000000))
+}
+
+timed_mount() {
+	start=$(date +%s%N)
+	"$dir/nandsim-yaffs.sh" "$mnt" "$1"
+	ms_since "$start"
+}
+
+for summary in off on; do
+	if grep -q "NAND simulator" /proc/mtd; then
+		rmmod nandsim
+	fi
+	"$dir/nandsim-yaffs.sh" "$mnt" "block-summary-$summary"
+	i=0
+	while [ $i -lt "$files" ]; do
+		dd if=/dev/zero of="$mnt/f$i" bs=1024 count="$kib" 2>/dev/null
+		i=$((i + 1))
+	done
+	umount "$mnt"
+
+	ms=$(timed_mount "block-summary-$summary")
+	umount "$mnt"
+	echo "summaries $summary: checkpoint mount $ms ms"
+
+	ms=$(timed_mount "block-summary-$summary,no-checkpoint-read")
+	scans=$(sed -n 's/^summaryScans\.* *//p' /proc/yaffs | head -n 1)
+	umount "$mnt"
+	echo "summaries $summary: scanning mount $ms ms, $scans blocks from summaries"
+done
+
+rmmod nandsim
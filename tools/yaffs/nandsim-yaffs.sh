@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+# nandsim-yaffs.sh -- mount yaffs2 on a simulated NAND for benchmarking
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as
+# published by the Free Software Foundation.
+#
+# Usage: nandsim-yaffs.sh mountpoint [mount options]
+#        nandsim-yaffs.sh -u mountpoint
+#
+# Loads nandsim (CONFIG_MTD_NAND_NANDSIM) as a 256MiB flash with 2KiB
+# pages, unless it is already loaded, and mounts its mtdblock device on
+# mountpoint. NANDSIM_IDS overrides the ID bytes, e.g.
+# "first_id_byte=0xec second_id_byte=0xdc" for 512MiB. The flash keeps
+# its contents across unmounts until -u, which also unloads nandsim.
+
+set -e
+
+if [ "$1" = "-u" ]; then
+	umount "$2"
+	rmmod nandsim
+	exit 0
+fi
+
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 mountpoint [mount options] | -u mountpoint" >&2
+	exit 1
+fi
+
+mnt=$1
+opts=${2:-}
+
+if ! grep -q "NAND simulator" /proc/mtd; then
+	modprobe nandsim ${NANDSIM_IDS:-first_id_byte=0x20 second_id_byte=0xaa}
+fi
+mtd=$(sed -n 's/^mtd\([0-9]*\):.*"NAND simulator.*/\1/p' /proc/mtd | head -n 1)
+if [ -z "$mtd" ]; then
+	echo "$0: no nandsim mtd device" >&2
+	exit 1
+fi
+
+mkdir -p "$mnt"
+mount -t yaffs2 ${opts:+-o "$opts"} "/dev/mtdblock$mtd" "$mnt"
@@ -0,0 +1,548 @@
+/*
+ * yaffs-bench.c -- workloads for measuring yaffs2, e.g. on nandsim
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* $(CROSS_COMPILE)gcc -Wall -Wextra -O2 -g -pthread -o yaffs-bench yaffs-bench.c */
+
+/*
+ * Usage: yaffs-bench rw [-r readers] [-w writers] [-f KiB] [-s seconds] dir
+ *
+ * rw: readers threads each read their own file of KiB (1024 by default)
+ * over and over, dropping its page cache first so that every pass goes
+ * through yaffs. Meanwhile writers threads overwrite files of their own
+ * and fsync them after every pass. After seconds the read and write
+ * MB/s and the slowest single read are printed; a read stuck behind a
+ * writer or garbage collection shows up in the latter.
+ *
+ * Usage: yaffs-bench names [-n files] [-d device] dir
+ *
+ * names: creates files empty files in a new directory under dir, 5000 by
+ * default, stats them in random order, then unlinks them, and prints
+ * the operations per second of each phase. The directory index of the
+ * device, the first in /proc/yaffs or the one whose name contains
+ * device, is reported once the files exist.
+ *
+ * Usage: yaffs-bench gc [-c files] [-h files] [-f KiB] [-s seconds]
+ *		       [-d device] dir
+ *
+ * gc: writes cold files of KiB once (-c, 100 of 1024KiB by default),
+ * then for seconds overwrites random 4KiB pieces of hot files (-h, 4 by
+ * default) and fsyncs them every 64 writes. The /proc/yaffs counters
+ * of the device taken over the hot phase give the write amplification,
+ * NAND page writes per page written by the host, along with the chunks
+ * copied and blocks erased by garbage collection. Compare GC policies
+ * by mounting with gc-greedy or gc-cold-stream-off.
+ *
+ * dir should be on a yaffs2 mount; nandsim-yaffs.sh sets one up.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define IO_SIZE		(64 * 1024)
+
+struct worker {
+	pthread_t thread;
+	char path[256];
+	unsigned long long bytes;
+	unsigned long long max_ns;
+	int error;
+};
+
+static const char *device;
+static unsigned int file_kb = 1024;
+static unsigned int seconds = 10;
+static volatile int stop;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double mb_per_sec(unsigned long long bytes, unsigned long long ns)
+{
+	return bytes * 1e9 / ns / (1024 * 1024);
+}
+
+/*
+ * Look up counters of the device in /proc/yaffs, where each is printed
+ * as "name...... value". Counters not found are left at 0.
+ */
+static int read_counters(const char *const *names, unsigned long *vals,
+			 unsigned int n)
+{
+	char line[256], key[64];
+	int in_device = 0, found = 0;
+	unsigned long val;
+	unsigned int i;
+	FILE *f;
+
+	memset(vals, 0, n * sizeof(*vals));
+	f = fopen("/proc/yaffs", "r");
+	if (!f) {
+		perror("/proc/yaffs");
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "Device ", 7)) {
+			if (found)
+				break;
+			in_device = !device || strstr(line, device);
+			found = in_device;
+			continue;
+		}
+		if (!in_device ||
+		    sscanf(line, "%63[^. ]%*[. ]%lu", key, &val) != 2)
+			continue;
+		for (i = 0; i < n; i++)
+			if (!strcmp(key, names[i]))
+				vals[i] = val;
+	}
+	fclose(f);
+	if (!found) {
+		fprintf(stderr, "no yaffs device %s\n", device ? device : "");
+		return -1;
+	}
+	return 0;
+}
+
+static int write_file(int fd, char *buf, unsigned long long *bytes)
+{
+	off_t off, size = (off_t)file_kb * 1024;
+	size_t len;
+
+	for (off = 0; off < size && !stop; off += len) {
+		len = size - off < IO_SIZE ? size - off : IO_SIZE;
+		if (pwrite(fd, buf, len, off) != (ssize_t)len) {
+			perror("pwrite");
+			return -1;
+		}
+		if (bytes)
+			*bytes += len;
+	}
+	if (fsync(fd)) {
+		perror("fsync");
+		return -1;
+	}
+	return 0;
+}
+
+static int create_file(const char *path, char *buf)
+{
+	int fd, ret;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(path);
+		return -1;
+	}
+	ret = write_file(fd, buf, NULL);
+	close(fd);
+	return ret;
+}
+
+static void *reader_thread(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long long start, ns;
+	char *buf;
+	ssize_t ret;
+	int fd;
+
+	buf = malloc(IO_SIZE);
+	fd = open(w->path, O_RDONLY);
+	if (!buf || fd < 0) {
+		perror(w->path);
+		w->error = 1;
+		return NULL;
+	}
+
+	while (!stop) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		if (lseek(fd, 0, SEEK_SET) < 0)
+			break;
+		do {
+			start = now_ns();
+			ret = read(fd, buf, IO_SIZE);
+			ns = now_ns() - start;
+			if (ret < 0) {
+				perror("read");
+				w->error = 1;
+				break;
+			}
+			w->bytes += ret;
+			if (ns > w->max_ns)
+				w->max_ns = ns;
+		} while (ret > 0 && !stop);
+		if (w->error)
+			break;
+	}
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct worker *w = arg;
+	char *buf;
+	int fd;
+
+	buf = malloc(IO_SIZE);
+	fd = open(w->path, O_WRONLY | O_CREAT, 0644);
+	if (!buf || fd < 0) {
+		perror(w->path);
+		w->error = 1;
+		return NULL;
+	}
+
+	while (!stop) {
+		memset(buf, (int)w->bytes, IO_SIZE);
+		if (write_file(fd, buf, &w->bytes)) {
+			w->error = 1;
+			break;
+		}
+	}
+
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static int bench_rw(int argc, char *argv[])
+{
+	unsigned int nr_readers = 2, nr_writers = 1, i;
+	unsigned long long start, elapsed, rd = 0, wr = 0, max_ns = 0;
+	struct worker *workers;
+	char buf[IO_SIZE];
+	int opt, error = 0;
+
+	while ((opt = getopt(argc, argv, "r:w:f:s:")) != -1) {
+		switch (opt) {
+		case 'r':
+			nr_readers = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			nr_writers = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			file_kb = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			return -1;
+		}
+	}
+	if (optind + 1 != argc || !(nr_readers + nr_writers) || !file_kb)
+		return -1;
+
+	workers = calloc(nr_readers + nr_writers, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		return 1;
+	}
+
+	memset(buf, 'r', sizeof(buf));
+	for (i = 0; i < nr_readers + nr_writers; i++) {
+		snprintf(workers[i].path, sizeof(workers[i].path), "%s/%s.%u",
+			 argv[optind], i < nr_readers ? "read" : "write", i);
+		if (i < nr_readers && create_file(workers[i].path, buf))
+			return 1;
+	}
+	sync();
+
+	start = now_ns();
+	for (i = 0; i < nr_readers + nr_writers; i++) {
+		if (pthread_create(&workers[i].thread, NULL,
+				   i < nr_readers ? reader_thread : writer_thread,
+				   &workers[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			return 1;
+		}
+	}
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nr_readers + nr_writers; i++) {
+		pthread_join(workers[i].thread, NULL);
+		error |= workers[i].error;
+		if (i < nr_readers) {
+			rd += workers[i].bytes;
+			if (workers[i].max_ns > max_ns)
+				max_ns = workers[i].max_ns;
+		} else {
+			wr += workers[i].bytes;
+		}
+	}
+	elapsed = now_ns() - start;
+
+	for (i = 0; i < nr_readers + nr_writers; i++)
+		unlink(workers[i].path);
+
+	printf("readers %u writers %u file %u KiB\n",
+	       nr_readers, nr_writers, file_kb);
+	printf("read %.1f MB/s write %.1f MB/s slowest read %llu us\n",
+	       mb_per_sec(rd, elapsed), mb_per_sec(wr, elapsed),
+	       max_ns / 1000);
+	return error;
+}
+
+static void print_rate(const char *what, unsigned int n,
+		       unsigned long long ns)
+{
+	printf("%s %.0f/s", what, n * 1e9 / ns);
+}
+
+static int bench_names(int argc, char *argv[])
+{
+	static const char *const counters[] = {
+		"nDirIndexes", "dirIndexBytes",
+	};
+	unsigned long vals[2];
+	unsigned int nr_files = 5000, i, j, tmp, *order;
+	unsigned long long start;
+	char dir[256], path[300];
+	struct stat st;
+	int opt, fd, have_counters;
+
+	while ((opt = getopt(argc, argv, "n:d:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_files = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		default:
+			return -1;
+		}
+	}
+	if (optind + 1 != argc || !nr_files)
+		return -1;
+
+	order = malloc(nr_files * sizeof(*order));
+	if (!order) {
+		perror("malloc");
+		return 1;
+	}
+	for (i = 0; i < nr_files; i++)
+		order[i] = i;
+	srand(1);
+	for (i = nr_files - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	snprintf(dir, sizeof(dir), "%s/names.%d", argv[optind], getpid());
+	if (mkdir(dir, 0755)) {
+		perror(dir);
+		return 1;
+	}
+
+	start = now_ns();
+	for (i = 0; i < nr_files; i++) {
+		snprintf(path, sizeof(path), "%s/file-%u", dir, i);
+		fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (fd < 0) {
+			perror(path);
+			return 1;
+		}
+		close(fd);
+	}
+	print_rate("create", nr_files, now_ns() - start);
+
+	start = now_ns();
+	for (i = 0; i < nr_files; i++) {
+		snprintf(path, sizeof(path), "%s/file-%u", dir, order[i]);
+		if (stat(path, &st)) {
+			perror(path);
+			return 1;
+		}
+	}
+	print_rate(" stat", nr_files, now_ns() - start);
+
+	have_counters = !read_counters(counters, vals, 2);
+
+	start = now_ns();
+	for (i = 0; i < nr_files; i++) {
+		snprintf(path, sizeof(path), "%s/file-%u", dir, order[i]);
+		if (unlink(path)) {
+			perror(path);
+			return 1;
+		}
+	}
+	print_rate(" unlink", nr_files, now_ns() - start);
+	rmdir(dir);
+
+	printf("\n");
+	if (have_counters)
+		printf("files %u dir indexes %lu using %lu bytes\n",
+		       nr_files, vals[0], vals[1]);
+	return 0;
+}
+
+static int bench_gc(int argc, char *argv[])
+{
+	static const char *const counters[] = {
+		"nPageWrites", "nHostWrites", "nGCCopies", "nBlockErasures",
+		"backgroundGCs",
+	};
+	unsigned long before[5], after[5], d[5];
+	unsigned int nr_cold = 100, nr_hot = 4, i;
+	unsigned long long start, elapsed, writes = 0;
+	char path[300], buf[IO_SIZE];
+	unsigned int seed = 1;
+	off_t pieces;
+	int opt, *fds;
+
+	while ((opt = getopt(argc, argv, "c:h:f:s:d:")) != -1) {
+		switch (opt) {
+		case 'c':
+			nr_cold = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+			nr_hot = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			file_kb = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		default:
+			return -1;
+		}
+	}
+	if (optind + 1 != argc || !nr_hot || file_kb < 4)
+		return -1;
+	pieces = file_kb / 4;
+
+	fds = calloc(nr_hot, sizeof(*fds));
+	if (!fds) {
+		perror("calloc");
+		return 1;
+	}
+
+	memset(buf, 'c', sizeof(buf));
+	for (i = 0; i < nr_cold; i++) {
+		snprintf(path, sizeof(path), "%s/cold.%u", argv[optind], i);
+		if (create_file(path, buf))
+			return 1;
+	}
+	memset(buf, 'h', sizeof(buf));
+	for (i = 0; i < nr_hot; i++) {
+		snprintf(path, sizeof(path), "%s/hot.%u", argv[optind], i);
+		if (create_file(path, buf))
+			return 1;
+		fds[i] = open(path, O_WRONLY);
+		if (fds[i] < 0) {
+			perror(path);
+			return 1;
+		}
+	}
+	sync();
+
+	if (read_counters(counters, before, 5))
+		return 1;
+
+	start = now_ns();
+	while (now_ns() - start < seconds * 1000000000ULL) {
+		int fd = fds[rand_r(&seed) % nr_hot];
+		off_t off = (rand_r(&seed) % pieces) * 4096;
+
+		buf[0] = writes;
+		if (pwrite(fd, buf, 4096, off) != 4096) {
+			perror("pwrite");
+			return 1;
+		}
+		if (++writes % 64 == 0 && fsync(fd)) {
+			perror("fsync");
+			return 1;
+		}
+	}
+	for (i = 0; i < nr_hot; i++) {
+		fsync(fds[i]);
+		close(fds[i]);
+	}
+	elapsed = now_ns() - start;
+
+	if (read_counters(counters, after, 5))
+		return 1;
+	/* The counters are 32 bits wide in the kernel */
+	for (i = 0; i < 5; i++)
+		d[i] = (unsigned int)(after[i] - before[i]);
+
+	printf("cold %u hot %u file %u KiB: %.1f MB/s written\n",
+	       nr_cold, nr_hot, file_kb, mb_per_sec(writes * 4096, elapsed));
+	printf("page writes %lu host writes %lu", d[0], d[1]);
+	if (d[1])
+		printf(" write amplification %.2f", (double)d[0] / d[1]);
+	printf("\ngc copies %lu erasures %lu background gcs %lu\n",
+	       d[2], d[3], d[4]);
+
+	for (i = 0; i < nr_cold + nr_hot; i++) {
+		if (i < nr_cold)
+			snprintf(path, sizeof(path), "%s/cold.%u",
+				 argv[optind], i);
+		else
+			snprintf(path, sizeof(path), "%s/hot.%u",
+				 argv[optind], i - nr_cold);
+		unlink(path);
+	}
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	int (*fn)(int argc, char *argv[]);
+	const char *usage;
+} benches[] = {
+	{ "rw", bench_rw,
+	  "rw [-r readers] [-w writers] [-f KiB] [-s seconds] dir" },
+	{ "names", bench_names, "names [-n files] [-d device] dir" },
+	{ "gc", bench_gc,
+	  "gc [-c files] [-h files] [-f KiB] [-s seconds] [-d device] dir" },
+};
+
+int main(int argc, char *argv[])
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; argc > 1 && i < sizeof(benches) / sizeof(benches[0]); i++) {
+		if (strcmp(argv[1], benches[i].name))
+			continue;
+		ret = benches[i].fn(argc - 1, argv + 1);
+		if (ret >= 0)
+			return ret;
+		fprintf(stderr, "Usage: %s %s\n", argv[0], benches[i].usage);
+		return 1;
+	}
+
+	fprintf(stderr, "Usage:\n");
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+		fprintf(stderr, "\t%s %s\n", argv[0], benches[i].usage);
+	return 1;
+}
@@ -0,0 +1,278 @@
+/*
+ * zram-bench.c -- read and write a zram device from several threads and
+ * report the throughput
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* $(CROSS_COMPILE)gcc -Wall -Wextra -O2 -g -pthread -o zram-bench zram-bench.c */
+
+/*
+ * Usage: zram-bench [-t threads] [-b bytes] [-f percent] [-r percent]
+ *		     [-s seconds] [device]
+ *
+ * The device, /dev/zram0 by default, must already be initialized, e.g.
+ * with zramconfig /dev/zram0 --disksize_kb=262144 --init. Its contents
+ * are overwritten.
+ *
+ * Each of threads owns an equal slice of the device. It first writes the
+ * whole slice once, in blocks of bytes (4096 by default), then does
+ * random reads and writes within it for seconds, percent of them reads
+ * as given by -r (70 by default). The first -f percent of every block
+ * written is random and the rest zero, which sets how well it compresses
+ * (50 by default); 0 only exercises the same-filled page path. I/O is
+ * O_DIRECT so every request reaches the driver.
+ *
+ * Prints MB/s for the initial fill and for reads and writes of the
+ * mixed phase. Compare -t 1 with -t <ncpus>.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/fs.h>
+
+struct worker {
+	pthread_t thread;
+	unsigned int seed;
+	off_t start;
+	off_t len;
+	unsigned long long fill_bytes;
+	unsigned long long read_bytes;
+	unsigned long long write_bytes;
+	int error;
+};
+
+static const char *device = "/dev/zram0";
+static unsigned int nr_threads = 2;
+static size_t block = 4096;
+static unsigned int fill_pct = 50;
+static unsigned int read_pct = 70;
+static unsigned int seconds = 10;
+static volatile int stop;
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void fill_block(char *buf, unsigned int *seed)
+{
+	size_t random_len = block * fill_pct / 100;
+	size_t i;
+
+	for (i = 0; i < random_len; i++)
+		buf[i] = rand_r(seed);
+	memset(buf + random_len, 0, block - random_len);
+}
+
+static int do_io(int fd, char *buf, off_t off, int write)
+{
+	ssize_t ret;
+
+	if (write)
+		ret = pwrite(fd, buf, block, off);
+	else
+		ret = pread(fd, buf, block, off);
+	if (ret != (ssize_t)block) {
+		perror(write ? "pwrite" : "pread");
+		return -1;
+	}
+	return 0;
+}
+
+static void *fill_thread(void *arg)
+{
+	struct worker *w = arg;
+	off_t off;
+	char *buf;
+	int fd;
+
+	fd = open(device, O_RDWR | O_DIRECT);
+	if (fd < 0 || posix_memalign((void **)&buf, 4096, block)) {
+		perror(device);
+		w->error = 1;
+		return NULL;
+	}
+
+	for (off = w->start; off < w->start + w->len; off += block) {
+		fill_block(buf, &w->seed);
+		if (do_io(fd, buf, off, 1)) {
+			w->error = 1;
+			break;
+		}
+		w->fill_bytes += block;
+	}
+
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+static void *mixed_thread(void *arg)
+{
+	struct worker *w = arg;
+	off_t nr_blocks = w->len / block;
+	off_t off;
+	char *buf;
+	int fd, write;
+
+	fd = open(device, O_RDWR | O_DIRECT);
+	if (fd < 0 || posix_memalign((void **)&buf, 4096, block)) {
+		perror(device);
+		w->error = 1;
+		return NULL;
+	}
+
+	while (!stop) {
+		off = w->start + (rand_r(&w->seed) % nr_blocks) * block;
+		write = (unsigned int)rand_r(&w->seed) % 100 >= read_pct;
+		if (write)
+			fill_block(buf, &w->seed);
+		if (do_io(fd, buf, off, write)) {
+			w->error = 1;
+			break;
+		}
+		if (write)
+			w->write_bytes += block;
+		else
+			w->read_bytes += block;
+	}
+
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+static int run(struct worker *workers, void *(*fn)(void *))
+{
+	unsigned int i;
+	int error = 0;
+
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&workers[i].thread, NULL, fn,
+				   &workers[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+	}
+	if (fn == mixed_thread) {
+		sleep(seconds);
+		stop = 1;
+	}
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		error |= workers[i].error;
+	}
+	return error;
+}
+
+static double mb_per_sec(unsigned long long bytes, unsigned long long ns)
+{
+	return bytes * 1e9 / ns / (1024 * 1024);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long long start, fill_ns, mixed_ns;
+	unsigned long long fill = 0, rd = 0, wr = 0;
+	struct worker *workers;
+	uint64_t size;
+	off_t slice;
+	unsigned int i;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "t:b:f:r:s:")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			block = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			fill_pct = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			read_pct = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seconds = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind < argc)
+		device = argv[optind++];
+	if (optind < argc || !nr_threads || !block || block % 4096 ||
+	    fill_pct > 100 || read_pct > 100)
+		goto usage;
+
+	fd = open(device, O_RDONLY);
+	if (fd < 0 || ioctl(fd, BLKGETSIZE64, &size) < 0) {
+		perror(device);
+		return 1;
+	}
+	close(fd);
+
+	slice = size / nr_threads / block * block;
+	if (!slice) {
+		fprintf(stderr, "%s: too small for %u threads\n",
+			device, nr_threads);
+		return 1;
+	}
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].seed = i + 1;
+		workers[i].start = i * slice;
+		workers[i].len = slice;
+	}
+
+	start = now_ns();
+	if (run(workers, fill_thread))
+		return 1;
+	fill_ns = now_ns() - start;
+
+	start = now_ns();
+	if (run(workers, mixed_thread))
+		return 1;
+	mixed_ns = now_ns() - start;
+
+	for (i = 0; i < nr_threads; i++) {
+		fill += workers[i].fill_bytes;
+		rd += workers[i].read_bytes;
+		wr += workers[i].write_bytes;
+	}
+
+	printf("threads %u block %zu random %u%% reads %u%%\n",
+	       nr_threads, block, fill_pct, read_pct);
+	printf("fill %.1f MB/s\n", mb_per_sec(fill, fill_ns));
+	printf("mixed read %.1f MB/s write %.1f MB/s\n",
+	       mb_per_sec(rd, mixed_ns), mb_per_sec(wr, mixed_ns));
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-t threads] [-b bytes] [-f percent] "
+		"[-r percent] [-s seconds] [device]\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,187 @@
+/*
+ * zram-trace.c -- replay a trace of page writes on a zram device and
+ * report how much memory the stored objects take
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* $(CROSS_COMPILE)gcc -Wall -Wextra -O2 -g -o zram-trace zram-trace.c */
+
+/*
+ * Usage: zram-trace [-c] [trace [device]]
+ *
+ * Each line of the trace, standard input by default, is
+ *
+ *	<page> <bytes>
+ *
+ * and writes page number page of device, /dev/zram0 by default, with
+ * bytes of random data followed by zeroes, so that it compresses to
+ * roughly bytes. A page of 0 bytes is stored as a same-filled page,
+ * which frees whatever the page held: that is how a trace frees objects,
+ * the way swap slot free notifications would. The device must be
+ * initialized and large enough for the highest page.
+ *
+ * At the end the driver's stats are printed: data stored, its
+ * compressed size and the memory used to hold it. With -c the
+ * ZRAMIO_COMPACT ioctl is then issued until it frees nothing and the
+ * memory used is printed again.
+ *
+ * The stats ioctl of kernels still using xvmalloc is also understood,
+ * so the same trace replayed on both kernels compares the allocators.
+ * A trace of uniformly distributed sizes, for example:
+ *
+ *	awk 'BEGIN { srand(1); for (i = 0; i < 200000; i++)
+ *		print int(rand() * 16384), int(rand() * 4096) }' > trace
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+/* Not exported to userspace */
+#include "../../drivers/staging/zram/zram_ioctl.h"
+
+/* The leading part of the stats, as xvmalloc kernels report them */
+struct zram_ioctl_stats_xv {
+	u64 disksize;
+	u64 num_reads;
+	u64 num_writes;
+	u64 failed_reads;
+	u64 failed_writes;
+	u64 invalid_io;
+	u64 notify_free;
+	u32 pages_zero;
+	u32 good_compress_pct;
+	u32 pages_expand_pct;
+	u32 pages_stored;
+	u32 pages_used;
+	u64 orig_data_size;
+	u64 compr_data_size;
+	u64 mem_used_total;
+} __attribute__ ((packed, aligned(4)));
+
+#define ZRAMIO_GET_STATS_XV	_IOR('z', 1, struct zram_ioctl_stats_xv)
+
+#define PAGE_SIZE	4096
+
+static int get_stats(int fd, struct zram_ioctl_stats *s)
+{
+	memset(s, 0, sizeof(*s));
+	if (!ioctl(fd, ZRAMIO_GET_STATS, s))
+		return 0;
+	if (errno == ENOTTY || errno == EINVAL)
+		return ioctl(fd, ZRAMIO_GET_STATS_XV, s);
+	return -1;
+}
+
+static void print_stats(const char *what, const struct zram_ioctl_stats *s)
+{
+	printf("%s: orig %llu KB compr %llu KB used %llu KB",
+	       what, (unsigned long long)s->orig_data_size >> 10,
+	       (unsigned long long)s->compr_data_size >> 10,
+	       (unsigned long long)s->mem_used_total >> 10);
+	if (s->mem_used_total)
+		printf(" (compr/used %llu%%)",
+		       (unsigned long long)s->compr_data_size * 100 /
+		       s->mem_used_total);
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *trace = "-", *device = "/dev/zram0";
+	struct zram_ioctl_stats stats;
+	unsigned long page, bytes, line = 0, writes = 0;
+	unsigned int seed = 1;
+	char *buf;
+	FILE *in;
+	int fd, opt, compact = 0, freed;
+	size_t i;
+
+	while ((opt = getopt(argc, argv, "c")) != -1) {
+		switch (opt) {
+		case 'c':
+			compact = 1;
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind < argc)
+		trace = argv[optind++];
+	if (optind < argc)
+		device = argv[optind++];
+	if (optind < argc)
+		goto usage;
+
+	in = strcmp(trace, "-") ? fopen(trace, "r") : stdin;
+	if (!in) {
+		perror(trace);
+		return 1;
+	}
+	fd = open(device, O_RDWR | O_DIRECT);
+	if (fd < 0 || posix_memalign((void **)&buf, PAGE_SIZE, PAGE_SIZE)) {
+		perror(device);
+		return 1;
+	}
+
+	while (fscanf(in, "%lu %lu", &page, &bytes) == 2) {
+		line++;
+		if (bytes > PAGE_SIZE) {
+			fprintf(stderr, "%s:%lu: more than a page\n",
+				trace, line);
+			return 1;
+		}
+		for (i = 0; i < bytes; i++)
+			buf[i] = rand_r(&seed);
+		memset(buf + bytes, 0, PAGE_SIZE - bytes);
+		if (pwrite(fd, buf, PAGE_SIZE, (off_t)page * PAGE_SIZE) !=
+		    PAGE_SIZE) {
+			fprintf(stderr, "%s:%lu: ", trace, line);
+			perror("pwrite");
+			return 1;
+		}
+		writes++;
+	}
+	if (!feof(in)) {
+		fprintf(stderr, "%s:%lu: bad line\n", trace, line + 1);
+		return 1;
+	}
+
+	if (get_stats(fd, &stats)) {
+		perror("ZRAMIO_GET_STATS");
+		return 1;
+	}
+	printf("%lu writes\n", writes);
+	print_stats("replayed", &stats);
+
+	if (compact) {
+		while ((freed = ioctl(fd, ZRAMIO_COMPACT)) > 0)
+			;
+		if (freed < 0) {
+			perror("ZRAMIO_COMPACT");
+			return 1;
+		}
+		if (get_stats(fd, &stats)) {
+			perror("ZRAMIO_GET_STATS");
+			return 1;
+		}
+		print_stats("compacted", &stats);
+	}
+	return 0;
+
+usage:
+	fprintf(stderr, "Usage: %s [-c] [trace [device]]\n", argv[0]);
+	return 1;
+}